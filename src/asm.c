@@ -0,0 +1,1085 @@
+#include <ctype.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "asm.h"
+#include "cpu6502.h"
+#include "ef.h"
+#include "obj.h"
+
+#define ASM_MAX_SEGMENTS 	64
+#define ASM_MAX_SEGMENT_LEN	0xFFFF 	// lengths are 16-bit, longer runs are split
+#define ASM_MODES 			(AM_REL + 1)
+
+/*
+ * Mnemonics, generated from opcodes.def. Every name there starts with
+ * the three letter mnemonic, so a mnemonic is looked up by its letters
+ * packed into 15 bits.
+ */
+typedef struct asm_mnemonic
+{
+	char name[4];
+	short code[ASM_MODES]; 	// opcode per addr_mode_t, -1 if the mode does not exist
+} asm_mnemonic_t;
+
+static asm_mnemonic_t asm_mnemonics[64];
+static byte asm_index[1 << 15]; 	// packed letters -> index into asm_mnemonics + 1
+static pthread_once_t asm_once = PTHREAD_ONCE_INIT;
+
+static int asm_key(const char *s)
+{
+	int key = 0;
+	for(int i = 0; i < 3; i++)
+	{
+		const int c = tolower((unsigned char) s[i]) - 'a';
+		if(c < 0 || c >= 26)
+			return -1;
+		key = key << 5 | c;
+	}
+	return key;
+}
+
+static void asm_build_mnemonics(void)
+{
+	static const struct { const char *name; byte code, mode; } ops[] =
+	{
+#define OP(name, code, mode, cycles) { #name, code, AM_##mode },
+#include "opcodes.def"
+	};
+
+	unsigned n = 0;
+	for(size_t i = 0; i < sizeof ops / sizeof *ops; i++)
+	{
+		const int key = asm_key(ops[i].name);
+		if(!asm_index[key])
+		{
+			asm_mnemonic_t *mn = &asm_mnemonics[n];
+			for(int k = 0; k < 3; k++)
+				mn->name[k] = tolower((unsigned char) ops[i].name[k]);
+			for(int m = 0; m < ASM_MODES; m++)
+				mn->code[m] = -1;
+			asm_index[key] = ++n;
+		}
+		asm_mnemonics[asm_index[key] - 1].code[ops[i].mode] = ops[i].code;
+	}
+}
+
+static const asm_mnemonic_t *asm_find_mnemonic(const char *s, size_t len)
+{
+	if(len != 3)
+		return NULL;
+	const int key = asm_key(s);
+	return key < 0 || !asm_index[key] ? NULL : &asm_mnemonics[asm_index[key] - 1];
+}
+
+static const char *const asm_mode_names[ASM_MODES] =
+{
+	[AM_IMP] = "implied", [AM_ACC] = "accumulator", [AM_IMM] = "immediate",
+	[AM_ZP] = "zero page", [AM_ZPX] = "zero page,x", [AM_ZPY] = "zero page,y",
+	[AM_ABS] = "absolute", [AM_ABSX] = "absolute,x", [AM_ABSY] = "absolute,y",
+	[AM_IND] = "indirect", [AM_INDX] = "indexed indirect", [AM_INDY] = "indirect indexed",
+	[AM_REL] = "relative"
+};
+
+// Where a value lies: a plain number, an offset into the text section,
+// or an offset from an external symbol, given by its index
+#define ASM_ABSOLUTE 	-1
+#define ASM_TEXT 		-2
+
+// Part of a relocatable value taken with < or >
+#define ASM_WHOLE 		0
+#define ASM_LOW 		1
+#define ASM_HIGH 		2
+
+typedef struct asm_value
+{
+	long n;
+	long base; 		// ASM_ABSOLUTE, ASM_TEXT or a symbol index
+	byte part;
+} asm_value_t;
+
+typedef struct asm_symbol
+{
+	const char *name; 	// points into the source
+	byte len;
+	asm_value_t value;
+	unsigned pass; 		// pass that last defined it, 0 if only referenced
+	bool known; 		// value did not depend on undefined symbols
+	bool external; 		// used but not defined, another unit has to
+	bool global; 		// named by .global
+} asm_symbol_t;
+
+typedef struct asm_state
+{
+	asm_error_t *err;
+	unsigned line;
+
+	// Passes run until no symbol moves and no operand grows, then one
+	// final pass emits the code with every value known
+	unsigned pass;
+	bool final;
+	bool changed; 				// something moved during this pass
+	bool unknown; 				// the last expression used an undefined symbol
+
+	// Symbols in order of first use, with an open addressing hash index
+	asm_symbol_t *syms;
+	size_t nsyms, sym_cap;
+	uint32_t *index; 			// 1 + position in syms, 0 for a free slot
+	size_t index_cap; 			// power of two
+
+	// Per operand that could be zero page, set once it turned out not to
+	// fit. Operands only ever grow, so the passes settle.
+	byte *wide;
+	size_t nwide, operand;
+
+	uint32_t pc; 				// may run one past MEM_MAX, caught on the next byte
+	bool text; 					// before the first .org, pc is an offset into the text
+	bool open; 					// bytes go to the last absolute segment
+	bool has_entry; 			// the first instruction, or .entry
+	bool explicit_entry; 		// set by .entry, which wins
+	byte *code; 				// MEM_SIZE bytes of text
+	byte *image; 				// MEM_SIZE bytes, the absolute segments point into it
+	byte used[MEM_SIZE / 8]; 	// bit per address already assembled to
+	ef_segment segs[ASM_MAX_SEGMENTS]; 	// [0] is the text
+	word nsegs;
+
+	obj_reloc *relocs;
+	size_t nrelocs, reloc_cap;
+	obj_file obj;
+} asm_t;
+
+static int asm_fail(asm_t *as, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	as->err->line = as->line;
+	vsnprintf(as->err->msg, sizeof as->err->msg, fmt, ap);
+	va_end(ap);
+	return -1;
+}
+
+// `value` is ASM_ABSOLUTE or ASM_TEXT
+static void asm_set_entry(asm_t *as, const asm_value_t *value)
+{
+	as->obj.obj_flags |= OBJ_HAS_ENTRY;
+	as->obj.obj_entry = value->n;
+	as->obj.obj_entry_section = value->base == ASM_TEXT ? OBJ_TEXT : OBJ_ABSOLUTE;
+	as->has_entry = true;
+}
+
+static int asm_emit(asm_t *as, byte data)
+{
+	if(!as->final)
+	{
+		as->pc++;
+		return 0;
+	}
+	if(as->pc > MEM_MAX)
+		return asm_fail(as, "code runs past the end of memory");
+
+	if(as->text)
+	{
+		if(as->segs[0].len == ASM_MAX_SEGMENT_LEN)
+			return asm_fail(as, "text is longer than %d bytes", ASM_MAX_SEGMENT_LEN);
+		as->code[as->pc++] = data;
+		as->segs[0].len++;
+		return 0;
+	}
+
+	if(as->used[as->pc / 8] & (1 << as->pc % 8))
+		return asm_fail(as, "code overlaps earlier code at $%04x", as->pc);
+	if(!as->open || as->segs[as->nsegs - 1].len == ASM_MAX_SEGMENT_LEN)
+	{
+		if(as->nsegs == ASM_MAX_SEGMENTS)
+			return asm_fail(as, "more than %d segments", ASM_MAX_SEGMENTS - 1);
+		as->segs[as->nsegs++] = (ef_segment) { as->pc, 0, as->image + as->pc };
+		as->open = true;
+	}
+
+	as->image[as->pc] = data;
+	as->used[as->pc / 8] |= 1 << as->pc % 8;
+	as->segs[as->nsegs - 1].len++;
+	as->pc++;
+	return 0;
+}
+
+/*
+ * Symbol table
+ */
+
+static uint32_t asm_hash(const char *name, size_t len)
+{
+	uint32_t h = 0x811c9dc5;
+	for(size_t i = 0; i < len; i++)
+		h = (h ^ (byte) name[i]) * 0x01000193;
+	return h;
+}
+
+static uint32_t *asm_slot(asm_t *as, const char *name, size_t len)
+{
+	const size_t mask = as->index_cap - 1;
+	for(size_t i = asm_hash(name, len) & mask;; i = (i + 1) & mask)
+	{
+		uint32_t *slot = &as->index[i];
+		if(!*slot)
+			return slot;
+		const asm_symbol_t *sym = &as->syms[*slot - 1];
+		if(sym->len == len && memcmp(sym->name, name, len) == 0)
+			return slot;
+	}
+}
+
+static int asm_grow_symbols(asm_t *as)
+{
+	if(as->nsyms == as->sym_cap)
+	{
+		const size_t cap = as->sym_cap ? 2 * as->sym_cap : 64;
+		asm_symbol_t *syms = realloc(as->syms, cap * sizeof *syms);
+		if(!syms)
+			return -1;
+		as->syms = syms;
+		as->sym_cap = cap;
+	}
+
+	// keep the index at most half full
+	if(2 * (as->nsyms + 1) > as->index_cap)
+	{
+		const size_t cap = as->index_cap ? 2 * as->index_cap : 128;
+		uint32_t *index = calloc(cap, sizeof *index);
+		if(!index)
+			return -1;
+		free(as->index);
+		as->index = index;
+		as->index_cap = cap;
+		for(size_t i = 0; i < as->nsyms; i++)
+			*asm_slot(as, as->syms[i].name, as->syms[i].len) = i + 1;
+	}
+	return 0;
+}
+
+// Created on first use. Fails the line on a bad name or out of memory.
+static asm_symbol_t *asm_symbol(asm_t *as, const char *name, size_t len)
+{
+	if(as->index_cap)
+	{
+		const uint32_t *slot = asm_slot(as, name, len);
+		if(*slot)
+			return &as->syms[*slot - 1];
+	}
+	if(len > 0xFF)
+	{
+		asm_fail(as, "symbol name longer than 255 characters");
+		return NULL;
+	}
+	if(as->nsyms == 0xFFFF || asm_grow_symbols(as) < 0)
+	{
+		asm_fail(as, as->nsyms == 0xFFFF ? "more than 65535 symbols" : "out of memory");
+		return NULL;
+	}
+
+	asm_symbol_t *sym = &as->syms[as->nsyms++];
+	*sym = (asm_symbol_t) { name, len, { 0, ASM_ABSOLUTE, ASM_WHOLE }, 0, false, false, false };
+	*asm_slot(as, name, len) = as->nsyms;
+	return sym;
+}
+
+static int asm_define(asm_t *as, const char *name, size_t len, const asm_value_t *value, bool known)
+{
+	asm_symbol_t *sym = asm_symbol(as, name, len);
+	if(!sym)
+		return -1;
+	if(sym->pass == as->pass)
+		return asm_fail(as, "'%.*s' defined twice", (int) len, name);
+	if(value->base >= 0)
+		return asm_fail(as, "'%.*s' cannot be defined by an external symbol", (int) len, name);
+	if(value->part != ASM_WHOLE)
+		return asm_fail(as, "'%.*s' cannot be defined by < or > of a label", (int) len, name);
+
+	// the value of a symbol that is not known yet does not matter
+	as->changed |= !sym->pass || sym->known != known
+		|| (known && (sym->value.n != value->n || sym->value.base != value->base));
+	sym->value = *value;
+	sym->pass = as->pass;
+	sym->known = known;
+	return 0;
+}
+
+/*
+ * Expressions
+ *
+ * C operators on longs, from loosest to tightest: | ^ & << >> + - * /
+ * Unary - ~ < (low byte) > (high byte), parentheses, numbers, symbols
+ * and * for the address of the current statement. A symbol defined
+ * further down has its value from the previous pass.
+ *
+ * Labels in the text section and external symbols are only known to
+ * the linker. An expression may add a number to one of them or take the
+ * difference of two labels in the same section, and < or > may be
+ * applied last.
+ */
+
+static const char *asm_skip_space(const char *p, const char *e)
+{
+	while(p < e && isspace((unsigned char) *p))
+		p++;
+	return p;
+}
+
+static bool asm_ident_start(char c)
+{
+	return isalpha((unsigned char) c) || c == '_';
+}
+
+static const char *asm_ident_end(const char *p, const char *e)
+{
+	while(p < e && (isalnum((unsigned char) *p) || *p == '_'))
+		p++;
+	return p;
+}
+
+static int asm_number(asm_t *as, const char **pp, const char *e, long *value)
+{
+	const char *p = *pp;
+	int base = 10;
+	if(p < e && *p == '$')
+	{
+		base = 16;
+		p++;
+	}
+	else if(e - p > 2 && p[0] == '0' && tolower((unsigned char) p[1]) == 'x')
+	{
+		base = 16;
+		p += 2;
+	}
+
+	const char *digits = p;
+	long v = 0;
+	for(; p < e && isxdigit((unsigned char) *p); p++)
+	{
+		const int d = isdigit((unsigned char) *p) ? *p - '0' : tolower((unsigned char) *p) - 'a' + 10;
+		if(d >= base)
+			break;
+		if(v > 0xFFFFFF)
+			return asm_fail(as, "number out of range");
+		v = v * base + d;
+	}
+	if(p == digits)
+		return asm_fail(as, "number expected");
+
+	*value = v;
+	*pp = p;
+	return 0;
+}
+
+static int asm_absolute(asm_t *as, const asm_value_t *v, char op)
+{
+	if(v->base != ASM_ABSOLUTE)
+		return asm_fail(as, "'%c' needs a value known before linking", op);
+	return 0;
+}
+
+static int asm_expr_prec(asm_t *as, const char **pp, const char *e, int min_prec, asm_value_t *value);
+
+static int asm_unary(asm_t *as, const char **pp, const char *e, asm_value_t *value)
+{
+	const char *p = asm_skip_space(*pp, e);
+	if(p == e)
+		return asm_fail(as, "expression expected");
+
+	const char op = *p;
+	switch(op)
+	{
+	case '-':
+	case '~':
+		*pp = p + 1;
+		if(asm_unary(as, pp, e, value) < 0 || asm_absolute(as, value, op) < 0)
+			return -1;
+		value->n = op == '-' ? -value->n : ~value->n;
+		return 0;
+
+	case '<':
+	case '>':
+		*pp = p + 1;
+		if(asm_unary(as, pp, e, value) < 0)
+			return -1;
+		if(value->base == ASM_ABSOLUTE)
+			value->n = op == '<' ? value->n & 0xFF : value->n >> 8 & 0xFF;
+		else if(value->part != ASM_WHOLE)
+			return asm_fail(as, "'%c' of a single byte", op);
+		else
+			value->part = op == '<' ? ASM_LOW : ASM_HIGH;
+		return 0;
+
+	case '(':
+		*pp = p + 1;
+		if(asm_expr_prec(as, pp, e, 1, value) < 0)
+			return -1;
+		p = asm_skip_space(*pp, e);
+		if(p == e || *p != ')')
+			return asm_fail(as, "')' expected");
+		*pp = p + 1;
+		return 0;
+
+	case '*':
+		*pp = p + 1;
+		*value = (asm_value_t) { as->pc, as->text ? ASM_TEXT : ASM_ABSOLUTE, ASM_WHOLE };
+		return 0;
+	}
+
+	*value = (asm_value_t) { 0, ASM_ABSOLUTE, ASM_WHOLE };
+	if(!asm_ident_start(op))
+	{
+		*pp = p;
+		return asm_number(as, pp, e, &value->n);
+	}
+
+	const char *end = asm_ident_end(p, e);
+	const asm_symbol_t *sym = asm_symbol(as, p, end - p);
+	if(!sym)
+		return -1;
+	if(sym->pass)
+	{
+		if(as->final && !sym->known)
+			return asm_fail(as, "'%.*s' depends on itself", (int) (end - p), p);
+		*value = sym->value;
+		as->unknown |= !sym->known;
+	}
+	else if(sym->external)
+		value->base = sym - as->syms;
+	else
+		as->unknown = true;
+	*pp = end;
+	return 0;
+}
+
+// Binary operator at p: its precedence, 0 if there is none
+static int asm_binary_op(const char *p, const char *e, char *op, int *len)
+{
+	if(p == e)
+		return 0;
+	*op = *p;
+	*len = 1;
+	switch(*p)
+	{
+	case '|': return 1;
+	case '^': return 2;
+	case '&': return 3;
+	case '<':
+	case '>':
+		if(e - p < 2 || p[1] != p[0])
+			return 0;
+		*len = 2;
+		return 4;
+	case '+':
+	case '-': return 5;
+	case '*':
+	case '/': return 6;
+	default: return 0;
+	}
+}
+
+static int asm_binary(asm_t *as, char op, asm_value_t *lhs, const asm_value_t *rhs)
+{
+	if(lhs->part != ASM_WHOLE || rhs->part != ASM_WHOLE)
+		return asm_fail(as, "'<' and '>' of a label have to come last");
+
+	if(op == '+' && (lhs->base == ASM_ABSOLUTE || rhs->base == ASM_ABSOLUTE))
+	{
+		lhs->base = lhs->base == ASM_ABSOLUTE ? rhs->base : lhs->base;
+		lhs->n += rhs->n;
+		return 0;
+	}
+	if(op == '-' && (rhs->base == ASM_ABSOLUTE || rhs->base == lhs->base))
+	{
+		lhs->base = rhs->base == ASM_ABSOLUTE ? lhs->base : ASM_ABSOLUTE;
+		lhs->n -= rhs->n;
+		return 0;
+	}
+	if(asm_absolute(as, lhs, op) < 0 || asm_absolute(as, rhs, op) < 0)
+		return -1;
+
+	switch(op)
+	{
+	case '|': lhs->n |= rhs->n; break;
+	case '^': lhs->n ^= rhs->n; break;
+	case '&': lhs->n &= rhs->n; break;
+	case '<': lhs->n = rhs->n < 0 || rhs->n > 31 ? 0 : lhs->n << rhs->n; break;
+	case '>': lhs->n = rhs->n < 0 || rhs->n > 31 ? 0 : lhs->n >> rhs->n; break;
+	case '*': lhs->n *= rhs->n; break;
+	case '/':
+		if(rhs->n == 0 && as->final)
+			return asm_fail(as, "division by zero");
+		lhs->n = rhs->n ? lhs->n / rhs->n : 0;
+		break;
+	}
+	return 0;
+}
+
+static int asm_expr_prec(asm_t *as, const char **pp, const char *e, int min_prec, asm_value_t *value)
+{
+	if(asm_unary(as, pp, e, value) < 0)
+		return -1;
+
+	for(;;)
+	{
+		const char *p = asm_skip_space(*pp, e);
+		char op;
+		int len;
+		const int prec = asm_binary_op(p, e, &op, &len);
+		if(!prec || prec < min_prec)
+			return 0;
+
+		asm_value_t rhs;
+		*pp = p + len;
+		if(asm_expr_prec(as, pp, e, prec + 1, &rhs) < 0 || asm_binary(as, op, value, &rhs) < 0)
+			return -1;
+		// keep intermediate values from overflowing a long
+		if(value->n > 0xFFFFFFFL || value->n < -0xFFFFFFFL)
+			value->n &= 0xFFFFFFFL;
+	}
+}
+
+static int asm_expr(asm_t *as, const char **pp, const char *e, asm_value_t *value)
+{
+	return asm_expr_prec(as, pp, e, 1, value);
+}
+
+// ",x" or ",y" at p: returns 'x' or 'y' and moves past it, 0 if there is none
+static int asm_index_reg(const char **pp, const char *e)
+{
+	const char *p = asm_skip_space(*pp, e);
+	if(p == e || *p != ',')
+		return 0;
+	p = asm_skip_space(p + 1, e);
+	if(p == e)
+		return 0;
+	const int reg = tolower((unsigned char) *p);
+	if(reg != 'x' && reg != 'y')
+		return 0;
+	*pp = p + 1;
+	return reg;
+}
+
+static bool asm_expect(const char **pp, const char *e, char c)
+{
+	const char *p = asm_skip_space(*pp, e);
+	if(p == e || *p != c)
+		return false;
+	*pp = p + 1;
+	return true;
+}
+
+/*
+ * Statements
+ */
+
+// Emit `value` as `kind`, OBJ_R_BYTE, OBJ_R_WORD or OBJ_R_BRANCH, and
+// leave a relocation for the linker if it is not known yet. Range
+// checks of known values are up to the caller.
+static int asm_emit_value(asm_t *as, const asm_value_t *value, byte kind)
+{
+	const long here = as->text ? ASM_TEXT : ASM_ABSOLUTE;
+	if(value->base == ASM_ABSOLUTE && (kind != OBJ_R_BRANCH || here == ASM_ABSOLUTE))
+	{
+		const long n = kind == OBJ_R_BRANCH ? value->n - (long) (as->pc + 1) : value->n;
+		return asm_emit(as, n & 0xFF) < 0 || (kind == OBJ_R_WORD && asm_emit(as, n >> 8 & 0xFF) < 0) ? -1 : 0;
+	}
+	if(kind == OBJ_R_BRANCH && value->base == here)
+		return asm_emit(as, (value->n - (long) (as->pc + 1)) & 0xFF);
+
+	if(value->part != ASM_WHOLE)
+	{
+		if(kind != OBJ_R_BYTE)
+			return asm_fail(as, "'<' and '>' give a single byte");
+		kind = value->part == ASM_LOW ? OBJ_R_LOW : OBJ_R_HIGH;
+	}
+
+	// a relocated word must not straddle a segment split
+	if(kind == OBJ_R_WORD && as->final && !as->text && as->open
+		&& as->segs[as->nsegs - 1].len == ASM_MAX_SEGMENT_LEN - 1)
+		as->open = false;
+	if(asm_emit(as, 0) < 0 || (kind == OBJ_R_WORD && asm_emit(as, 0) < 0))
+		return -1;
+	if(!as->final)
+		return 0;
+
+	if(as->nrelocs == as->reloc_cap)
+	{
+		const size_t cap = as->reloc_cap ? 2 * as->reloc_cap : 64;
+		obj_reloc *relocs = realloc(as->relocs, cap * sizeof *relocs);
+		if(!relocs)
+			return asm_fail(as, "out of memory");
+		as->relocs = relocs;
+		as->reloc_cap = cap;
+	}
+
+	const word seg = as->text ? 0 : as->nsegs - 1;
+	const uint32_t at = as->pc - (kind == OBJ_R_WORD ? 2 : 1);
+	as->relocs[as->nrelocs++] = (obj_reloc)
+	{
+		.seg = seg,
+		.offset = at - as->segs[seg].addr,
+		.kind = kind,
+		.section = value->base == ASM_ABSOLUTE ? OBJ_ABSOLUTE : value->base == ASM_TEXT ? OBJ_TEXT : OBJ_EXTERN,
+		.sym = value->base >= 0 ? value->base : 0,
+		.addend = value->n,
+		.line = as->line
+	};
+	return 0;
+}
+
+// Addressing mode and value of the operand in [p, e). `sized` is set
+// when the operand is a plain address that may also fit zero page.
+static int asm_operand(asm_t *as, const asm_mnemonic_t *mn, const char *p, const char *e,
+		byte *mode, asm_value_t *value, bool *sized)
+{
+	*value = (asm_value_t) { 0, ASM_ABSOLUTE, ASM_WHOLE };
+	*sized = false;
+	if(p == e)
+	{
+		*mode = mn->code[AM_IMP] < 0 && mn->code[AM_ACC] >= 0 ? AM_ACC : AM_IMP;
+		return 0;
+	}
+	if(e - p == 1 && tolower((unsigned char) *p) == 'a')
+	{
+		*mode = AM_ACC;
+		return 0;
+	}
+
+	int reg;
+	switch(*p)
+	{
+	case '#':
+		p++;
+		if(asm_expr(as, &p, e, value) < 0)
+			return -1;
+		*mode = AM_IMM;
+		break;
+
+	case '%':
+		p++;
+		if(asm_expr(as, &p, e, value) < 0)
+			return -1;
+		reg = asm_index_reg(&p, e);
+		*mode = reg == 'x' ? AM_ZPX : reg == 'y' ? AM_ZPY : AM_ZP;
+		break;
+
+	case '[':
+		p++;
+		if(asm_expr(as, &p, e, value) < 0)
+			return -1;
+		reg = asm_index_reg(&p, e);
+		if(!asm_expect(&p, e, ']'))
+			return asm_fail(as, "']' expected");
+		if(reg == 'x')
+			*mode = AM_INDX;
+		else if(reg == 'y' || asm_index_reg(&p, e) == 'y')
+			*mode = AM_INDY;
+		else
+			*mode = AM_IND;
+		break;
+
+	default:
+		if(asm_expr(as, &p, e, value) < 0)
+			return -1;
+		reg = asm_index_reg(&p, e);
+		*mode = reg == 'x' ? AM_ABSX : reg == 'y' ? AM_ABSY
+			: mn->code[AM_REL] >= 0 ? AM_REL : AM_ABS;
+		*sized = *mode != AM_REL;
+		break;
+	}
+
+	if(asm_skip_space(p, e) != e)
+		return asm_fail(as, "junk after the operand");
+	return 0;
+}
+
+// Zero page form of an absolute operand, if it fits and the mnemonic
+// has one. Undefined symbols are taken to fit until a later pass knows,
+// values only the linker knows never do.
+static byte asm_shortest(asm_t *as, const asm_mnemonic_t *mn, byte mode, const asm_value_t *value)
+{
+	const byte zp = mode == AM_ABSX ? AM_ZPX : mode == AM_ABSY ? AM_ZPY : AM_ZP;
+	if(mn->code[zp] < 0)
+		return mode;
+
+	if(as->operand == as->nwide)
+	{
+		byte *wide = realloc(as->wide, as->nwide + 1);
+		if(!wide)
+			return mode; 	// fits either way, only longer
+		as->wide = wide;
+		as->wide[as->nwide++] = 0;
+	}
+
+	byte *wide = &as->wide[as->operand++];
+	if(!*wide && !as->unknown
+		&& (value->base != ASM_ABSOLUTE || value->n < 0 || value->n > 0xFF))
+	{
+		*wide = 1;
+		as->changed = true;
+	}
+	return *wide ? mode : zp;
+}
+
+static int asm_instruction(asm_t *as, const char *p, const char *e)
+{
+	const char *name = p;
+	while(p < e && isalpha((unsigned char) *p))
+		p++;
+	const asm_mnemonic_t *mn = asm_find_mnemonic(name, p - name);
+	if(!mn)
+		return asm_fail(as, "unknown mnemonic '%.*s'", (int) (p - name), name);
+
+	byte mode = AM_IMP;
+	asm_value_t value;
+	bool sized;
+	as->unknown = false;
+	if(asm_operand(as, mn, asm_skip_space(p, e), e, &mode, &value, &sized) < 0)
+		return -1;
+	if(sized)
+		mode = asm_shortest(as, mn, mode, &value);
+	if(mn->code[mode] < 0)
+		return asm_fail(as, "%s has no %s mode", mn->name, asm_mode_names[mode]);
+
+	// values are only final in the final pass, and the linker checks
+	// the ones it fills in
+	const long n = value.n;
+	switch(as->final && value.base == ASM_ABSOLUTE ? mode : AM_IMP)
+	{
+	case AM_IMM:
+		if(n < -128 || n > 0xFF)
+			return asm_fail(as, "immediate value out of range");
+		break;
+	case AM_ZP:
+	case AM_ZPX:
+	case AM_ZPY:
+	case AM_INDX:
+	case AM_INDY:
+		if(n < 0 || n > 0xFF)
+			return asm_fail(as, "zero page address out of range");
+		break;
+	case AM_REL:
+		if(n < 0 || n > MEM_MAX)
+			return asm_fail(as, "address out of range");
+		if(!as->text && (n - (long) (as->pc + 2) < -128 || n - (long) (as->pc + 2) > 127))
+			return asm_fail(as, "branch target $%04lx out of range", n);
+		break;
+	case AM_ABS:
+	case AM_ABSX:
+	case AM_ABSY:
+	case AM_IND:
+		if(n < 0 || n > MEM_MAX)
+			return asm_fail(as, "address out of range");
+		break;
+	}
+	if(as->final && mode == AM_REL && as->text && value.base == ASM_TEXT
+		&& (n - (long) (as->pc + 2) < -128 || n - (long) (as->pc + 2) > 127))
+		return asm_fail(as, "branch target out of range");
+
+	if(as->final && !as->has_entry)
+		asm_set_entry(as, &(asm_value_t) { as->pc, as->text ? ASM_TEXT : ASM_ABSOLUTE, ASM_WHOLE });
+	if(asm_emit(as, mn->code[mode]) < 0)
+		return -1;
+	switch(cpu_op_length(mode))
+	{
+	case 2: return asm_emit_value(as, &value, mode == AM_REL ? OBJ_R_BRANCH : OBJ_R_BYTE);
+	case 3: return asm_emit_value(as, &value, OBJ_R_WORD);
+	default: return 0;
+	}
+}
+
+// Comma separated expressions, each emitted as `size` bytes
+static int asm_data(asm_t *as, const char *p, const char *e, int size)
+{
+	do
+	{
+		asm_value_t value;
+		if(asm_expr(as, &p, e, &value) < 0)
+			return -1;
+		if(as->final && value.base == ASM_ABSOLUTE
+			&& (value.n < (size == 1 ? -128 : -32768) || value.n > (size == 1 ? 0xFF : 0xFFFF)))
+			return asm_fail(as, "value out of range");
+		if(asm_emit_value(as, &value, size == 1 ? OBJ_R_BYTE : OBJ_R_WORD) < 0)
+			return -1;
+	}
+	while(asm_expect(&p, e, ','));
+
+	if(asm_skip_space(p, e) != e)
+		return asm_fail(as, "',' or ']' expected");
+	return 0;
+}
+
+// Comma separated names
+static int asm_global(asm_t *as, const char *p, const char *e)
+{
+	do
+	{
+		p = asm_skip_space(p, e);
+		if(p == e || !asm_ident_start(*p))
+			return asm_fail(as, "symbol name expected");
+		const char *end = asm_ident_end(p, e);
+		asm_symbol_t *sym = asm_symbol(as, p, end - p);
+		if(!sym)
+			return -1;
+		sym->global = true;
+		p = end;
+	}
+	while(asm_expect(&p, e, ','));
+
+	if(asm_skip_space(p, e) != e)
+		return asm_fail(as, "',' or ']' expected");
+	return 0;
+}
+
+// [.name args]
+static int asm_directive(asm_t *as, const char *p, const char *e)
+{
+	if(e[-1] != ']')
+		return asm_fail(as, "']' expected");
+	e--;
+	p = asm_skip_space(p + 1, e);
+	if(p == e || *p != '.')
+		return asm_fail(as, "directive expected after '['");
+	const char *name = ++p;
+	while(p < e && isalpha((unsigned char) *p))
+		p++;
+	const size_t len = p - name;
+
+	if(len == 4 && strncasecmp(name, "byte", 4) == 0)
+		return asm_data(as, p, e, 1);
+	if(len == 4 && strncasecmp(name, "word", 4) == 0)
+		return asm_data(as, p, e, 2);
+	if(len == 6 && strncasecmp(name, "global", 6) == 0)
+		return asm_global(as, p, e);
+
+	asm_value_t value;
+	as->unknown = false;
+	if(asm_expr(as, &p, e, &value) < 0)
+		return -1;
+	if(asm_skip_space(p, e) != e)
+		return asm_fail(as, "']' expected");
+
+	if(len == 3 && strncasecmp(name, "org", 3) == 0)
+	{
+		if(as->unknown && !as->final)
+			value = (asm_value_t) { as->pc, ASM_ABSOLUTE, ASM_WHOLE }; 	// settles in a later pass
+		if(value.base != ASM_ABSOLUTE)
+			return asm_fail(as, ".org needs an address known before linking");
+		if(value.n < 0 || value.n > MEM_MAX)
+			return asm_fail(as, "address out of range");
+		as->pc = value.n;
+		as->text = false;
+		as->open = false;
+	}
+	else if(len == 5 && strncasecmp(name, "entry", 5) == 0)
+	{
+		if(!as->final)
+			return 0;
+		if(as->explicit_entry)
+			return asm_fail(as, "more than one .entry");
+		if(value.part != ASM_WHOLE || (value.base != ASM_ABSOLUTE && value.base != ASM_TEXT))
+			return asm_fail(as, ".entry needs an address in this unit");
+		if(value.n < 0 || value.n > MEM_MAX)
+			return asm_fail(as, "address out of range");
+		asm_set_entry(as, &value);
+		as->explicit_entry = true;
+	}
+	else if(len == 3 && strncasecmp(name, "bit", 3) == 0)
+	{
+		if(value.n != 16)
+			return asm_fail(as, "only 16 bit addresses are supported");
+	}
+	else
+		return asm_fail(as, "unknown directive '.%.*s'", (int) len, name);
+	return 0;
+}
+
+// [label:] [statement], or name = expression
+static int asm_line(asm_t *as, const char *p, const char *e)
+{
+	const char *comment = memchr(p, ';', e - p);
+	if(comment)
+		e = comment;
+	while(e > p && isspace((unsigned char) e[-1]))
+		e--;
+	p = asm_skip_space(p, e);
+
+	if(p < e && asm_ident_start(*p))
+	{
+		const char *end = asm_ident_end(p, e);
+		const char *q = asm_skip_space(end, e);
+		if(q < e && *q == ':')
+		{
+			const asm_value_t here = { as->pc, as->text ? ASM_TEXT : ASM_ABSOLUTE, ASM_WHOLE };
+			if(asm_define(as, p, end - p, &here, true) < 0)
+				return -1;
+			p = asm_skip_space(q + 1, e);
+		}
+		else if(q < e && *q == '=')
+		{
+			asm_value_t value;
+			q++;
+			as->unknown = false;
+			if(asm_expr(as, &q, e, &value) < 0)
+				return -1;
+			if(asm_skip_space(q, e) != e)
+				return asm_fail(as, "junk after the expression");
+			return asm_define(as, p, end - p, &value, !as->unknown);
+		}
+	}
+
+	if(p == e)
+		return 0;
+	if(*p == '[')
+		return asm_directive(as, p, e);
+	return asm_instruction(as, p, e);
+}
+
+static int asm_pass(asm_t *as, const char *src, size_t len)
+{
+	as->line = 0;
+	as->pc = 0;
+	as->text = true;
+	as->open = false;
+	as->operand = 0;
+	as->changed = false;
+
+	const char *p = src, *end = src + len;
+	while(p < end)
+	{
+		const char *nl = memchr(p, '\n', end - p);
+		const char *e = nl ? nl : end;
+		as->line++;
+		if(asm_line(as, p, e) < 0)
+			return -1;
+		p = e + 1;
+	}
+
+	// Whatever is used and still not defined has to come from another
+	// unit. From the next pass on it is known to need a relocation.
+	for(size_t i = 0; i < as->nsyms; i++)
+		if(!as->syms[i].pass && !as->syms[i].external)
+		{
+			as->syms[i].external = true;
+			as->changed = true;
+		}
+	return 0;
+}
+
+static byte *asm_output(asm_t *as, size_t *out_len)
+{
+	as->obj.obj_syms = malloc((as->nsyms + 1) * sizeof *as->obj.obj_syms);
+	if(!as->obj.obj_syms)
+	{
+		asm_fail(as, "out of memory");
+		return NULL;
+	}
+
+	// symbol indexes are the ones the relocations use
+	for(size_t i = 0; i < as->nsyms; i++)
+	{
+		const asm_symbol_t *sym = &as->syms[i];
+		as->obj.obj_syms[i] = (obj_symbol)
+		{
+			.value = sym->pass ? sym->value.n & 0xFFFF : 0,
+			.section = !sym->pass ? OBJ_EXTERN : sym->value.base == ASM_TEXT ? OBJ_TEXT : OBJ_ABSOLUTE,
+			.flags = sym->global ? OBJ_GLOBAL : 0,
+			.len = sym->len,
+			.name = sym->name
+		};
+	}
+	as->obj.obj_nsyms = as->nsyms;
+	as->obj.obj_segs = as->segs;
+	as->obj.obj_nsegs = as->nsegs;
+	as->obj.obj_relocs = as->relocs;
+	as->obj.obj_nrelocs = as->nrelocs;
+
+	byte *obj = obj_build(&as->obj, out_len);
+	if(!obj)
+		asm_fail(as, "out of memory");
+	free(as->obj.obj_syms);
+	return obj;
+}
+
+byte *asm_object(const char *src, size_t len, size_t *out_len, asm_error_t *err)
+{
+	pthread_once(&asm_once, asm_build_mnemonics);
+	*err = (asm_error_t) { 0 };
+
+	asm_t *as = calloc(1, sizeof *as);
+	byte *code = malloc(MEM_SIZE);
+	byte *image = malloc(MEM_SIZE);
+	if(!as || !code || !image)
+	{
+		free(as);
+		free(code);
+		free(image);
+		snprintf(err->msg, sizeof err->msg, "out of memory");
+		return NULL;
+	}
+	as->err = err;
+	as->code = code;
+	as->image = image;
+	as->segs[0] = (ef_segment) { 0, 0, code };
+	as->nsegs = 1;
+
+	// Every pass but the first that changes something makes a symbol
+	// move or an operand grow, which bounds the number of passes
+	byte *obj = NULL;
+	int ret = 0;
+	do
+	{
+		as->pass++;
+		ret = asm_pass(as, src, len);
+		if(ret == 0 && as->changed && as->pass > 2 * as->nsyms + as->nwide + 2)
+		{
+			as->line = 0;
+			ret = asm_fail(as, "symbol values do not settle");
+		}
+	}
+	while(ret == 0 && as->changed);
+
+	if(ret == 0)
+	{
+		as->pass++;
+		as->final = true;
+		ret = asm_pass(as, src, len);
+	}
+	if(ret == 0)
+		obj = asm_output(as, out_len);
+
+	free(as->syms);
+	free(as->index);
+	free(as->wide);
+	free(as->relocs);
+	free(image);
+	free(code);
+	free(as);
+	return obj;
+}
+
+byte *asm_assemble(const char *src, size_t len, size_t *out_len, asm_error_t *err)
+{
+	size_t obj_len;
+	byte *image = asm_object(src, len, &obj_len, err);
+	if(!image)
+		return NULL;
+
+	obj_file obj;
+	byte *ef = NULL;
+	if(obj_parse(image, obj_len, &obj) < 0)
+		snprintf(err->msg, sizeof err->msg, "out of memory");
+	else
+	{
+		ef = obj_link(&obj, 1, out_len, err);
+		obj_free(&obj);
+	}
+	free(image);
+	return ef;
+}
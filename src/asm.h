@@ -0,0 +1,69 @@
+#ifndef ASM_H
+#define ASM_H
+
+#include <stddef.h>
+
+#include "bytes.h"
+
+/*
+ *
+ * Assembler
+ *
+ * Turns 6502 source text into an EF v2 image in memory, without files
+ * or processes, so generated programs can be assembled and run in the
+ * same process (see emu_load_ef_image). Mnemonics and addressing modes
+ * come from opcodes.def, the table the CPU dispatches on.
+ *
+ * One statement per line, ';' starts a comment, case is ignored except
+ * in symbol names:
+ *
+ * 	[.org 0x4000] 	code that follows goes to 0x4000, default 0x1000
+ * 	[.bit 16] 		address width, only 16
+ * 	[.byte 1, n] 	bytes, [.word list] for little endian words
+ * 	[.global a, b] 	symbols other units may use
+ * 	[.entry main] 	entry point of the program
+ * 	loop: 			label, the address of what follows on the line
+ * 	size = 4 * n 	constant
+ * 	kil 			implied
+ * 	asl, asl a 		accumulator
+ * 	lda #2 			immediate
+ * 	lda %0x10 		zero page, also %n,x and %n,y
+ * 	lda 0x1234 		zero page if it fits and the mode exists, else
+ * 					absolute, also n,x and n,y
+ * 	jmp [0x1234] 	indirect
+ * 	lda [0x10,x] 	indexed indirect
+ * 	lda [0x10],y 	indirect indexed, [0x10,y] is accepted too
+ * 	bne loop 		branch to an address
+ *
+ * Operands are expressions with the C operators | ^ & << >> + - * /,
+ * unary - ~ < (low byte) > (high byte), parentheses, symbols and * for
+ * the address of the statement. Numbers are decimal, or hex with 0x or
+ * $. Symbols may be used before they are defined: passes repeat until
+ * every symbol keeps its value, then a last pass emits the code. Every
+ * symbol is exported in the EF symbol table.
+ *
+ * Code before the first .org is relocatable text, which the linker puts
+ * at 0x1000 for a single unit. Every .org starts a new segment at a
+ * fixed address. The entry point is the address given with .entry, else
+ * the first instruction of the source; data before it is skipped.
+ * Symbols a unit uses but does not define come from the .global
+ * symbols of other units; see obj.h.
+ *
+ * */
+
+typedef struct asm_error
+{
+	unsigned line; 		// 1-based, 0 if the error is not about one line
+	unsigned unit; 		// object the error is about, when linking
+	char msg[96];
+} asm_error_t;
+
+// Assemble `len` bytes of `src`. Returns a malloc'd EF image of *out_len
+// bytes, or NULL with the reason in *err.
+byte *asm_assemble(const char *src, size_t len, size_t *out_len, asm_error_t *err);
+
+// Assemble one unit of a program into a relocatable object for
+// obj_link, with the same return convention
+byte *asm_object(const char *src, size_t len, size_t *out_len, asm_error_t *err);
+
+#endif
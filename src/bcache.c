@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bcache.h"
+
+cpu_bcache_t *bcache_create(void)
+{
+	return calloc(1, sizeof(cpu_bcache_t));
+}
+
+void bcache_free(cpu_bcache_t *cache)
+{
+	if(!cache)
+		return;
+	jit_free(cache->jit);
+	if(cache->shadow)
+		ram_free(cache->shadow);
+	free(cache->shadow);
+	free(cache);
+}
+
+int bcache_enable_jit(cpu_bcache_t *cache, bool verify)
+{
+	cache->jit = jit_create(BCACHE_JIT_CODE_SIZE);
+	if(!cache->jit)
+		return -1;
+	if(!verify)
+		return 0;
+
+	cache->shadow = malloc(sizeof *cache->shadow);
+	if(!cache->shadow || ram_init(cache->shadow, NULL) < 0)
+	{
+		free(cache->shadow);
+		cache->shadow = NULL;
+		jit_free(cache->jit);
+		cache->jit = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void bcache_translate(cpu_bcache_t *cache, bcache_block_t *block)
+{
+	block->native = jit_compile(cache->jit, block);
+	if(block->native)
+		return;
+
+	// code buffer full, start over
+	jit_flush(cache->jit);
+	for(unsigned i = 0; i < BCACHE_BLOCKS; i++)
+	{
+		cache->blocks[i].native = NULL;
+		cache->blocks[i].runs = 0;
+	}
+	block->native = jit_compile(cache->jit, block);
+}
+
+static bool bcache_same_regs(const cpu6502_t *a, const cpu6502_t *b)
+{
+	return a->A == b->A && a->X == b->X && a->Y == b->Y && a->SP == b->SP
+		&& a->PC == b->PC && cpu_get_status(a) == cpu_get_status(b) && a->cycles == b->cycles;
+}
+
+unsigned bcache_run_verified(cpu_bcache_t *cache, const bcache_block_t *block,
+		cpu6502_t *cpu, ram_t *ram)
+{
+	// same memory, and the same code pages watched, so the interpreter
+	// stops early exactly where the native code has to
+	ram_t *shadow = cache->shadow;
+	memcpy(shadow->data, ram->data, MEM_SIZE);
+	ram_touch(shadow, 0, MEM_SIZE);
+	for(unsigned p = 0; p < RAM_PAGES; p++)
+		if(ram->flags[p] & RAM_PAGE_CODE)
+			ram_watch_code(shadow, p);
+	cpu6502_t ref = *cpu;
+
+	const unsigned native_ops = block->native(cpu, ram);
+	const unsigned ops = bcache_interpret(block, &ref, shadow);
+
+	cache->verified++;
+	if(ops != native_ops || !bcache_same_regs(cpu, &ref)
+		|| memcmp(ram->data, shadow->data, MEM_SIZE))
+	{
+		cache->mismatches++;
+		fprintf(stderr, "jit: block $%04x differs from the interpreter: "
+				"ops %u/%u A %02x/%02x X %02x/%02x Y %02x/%02x SP %02x/%02x "
+				"P %02x/%02x PC %04x/%04x\n", block->pc,
+				native_ops, ops, cpu->A, ref.A, cpu->X, ref.X,
+				cpu->Y, ref.Y, cpu->SP, ref.SP,
+				cpu_get_status(cpu), cpu_get_status(&ref), cpu->PC, ref.PC);
+	}
+	return native_ops;
+}
+
+/*
+ * Predecoded handlers
+ *
+ * Same effect as the handlers of the same name, with the operand from
+ * the block. PC still moves past it. None of these has a page crossing
+ * penalty, so the cycles are the table's.
+ */
+
+#define OPERAND_IMM 	(cpu->PC += 1, (byte) operand)
+#define OPERAND_ZP 		(cpu->PC += 1, ram_read(ram, (byte) operand))
+#define OPERAND_ABS 	(cpu->PC += 2, ram_read(ram, operand))
+#define ADDRESS_ZP 		(cpu->PC += 1, (byte) operand)
+#define ADDRESS_ABS 	(cpu->PC += 2, operand)
+
+#define PREDECODED(name, body) \
+	static void pre_##name(cpu6502_t *cpu, ram_t *ram, word operand) \
+	{ \
+		(void) ram; \
+		body; \
+	}
+
+#define PRE_LOAD(ins, reg, mode) \
+	PREDECODED(ins##_##mode, cpu->reg = OPERAND_##mode; cpu_set_nz(cpu, cpu->reg))
+#define PRE_STORE(ins, reg, mode) \
+	PREDECODED(ins##_##mode, const word addr = ADDRESS_##mode; ram_write(ram, addr, cpu->reg))
+#define PRE_LOGIC(ins, op, mode) \
+	PREDECODED(ins##_##mode, cpu->A op OPERAND_##mode; cpu_set_nz(cpu, cpu->A))
+#define PRE_COMPARE(ins, reg, mode) \
+	PREDECODED(ins##_##mode, const byte data = OPERAND_##mode; \
+			cpu->carry = cpu->reg >= data; cpu_set_nz(cpu, cpu->reg - data))
+
+#define PRE_READ_MODES(GEN, ins, arg) GEN(ins, arg, IMM) GEN(ins, arg, ZP) GEN(ins, arg, ABS)
+
+PRE_READ_MODES(PRE_LOAD, LDA, A)
+PRE_READ_MODES(PRE_LOAD, LDX, X)
+PRE_READ_MODES(PRE_LOAD, LDY, Y)
+PRE_STORE(STA, A, ZP) PRE_STORE(STA, A, ABS)
+PRE_STORE(STX, X, ZP) PRE_STORE(STX, X, ABS)
+PRE_STORE(STY, Y, ZP) PRE_STORE(STY, Y, ABS)
+PRE_READ_MODES(PRE_LOGIC, AND, &=)
+PRE_READ_MODES(PRE_LOGIC, ORA, |=)
+PRE_READ_MODES(PRE_LOGIC, EOR, ^=)
+PRE_READ_MODES(PRE_COMPARE, CMP, A)
+PRE_READ_MODES(PRE_COMPARE, CPX, X)
+PRE_READ_MODES(PRE_COMPARE, CPY, Y)
+
+#define PRE_ENTRY(ins, arg, mode) [INS_##ins##_##mode] = pre_##ins##_##mode,
+
+static const bcache_handler_t bcache_predecoded[256] =
+{
+	PRE_READ_MODES(PRE_ENTRY, LDA, _)
+	PRE_READ_MODES(PRE_ENTRY, LDX, _)
+	PRE_READ_MODES(PRE_ENTRY, LDY, _)
+	PRE_ENTRY(STA, _, ZP) PRE_ENTRY(STA, _, ABS)
+	PRE_ENTRY(STX, _, ZP) PRE_ENTRY(STX, _, ABS)
+	PRE_ENTRY(STY, _, ZP) PRE_ENTRY(STY, _, ABS)
+	PRE_READ_MODES(PRE_ENTRY, AND, _)
+	PRE_READ_MODES(PRE_ENTRY, ORA, _)
+	PRE_READ_MODES(PRE_ENTRY, EOR, _)
+	PRE_READ_MODES(PRE_ENTRY, CMP, _)
+	PRE_READ_MODES(PRE_ENTRY, CPX, _)
+	PRE_READ_MODES(PRE_ENTRY, CPY, _)
+};
+
+bcache_block_t *bcache_decode(cpu_bcache_t *cache, ram_t *ram, word pc)
+{
+	bcache_block_t *block = &cache->blocks[pc & (BCACHE_BLOCKS - 1)];
+	if(block->seen != pc)
+	{
+		block->seen = pc; 	// a single miss keeps whatever block is here
+		return NULL;
+	}
+
+	block->n = 0;
+	block->runs = 0;
+	block->native = NULL;
+
+	const byte page = pc >> 8;
+	if(!ram_watch_code(ram, page))
+		return NULL;
+
+	const byte *mem = ram->rd[page];
+	unsigned off = pc & 0xFF;
+	uint32_t span = 0;
+	byte n = 0;
+	while(n < BCACHE_MAX_OPS && off < RAM_PAGE_SIZE)
+	{
+		const byte opcode = mem[off];
+		const cpu_op_t *op = &cpu_optable[opcode];
+		const unsigned len = cpu_op_length(op->mode);
+		if(!op->handler || off + len > RAM_PAGE_SIZE)
+			break;
+
+		if(n)
+			span += block->ops[n - 1].cycles + 1; 	// + page crossing penalty
+		const word operand = len == 3 ? mem[off + 1] | mem[off + 2] << 8 : len == 2 ? mem[off + 1] : 0;
+		block->ops[n++] = (bcache_op_t) { op->handler, bcache_predecoded[opcode], opcode, op->cycles, operand };
+		off += len;
+		if(bcache_ends_block(opcode, op->mode))
+			break;
+	}
+
+	if(!n)
+		return NULL;
+	block->pc = pc;
+	block->gen = ram->gen[page];
+	block->span = span;
+	block->cycles = span - (n - 1) + block->ops[n - 1].cycles;
+	block->n = n;
+	return block;
+}
@@ -0,0 +1,147 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+
+#include "cpu6502.h"
+#include "jit.h"
+
+/*
+ *
+ * Basic-block decode cache
+ *
+ * A block is the straight-line run of instructions starting at some
+ * PC, decoded once into handlers, cycles and operands. It ends after a
+ * branch, jump, call or return, before an opcode without a handler,
+ * or where the next instruction would leave the page. Running a block
+ * skips the opcode fetch and table lookup of every instruction. Loads,
+ * stores, logic ops and compares with an immediate, zero page or
+ * absolute operand also skip the operand fetch: they run a predecoded
+ * handler that is passed the operand.
+ *
+ * Blocks are only decoded from own memory and read-only memory. Own
+ * pages with cached code are watched through the RAM write trap, and
+ * a block is valid while gen[] of its page is unchanged. Writes from
+ * inside a block bump ram->code_gen, which stops the block right after
+ * the writing instruction. A device raising an interrupt line stops it
+ * the same way, so the interrupt is taken at the next boundary.
+ *
+ * With a JIT attached, a block that ran BCACHE_JIT_THRESHOLD times is
+ * translated to native code. The translation lives as long as the
+ * block, so it is dropped together with it when its page is written.
+ * In verify mode every native run is repeated by the interpreter on a
+ * copy of the state in a shadow RAM, and registers and own memory are
+ * compared. The shadow has no devices or external memory, so verify
+ * programs that only use own memory.
+ *
+ * */
+
+#define BCACHE_BLOCKS 	1024 	// direct mapped by PC, power of two
+#define BCACHE_MAX_OPS 	16
+#define BCACHE_JIT_THRESHOLD 	32
+#define BCACHE_JIT_CODE_SIZE 	(1 << 20)
+
+// Handler that gets its operand from the block instead of fetching it
+typedef void (*bcache_handler_t)(cpu6502_t *cpu, ram_t *ram, word operand);
+
+typedef struct bcache_op
+{
+	cpu_handler_t handler;
+	bcache_handler_t predecoded; 	// runs instead of handler, NULL for most ops
+	byte opcode;
+	byte cycles;
+	word operand; 		// bytes after the opcode, a write to them drops the block
+} bcache_op_t;
+
+typedef struct bcache_block
+{
+	word pc;
+	word seen; 			// last PC that missed here, decoded when it misses again
+	byte n; 			// number of ops, 0 if the slot is empty
+	uint32_t gen; 		// gen[] of the page when decoded
+	uint32_t span; 		// worst-case cycles until the last op starts
+	uint32_t cycles; 	// sum of base cycles
+	uint32_t runs;
+	jit_fn_t native; 	// NULL until translated
+	bcache_op_t ops[BCACHE_MAX_OPS];
+} bcache_block_t;
+
+typedef struct cpu_bcache
+{
+	bcache_block_t blocks[BCACHE_BLOCKS];
+
+	jit_t *jit; 			// NULL runs every block interpreted
+	ram_t *shadow; 			// NULL unless verifying
+	uint64_t verified; 		// native runs checked against the interpreter
+	uint64_t mismatches;
+} cpu_bcache_t;
+
+// Instructions after which PC is not simply the next instruction. The
+// run loop only looks for a block after one of these or after a block,
+// straight-line code in between is stepped without probing the cache.
+static inline bool bcache_ends_block(byte opcode, byte mode)
+{
+	switch(opcode)
+	{
+	case INS_JMP_ABS:
+	case INS_JMP_IND:
+	case INS_JSR:
+	case INS_RTS:
+	case INS_RTI:
+	case INS_BRK:
+		return true;
+	default:
+		return mode == AM_REL;
+	}
+}
+
+// Returns NULL on failure
+cpu_bcache_t *bcache_create(void);
+void bcache_free(cpu_bcache_t *cache);
+
+// Attach a JIT. Returns -1 if the host has none or on failure, the cache
+// then keeps working interpreted.
+int bcache_enable_jit(cpu_bcache_t *cache, bool verify);
+
+// Translate a block that became hot
+void bcache_translate(cpu_bcache_t *cache, bcache_block_t *block);
+
+// Run a translated block, rerun it interpreted on the shadow RAM from
+// the same state and report differences on stderr. Returns the native
+// op count.
+unsigned bcache_run_verified(cpu_bcache_t *cache, const bcache_block_t *block,
+		cpu6502_t *cpu, ram_t *ram);
+
+// Decode the block at pc into its slot once it missed there twice in a
+// row, so code that runs once is never decoded. Returns NULL if the
+// caller has to step.
+bcache_block_t *bcache_decode(cpu_bcache_t *cache, ram_t *ram, word pc);
+
+static inline bcache_block_t *bcache_lookup(cpu_bcache_t *cache, ram_t *ram, word pc)
+{
+	bcache_block_t *block = &cache->blocks[pc & (BCACHE_BLOCKS - 1)];
+	if(block->n && block->pc == pc && block->gen == ram->gen[pc >> 8])
+		return block;
+	return bcache_decode(cache, ram, pc);
+}
+
+// Run the block's handlers, the caller accounts cycles and instructions.
+// Returns how many ops ran, fewer than n if one of them wrote to code.
+static inline unsigned bcache_interpret(const bcache_block_t *block, cpu6502_t *cpu, ram_t *ram)
+{
+	const uint32_t code_gen = ram->code_gen;
+	for(byte i = 0; i < block->n; i++)
+	{
+		const bcache_op_t *op = &block->ops[i];
+		cpu->PC++; 	// opcode
+		if(op->predecoded)
+			op->predecoded(cpu, ram, op->operand);
+		else
+			op->handler(cpu, ram);
+		if(ram->code_gen != code_gen || cpu_interrupt_due(cpu))
+			return i + 1; 	// code was written or an interrupt is due, stop here
+	}
+	return block->n;
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "pool.h"
+
+#define BOARD_MAX_REGIONS 	8
+
+typedef struct board_region
+{
+	byte first;
+	unsigned count;
+	size_t size; 		// count pages in bytes
+	byte *data; 		// contents as of the last barrier
+	byte *views; 		// one copy of data per CPU, mapped into its RAM
+} board_region_t;
+
+struct board
+{
+	unsigned ncpus;
+	uint64_t quantum;
+	uint64_t time; 		// board cycles run so far
+	uint64_t target; 	// end of the quantum being run
+	pool_t *pool;
+
+	emu_t *cpus;
+	cpu_stop_t *stops;
+
+	board_region_t regions[BOARD_MAX_REGIONS];
+	unsigned nregions;
+	byte *merge; 		// scratch for the largest region
+};
+
+board_t *board_create(const board_config_t *config)
+{
+	if(!config->ncpus)
+		return NULL;
+
+	board_t *board = calloc(1, sizeof *board);
+	if(!board)
+		return NULL;
+	board->ncpus = config->ncpus;
+	board->quantum = config->quantum ? config->quantum : BOARD_DEFAULT_QUANTUM;
+	board->cpus = calloc(board->ncpus, sizeof *board->cpus);
+	board->stops = calloc(board->ncpus, sizeof *board->stops);
+	board->pool = pool_create(config->threads);
+	if(!board->cpus || !board->stops || !board->pool)
+	{
+		board_destroy(board);
+		return NULL;
+	}
+
+	for(unsigned i = 0; i < board->ncpus; i++)
+		if(emu_init(&board->cpus[i], &config->emu) < 0)
+		{
+			board_destroy(board);
+			return NULL;
+		}
+	return board;
+}
+
+void board_destroy(board_t *board)
+{
+	if(!board)
+		return;
+	for(unsigned i = 0; board->cpus && i < board->ncpus; i++)
+		emu_free(&board->cpus[i]);
+	for(unsigned r = 0; r < board->nregions; r++)
+	{
+		free(board->regions[r].data);
+		free(board->regions[r].views);
+	}
+	if(board->pool)
+		pool_destroy(board->pool);
+	free(board->merge);
+	free(board->stops);
+	free(board->cpus);
+	free(board);
+}
+
+unsigned board_ncpus(const board_t *board)
+{
+	return board->ncpus;
+}
+
+emu_t *board_cpu(board_t *board, unsigned index)
+{
+	return &board->cpus[index];
+}
+
+int board_share(board_t *board, byte first, unsigned count)
+{
+	if(!count || first + count > RAM_PAGES || board->nregions == BOARD_MAX_REGIONS)
+		return -1;
+	for(unsigned r = 0; r < board->nregions; r++)
+	{
+		const board_region_t *other = &board->regions[r];
+		if(first < other->first + other->count && other->first < first + count)
+			return -1;
+	}
+
+	board_region_t *region = &board->regions[board->nregions];
+	region->first = first;
+	region->count = count;
+	region->size = (size_t) count * RAM_PAGE_SIZE;
+	region->data = calloc(1, region->size);
+	region->views = calloc(board->ncpus, region->size);
+	byte *merge = realloc(board->merge, region->size);
+	if(merge)
+		board->merge = merge;
+	if(!region->data || !region->views || !merge)
+	{
+		free(region->data);
+		free(region->views);
+		return -1;
+	}
+
+	for(unsigned i = 0; i < board->ncpus; i++)
+		ram_map_memory(&board->cpus[i].ram, first, count,
+				region->views + i * region->size, 1);
+	board->nregions++;
+	return 0;
+}
+
+// Fold what every CPU changed in its view into the region, in CPU order
+static void board_merge(board_t *board, board_region_t *region)
+{
+	byte *merged = board->merge;
+	memcpy(merged, region->data, region->size);
+	for(unsigned i = 0; i < board->ncpus; i++)
+	{
+		const byte *view = region->views + i * region->size;
+		for(size_t b = 0; b < region->size; b++)
+			if(view[b] != region->data[b])
+				merged[b] = view[b];
+	}
+
+	memcpy(region->data, merged, region->size);
+	for(unsigned i = 0; i < board->ncpus; i++)
+		memcpy(region->views + i * region->size, merged, region->size);
+}
+
+// One CPU's share of a quantum, on a pool worker
+static void board_step(void *arg, size_t index)
+{
+	board_t *board = arg;
+	emu_t *emu = &board->cpus[index];
+	if(board->stops[index] != CPU_STOP_BUDGET || emu->cpu.cycles >= board->target)
+		return; 	// stopped, or still ahead from overshooting the last quantum
+	board->stops[index] = emu_run(emu, CPU_BUDGET_CYCLES, board->target - emu->cpu.cycles);
+}
+
+static unsigned board_running(const board_t *board)
+{
+	unsigned running = 0;
+	for(unsigned i = 0; i < board->ncpus; i++)
+		running += board->stops[i] == CPU_STOP_BUDGET;
+	return running;
+}
+
+unsigned board_run(board_t *board, uint64_t cycles)
+{
+	const uint64_t end = board->time + cycles < board->time ? UINT64_MAX : board->time + cycles;
+	while(board->time < end && board_running(board))
+	{
+		board->target = end - board->time < board->quantum ? end : board->time + board->quantum;
+		pool_run(board->pool, board_step, board, board->ncpus);
+		for(unsigned r = 0; r < board->nregions; r++)
+			board_merge(board, &board->regions[r]);
+		board->time = board->target;
+	}
+	return board_running(board);
+}
+
+cpu_stop_t board_stop_reason(const board_t *board, unsigned index)
+{
+	return board->stops[index];
+}
+
+void board_resume(board_t *board, unsigned index)
+{
+	board->stops[index] = CPU_STOP_BUDGET;
+}
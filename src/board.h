@@ -0,0 +1,68 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "emu.h"
+
+/*
+ *
+ * Lock-step multi-CPU board
+ *
+ * A board is several emu_t instances, each with its own RAM, plus
+ * regions of memory that are mapped into all of them at the same
+ * pages, e.g. a mailbox. The CPUs run in quanta of `quantum` cycles:
+ * within a quantum they run in parallel on a thread pool, then all of
+ * them meet at a barrier before the next quantum starts.
+ *
+ * To make the result independent of the thread count and of timing,
+ * every CPU works on its own view of a shared region during a quantum
+ * and never sees the other CPUs' writes before the barrier. At the
+ * barrier the bytes each CPU changed are merged into the region in CPU
+ * order, so on conflicting writes the highest numbered CPU wins, and
+ * the merged region is copied back into every view.
+ *
+ * */
+
+#define BOARD_DEFAULT_QUANTUM 	1000
+
+typedef struct board_config
+{
+	unsigned ncpus;
+	uint64_t quantum; 		// cycles between barriers, 0 for BOARD_DEFAULT_QUANTUM
+	unsigned threads; 		// 0 for one per online CPU
+	emu_config_t emu; 		// used for every CPU
+} board_config_t;
+
+typedef struct board board_t;
+
+// Returns NULL on failure
+board_t *board_create(const board_config_t *config);
+void board_destroy(board_t *board);
+
+unsigned board_ncpus(const board_t *board);
+
+// CPU `index`, to load programs, map devices or inspect state. Loading
+// an EF file writes own memory, so shared pages are filled through
+// ram_write instead, before the first board_run.
+emu_t *board_cpu(board_t *board, unsigned index);
+
+// Map zeroed pages [first, first + count) as shared into every CPU.
+// Returns -1 on allocation failure or if the pages overlap a region
+// shared before.
+int board_share(board_t *board, byte first, unsigned count);
+
+// Run every CPU for `cycles` more cycles of board time, or until all of
+// them have stopped on KIL, an illegal opcode or a breakpoint. A CPU
+// that stopped stays stopped, the others keep running. Returns how many
+// CPUs are still running.
+unsigned board_run(board_t *board, uint64_t cycles);
+
+// CPU_STOP_BUDGET while the CPU is running, else why it stopped
+cpu_stop_t board_stop_reason(const board_t *board, unsigned index);
+
+// Let a stopped CPU run again in the next board_run
+void board_resume(board_t *board, unsigned index);
+
+#endif
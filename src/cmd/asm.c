@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "asm.h"
+#include "obj.h"
+
+/*
+ *
+ * Assembler front end
+ *
+ * Assembles .a65 source files, one unit each, and links them into an
+ * EF v2 file, by default next to the first source with the extension
+ * replaced. With -c, objects are kept in a cache directory keyed by the
+ * contents of their source, and a unit whose source did not change is
+ * linked from there without assembling it again.
+ *
+ * */
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-o output.ef] [-c cache_dir] [-v] file.a65...\n", prog);
+}
+
+static void print_error(const char *input, const asm_error_t *err)
+{
+	if(err->line)
+		fprintf(stderr, "%s:%u: %s\n", input, err->line, err->msg);
+	else
+		fprintf(stderr, "%s: %s\n", input, err->msg);
+}
+
+// The object of one unit, from the cache if it has one. Returns NULL
+// after printing the reason.
+static byte *unit_object(const char *input, const char *cache, size_t *len, bool *cached)
+{
+	size_t src_len;
+	char *src = obj_read_source(input, &src_len);
+	if(!src)
+	{
+		fprintf(stderr, "Cannot read %s: %s\n", input, strerror(errno));
+		return NULL;
+	}
+
+	asm_error_t err;
+	byte *obj;
+	if(cache)
+		obj = obj_cache_object(cache, src, src_len, len, &err, cached);
+	else
+	{
+		obj = asm_object(src, src_len, len, &err);
+		*cached = false;
+	}
+	free(src);
+	if(!obj)
+		print_error(input, &err);
+	return obj;
+}
+
+int main(int argc, char **argv)
+{
+	const char *output = NULL;
+	const char *cache = NULL;
+	bool verbose = false;
+
+	int opt;
+	while((opt = getopt(argc, argv, "o:c:v")) != -1)
+	{
+		switch(opt)
+		{
+		case 'o':
+			output = optarg;
+			break;
+		case 'c':
+			cache = optarg;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind == argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	if(cache && access(cache, W_OK | X_OK) < 0)
+	{
+		fprintf(stderr, "Cannot write to the cache: %s\n", cache);
+		return 1;
+	}
+
+	const char **inputs = (const char**) argv + optind;
+	const size_t n = argc - optind;
+	byte **images = calloc(n, sizeof *images);
+	obj_file *objs = calloc(n, sizeof *objs);
+	if(!images || !objs)
+	{
+		fprintf(stderr, "Out of memory\n");
+		free(images);
+		free(objs);
+		return 1;
+	}
+
+	int status = 0;
+	size_t parsed = 0, reused = 0;
+	for(; parsed < n; parsed++)
+	{
+		size_t len;
+		bool cached;
+		images[parsed] = unit_object(inputs[parsed], cache, &len, &cached);
+		if(!images[parsed])
+		{
+			status = 1;
+			break;
+		}
+		if(obj_parse(images[parsed], len, &objs[parsed]) < 0)
+		{
+			fprintf(stderr, "Out of memory\n");
+			free(images[parsed]);
+			status = 1;
+			break;
+		}
+		reused += cached;
+	}
+
+	asm_error_t err;
+	size_t ef_len;
+	byte *ef = status ? NULL : obj_link(objs, n, &ef_len, &err);
+	if(!status && !ef)
+	{
+		print_error(inputs[err.unit], &err);
+		status = 1;
+	}
+	for(size_t i = 0; i < parsed; i++)
+	{
+		obj_free(&objs[i]);
+		free(images[i]);
+	}
+	free(objs);
+	free(images);
+	if(status)
+		return status;
+	if(verbose)
+		fprintf(stderr, "%zu units, %zu assembled, %zu from the cache\n", n, n - reused, reused);
+
+	char *fallback = output ? NULL : obj_output_name(inputs[0]);
+	if(!output)
+		output = fallback;
+	FILE *fp = output ? fopen(output, "wb") : NULL;
+	if(!fp || fwrite(ef, 1, ef_len, fp) != ef_len)
+	{
+		fprintf(stderr, "Cannot write %s\n", output ? output : "output");
+		status = 1;
+	}
+	if(fp && fclose(fp) != 0 && !status)
+	{
+		fprintf(stderr, "Cannot write %s\n", output);
+		status = 1;
+	}
+	free(fallback);
+	free(ef);
+	return status;
+}
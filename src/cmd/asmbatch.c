@@ -0,0 +1,314 @@
+#define _XOPEN_SOURCE 700 	// for nftw
+
+#include <errno.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asm.h"
+#include "obj.h"
+#include "pool.h"
+
+/*
+ *
+ * Batch assembler
+ *
+ * Assembles every .a65 source under the given directories, or listed
+ * in the given manifests (one path per line, '-' for stdin), on a
+ * work-stealing thread pool. Every source is a program of its own and
+ * gets an EF file next to it with the extension replaced. All threads
+ * share the one mnemonic table of the assembler.
+ *
+ * Prints one line per source in input order, with how long assembling,
+ * linking and writing it took, and the location of the error for the
+ * ones that failed. With -c, objects come from and go to a cache
+ * directory as with asm65.
+ *
+ * */
+
+typedef enum asmbatch_status
+{
+	ASMBATCH_OK,
+	ASMBATCH_READ_ERROR,
+	ASMBATCH_ASM_ERROR,
+	ASMBATCH_WRITE_ERROR
+} asmbatch_status_t;
+
+typedef struct asmbatch_result
+{
+	asmbatch_status_t status;
+	asm_error_t err;
+	size_t ef_len;
+	uint64_t nsec;
+	bool cached;
+} asmbatch_result_t;
+
+typedef struct asmbatch
+{
+	char **files;
+	size_t nfiles, cap;
+	asmbatch_result_t *results;
+	const char *cache;
+} asmbatch_t;
+
+static uint64_t now_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int add_file(asmbatch_t *batch, const char *fname)
+{
+	if(batch->nfiles == batch->cap)
+	{
+		const size_t cap = batch->cap ? batch->cap * 2 : 64;
+		char **files = realloc(batch->files, cap * sizeof *files);
+		if(!files)
+			return -1;
+		batch->files = files;
+		batch->cap = cap;
+	}
+	char *copy = strdup(fname);
+	if(!copy)
+		return -1;
+	batch->files[batch->nfiles++] = copy;
+	return 0;
+}
+
+static asmbatch_status_t write_file(const char *fname, const byte *data, size_t len)
+{
+	FILE *fp = fname ? fopen(fname, "wb") : NULL;
+	if(!fp)
+		return ASMBATCH_WRITE_ERROR;
+	const bool written = fwrite(data, 1, len, fp) == len;
+	return fclose(fp) == 0 && written ? ASMBATCH_OK : ASMBATCH_WRITE_ERROR;
+}
+
+// Object of the source, linked on its own
+static byte *assemble(asmbatch_t *batch, const char *src, size_t len, asmbatch_result_t *res)
+{
+	size_t obj_len;
+	byte *image = batch->cache
+		? obj_cache_object(batch->cache, src, len, &obj_len, &res->err, &res->cached)
+		: asm_object(src, len, &obj_len, &res->err);
+	if(!image)
+		return NULL;
+
+	obj_file obj;
+	byte *ef = NULL;
+	if(obj_parse(image, obj_len, &obj) < 0)
+		snprintf(res->err.msg, sizeof res->err.msg, "out of memory");
+	else
+	{
+		ef = obj_link(&obj, 1, &res->ef_len, &res->err);
+		obj_free(&obj);
+	}
+	free(image);
+	return ef;
+}
+
+static void assemble_one(void *arg, size_t index)
+{
+	asmbatch_t *batch = arg;
+	asmbatch_result_t *res = &batch->results[index];
+	const uint64_t start = now_nsec();
+
+	size_t len;
+	char *src = obj_read_source(batch->files[index], &len);
+	if(!src)
+	{
+		res->status = ASMBATCH_READ_ERROR;
+		snprintf(res->err.msg, sizeof res->err.msg, "%s", strerror(errno));
+	}
+	else
+	{
+		byte *ef = assemble(batch, src, len, res);
+		free(src);
+		if(!ef)
+			res->status = ASMBATCH_ASM_ERROR;
+		else
+		{
+			char *out = obj_output_name(batch->files[index]);
+			res->status = write_file(out, ef, res->ef_len);
+			free(out);
+			free(ef);
+		}
+	}
+	res->nsec = now_nsec() - start;
+}
+
+/*
+ * Inputs
+ */
+
+static asmbatch_t *walk_batch; 	// nftw has no argument for its callback
+
+static bool is_source(const char *fname)
+{
+	const size_t len = strlen(fname);
+	return len > 4 && strcmp(fname + len - 4, ".a65") == 0;
+}
+
+static int walk_one(const char *fname, const struct stat *st, int type, struct FTW *ftw)
+{
+	(void) st;
+	(void) ftw;
+	if(type == FTW_F && is_source(fname))
+		return add_file(walk_batch, fname);
+	return 0;
+}
+
+static int cmp_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const*) a, *(char *const*) b);
+}
+
+// Every source under `dir`, in name order so runs are comparable
+static int read_dir(asmbatch_t *batch, const char *dir)
+{
+	const size_t first = batch->nfiles;
+	walk_batch = batch;
+	if(nftw(dir, walk_one, 16, FTW_PHYS) != 0)
+	{
+		fprintf(stderr, "Cannot read directory: %s\n", dir);
+		return -1;
+	}
+	qsort(batch->files + first, batch->nfiles - first, sizeof *batch->files, cmp_names);
+	return 0;
+}
+
+static int read_manifest(asmbatch_t *batch, const char *fname)
+{
+	FILE *fp = strcmp(fname, "-") == 0 ? stdin : fopen(fname, "r");
+	if(!fp)
+	{
+		fprintf(stderr, "Cannot open manifest: %s\n", fname);
+		return -1;
+	}
+
+	int ret = 0;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t got;
+	while(ret == 0 && (got = getline(&line, &len, fp)) >= 0)
+	{
+		while(got > 0 && (line[got - 1] == '\n' || line[got - 1] == '\r'))
+			line[--got] = '\0';
+		if(got == 0 || line[0] == '#')
+			continue;
+		ret = add_file(batch, line);
+	}
+	free(line);
+	if(fp != stdin)
+		fclose(fp);
+	return ret;
+}
+
+static int read_input(asmbatch_t *batch, const char *arg)
+{
+	struct stat st;
+	if(strcmp(arg, "-") != 0 && stat(arg, &st) == 0 && S_ISDIR(st.st_mode))
+		return read_dir(batch, arg);
+	return read_manifest(batch, arg);
+}
+
+static const char *status_name(asmbatch_status_t status)
+{
+	switch(status)
+	{
+	case ASMBATCH_OK: 			return "ok";
+	case ASMBATCH_READ_ERROR: 	return "read-error";
+	case ASMBATCH_ASM_ERROR: 	return "error";
+	default: 					return "write-error";
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-j threads] [-c cache_dir] directory|manifest...\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned nthreads = 0;
+	asmbatch_t batch = { 0 };
+
+	int opt;
+	while((opt = getopt(argc, argv, "j:c:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'j':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			batch.cache = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind >= argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	if(batch.cache && access(batch.cache, W_OK | X_OK) < 0)
+	{
+		fprintf(stderr, "Cannot write to the cache: %s\n", batch.cache);
+		return 1;
+	}
+	for(int i = optind; i < argc; i++)
+		if(read_input(&batch, argv[i]) < 0)
+			return 1;
+
+	batch.results = calloc(batch.nfiles ? batch.nfiles : 1, sizeof *batch.results);
+	pool_t *pool = pool_create(nthreads);
+	if(!batch.results || !pool)
+	{
+		fprintf(stderr, "Cannot create thread pool\n");
+		return 1;
+	}
+
+	const uint64_t start = now_nsec();
+	pool_run(pool, assemble_one, &batch, batch.nfiles);
+	const uint64_t wall = now_nsec() - start;
+	const unsigned threads = pool_threads(pool);
+	pool_destroy(pool);
+
+	size_t failed = 0, cached = 0;
+	uint64_t busy = 0;
+	printf("# file\tstatus\tbytes\tusec\tcached\terror\n");
+	for(size_t i = 0; i < batch.nfiles; i++)
+	{
+		const asmbatch_result_t *res = &batch.results[i];
+		const char *fname = batch.files[i];
+		busy += res->nsec;
+		cached += res->cached;
+		printf("%s\t%s\t%zu\t%" PRIu64 "\t%d", fname, status_name(res->status),
+				res->ef_len, res->nsec / 1000, res->cached);
+		if(res->status == ASMBATCH_ASM_ERROR && res->err.line)
+			printf("\t%s:%u: %s\n", fname, res->err.line, res->err.msg);
+		else if(res->status == ASMBATCH_ASM_ERROR || res->status == ASMBATCH_READ_ERROR)
+			printf("\t%s: %s\n", fname, res->err.msg);
+		else
+			printf("\n");
+		failed += res->status != ASMBATCH_OK;
+		free(batch.files[i]);
+	}
+	fprintf(stderr, "%zu files, %zu failed, %zu from the cache, %.3f s on %u threads, %.3f s busy\n",
+			batch.nfiles, failed, cached, wall / 1e9, threads, busy / 1e9);
+
+	free(batch.files);
+	free(batch.results);
+	return failed ? 2 : 0;
+}
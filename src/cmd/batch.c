@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "emu.h"
+#include "pool.h"
+
+/*
+ *
+ * Batch runner
+ *
+ * Runs every EF file listed in a manifest (one path per line, '-' for
+ * stdin) on a work-stealing thread pool, one emu_t per program, and
+ * prints one result line per program in manifest order.
+ *
+ * */
+
+#define DEFAULT_MAX_CYCLES 1000000000ULL
+
+typedef enum batch_status
+{
+	BATCH_LOAD_ERROR = -1 	// otherwise a cpu_stop_t
+} batch_status_t;
+
+typedef struct batch_result
+{
+	int status;
+	byte A, X, Y, SP, P;
+	word PC;
+	uint64_t cycles;
+	uint64_t instructions;
+	uint64_t mismatches; 	// native blocks that differed from the interpreter, with -V
+} batch_result_t;
+
+typedef struct batch
+{
+	char **files;
+	size_t nfiles, cap;
+	batch_result_t *results;
+	uint64_t max_cycles;
+	bool block_cache;
+	bool jit;
+	bool jit_verify;
+	ram_arena_t arena; 	// one slot per worker thread
+} batch_t;
+
+static const char *status_name(int status)
+{
+	switch(status)
+	{
+	case CPU_STOP_BUDGET: 		return "budget";
+	case CPU_STOP_KIL: 			return "kil";
+	case CPU_STOP_ILLEGAL: 		return "illegal";
+	case CPU_STOP_BREAKPOINT: 	return "breakpoint";
+	default: 					return "load-error";
+	}
+}
+
+static void run_one(void *arg, size_t index)
+{
+	batch_t *batch = arg;
+	batch_result_t *res = &batch->results[index];
+
+	emu_t emu;
+	const emu_config_t config =
+	{
+		.arena = &batch->arena,
+		.block_cache = batch->block_cache,
+		.jit = batch->jit,
+		.jit_verify = batch->jit_verify
+	};
+	if(emu_init(&emu, &config) < 0
+		|| emu_load_ef(&emu, batch->files[index]) < 0)
+	{
+		res->status = BATCH_LOAD_ERROR;
+		emu_free(&emu);
+		return;
+	}
+
+	res->status = emu_run(&emu, CPU_BUDGET_CYCLES, batch->max_cycles);
+	res->A = emu.cpu.A;
+	res->X = emu.cpu.X;
+	res->Y = emu.cpu.Y;
+	res->SP = emu.cpu.SP;
+	res->P = cpu_get_status(&emu.cpu);
+	res->PC = emu.cpu.PC;
+	res->cycles = emu.cpu.cycles;
+	res->instructions = emu.cpu.instructions;
+	res->mismatches = emu_jit_mismatches(&emu);
+	emu_free(&emu);
+}
+
+static int add_file(batch_t *batch, const char *fname)
+{
+	if(batch->nfiles == batch->cap)
+	{
+		const size_t cap = batch->cap ? batch->cap * 2 : 64;
+		char **files = realloc(batch->files, cap * sizeof *files);
+		if(!files)
+			return -1;
+		batch->files = files;
+		batch->cap = cap;
+	}
+	char *copy = strdup(fname);
+	if(!copy)
+		return -1;
+	batch->files[batch->nfiles++] = copy;
+	return 0;
+}
+
+static int read_manifest(batch_t *batch, const char *fname)
+{
+	FILE *fp = strcmp(fname, "-") == 0 ? stdin : fopen(fname, "r");
+	if(!fp)
+	{
+		fprintf(stderr, "Cannot open manifest: %s\n", fname);
+		return -1;
+	}
+
+	int ret = 0;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t got;
+	while(ret == 0 && (got = getline(&line, &len, fp)) >= 0)
+	{
+		while(got > 0 && (line[got - 1] == '\n' || line[got - 1] == '\r'))
+			line[--got] = '\0';
+		if(got == 0 || line[0] == '#')
+			continue;
+		ret = add_file(batch, line);
+	}
+	free(line);
+	if(fp != stdin)
+		fclose(fp);
+	if(ret < 0)
+		fprintf(stderr, "Out of memory reading manifest: %s\n", fname);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-b] [-J] [-V] [-j threads] [-c max_cycles] manifest\n"
+			"  -b  run straight-line code from the block cache\n"
+			"  -J  translate hot blocks to native code\n"
+			"  -V  like -J, and check every native block against the interpreter\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned nthreads = 0;
+	uint64_t max_cycles = DEFAULT_MAX_CYCLES;
+	bool block_cache = false, jit = false, jit_verify = false;
+
+	int opt;
+	while((opt = getopt(argc, argv, "bJVj:c:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'b':
+			block_cache = true;
+			break;
+		case 'J':
+			jit = true;
+			break;
+		case 'V':
+			jit_verify = true;
+			break;
+		case 'j':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			max_cycles = strtoull(optarg, NULL, 0);
+			if(max_cycles == 0)
+				max_cycles = UINT64_MAX;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind >= argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	batch_t batch = { .max_cycles = max_cycles, .block_cache = block_cache,
+		.jit = jit, .jit_verify = jit_verify };
+	if(read_manifest(&batch, argv[optind]) < 0)
+		return 1;
+	const size_t n = batch.nfiles;
+
+	batch.results = calloc(n ? n : 1, sizeof *batch.results);
+	pool_t *pool = pool_create(nthreads);
+	if(!batch.results || !pool)
+	{
+		fprintf(stderr, "Cannot create thread pool\n");
+		return 1;
+	}
+	if(ram_arena_init(&batch.arena, pool_threads(pool)) < 0)
+	{
+		fprintf(stderr, "Cannot allocate memory arena\n");
+		return 1;
+	}
+	pool_run(pool, run_one, &batch, n);
+	pool_destroy(pool);
+	ram_arena_free(&batch.arena);
+
+	int failed = 0;
+	uint64_t mismatches = 0;
+	printf("# file\tstop\tA\tX\tY\tSP\tP\tPC\tcycles\tinstructions\n");
+	for(size_t i = 0; i < n; i++)
+	{
+		batch_result_t *res = &batch.results[i];
+		if(res->status == BATCH_LOAD_ERROR)
+		{
+			failed++;
+			printf("%s\t%s\n", batch.files[i], status_name(res->status));
+		}
+		else
+		{
+			printf("%s\t%s\t%02x\t%02x\t%02x\t%02x\t%02x\t%04x\t%" PRIu64 "\t%" PRIu64 "\n",
+				batch.files[i], status_name(res->status),
+				res->A, res->X, res->Y, res->SP, res->P, res->PC,
+				res->cycles, res->instructions);
+		}
+		mismatches += res->mismatches;
+		free(batch.files[i]);
+	}
+	if(mismatches)
+		fprintf(stderr, "jit: %" PRIu64 " native block runs differed from the interpreter\n", mismatches);
+
+	free(batch.files);
+	free(batch.results);
+	return failed || mismatches ? 2 : 0;
+}
@@ -0,0 +1,300 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu6502.h"
+#include "dis.h"
+#include "ef.h"
+
+/*
+ *
+ * Disassembler front end
+ *
+ * Lists the code of an EF file, or of a raw memory dump loaded at the
+ * address given with -b. By default every segment, or the dump, is
+ * swept linearly; -s and -n pick a range instead. With -r only the
+ * code reachable from the entry points is listed: the addresses given
+ * with -e, else the EF entry point, else the reset vector.
+ *
+ * The text listing is source for asm65, with the address and the bytes
+ * of every instruction in a comment. -m prints one tab separated line
+ * per instruction instead:
+ *
+ * 	address 	hex, 4 digits
+ * 	bytes 		hex, the whole instruction
+ * 	mnemonic 	lower case, '-' for bytes that are not an opcode
+ * 	mode 		dis_mode_name, '-' as above
+ * 	operand 	hex, 2 or 4 digits, the target for branches, '-' if none
+ *
+ * */
+
+#define MAX_ENTRIES 	64
+
+typedef struct range
+{
+	word start;
+	uint32_t len;
+} range_t;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+			"usage: %s [-r] [-m] [-e addr]... [-s addr] [-n len] [-b addr] file\n"
+			"  -r  only code reachable from the entry points\n"
+			"  -m  machine readable output\n"
+			"  -e  entry point (hex) for -r, may be repeated\n"
+			"  -s  first address (hex) of the range to list\n"
+			"  -n  bytes to list (hex), default up to the end of memory\n"
+			"  -b  the file is a raw dump to load at this address (hex)\n", prog);
+}
+
+// Hex number up to `max`, -1 if `arg` is not one
+static long parse_hex(const char *arg, unsigned long max)
+{
+	char *end;
+	errno = 0;
+	const unsigned long value = strtoul(arg, &end, 16);
+	if(end == arg || *end || errno || value > max)
+	{
+		fprintf(stderr, "Not a hex number up to %lx: %s\n", max, arg);
+		return -1;
+	}
+	return value;
+}
+
+// Raw dump at `base`, clipped at the end of memory
+static int load_raw(const char *fname, word base, byte *mem, range_t *range)
+{
+	FILE *fp = fopen(fname, "rb");
+	if(!fp)
+	{
+		fprintf(stderr, "File not found or permission denied: %s\n", fname);
+		return -1;
+	}
+	range->start = base;
+	range->len = fread(mem + base, 1, MEM_SIZE - base, fp);
+	fclose(fp);
+	return 0;
+}
+
+static char *put_hex(char *p, unsigned value, int digits)
+{
+	static const char hex[] = "0123456789abcdef";
+	for(int i = digits - 1; i >= 0; i--)
+		*p++ = hex[value >> (4 * i) & 0xF];
+	return p;
+}
+
+// `hidden` comments the text line out, for an instruction that starts
+// inside the one before it
+static void print_insn(const byte *mem, const dis_insn_t *insn, bool machine, bool hidden)
+{
+	char line[128];
+	char *p = line;
+	if(machine)
+	{
+		p = put_hex(p, insn->addr, 4);
+		*p++ = '\t';
+		for(unsigned i = 0; i < insn->len; i++)
+			p = put_hex(p, mem[(word) (insn->addr + i)], 2);
+		*p++ = '\t';
+
+		const char *mnemonic = dis_mnemonic(insn);
+		if(!mnemonic)
+			p += sprintf(p, "-\t-\t-");
+		else
+		{
+			p += sprintf(p, "%s\t%s\t", mnemonic, dis_mode_name(insn->mode));
+			if(insn->len == 1)
+				*p++ = '-';
+			else
+				p = put_hex(p, insn->operand, insn->len == 3 || insn->mode == AM_REL ? 4 : 2);
+		}
+	}
+	else
+	{
+		*p++ = '\t';
+		if(hidden)
+		{
+			*p++ = ';';
+			*p++ = ' ';
+		}
+		const size_t len = dis_text(insn, p);
+		p += len;
+		size_t col = len + (hidden ? 2 : 0);
+		do
+			*p++ = '\t';
+		while((col += 8) < 32);
+		*p++ = ';';
+		*p++ = ' ';
+		p = put_hex(p, insn->addr, 4);
+		*p++ = ' ';
+		for(unsigned i = 0; i < insn->len; i++)
+		{
+			*p++ = ' ';
+			p = put_hex(p, mem[(word) (insn->addr + i)], 2);
+		}
+	}
+	*p++ = '\n';
+	fwrite(line, 1, p - line, stdout);
+}
+
+static void print_org(word addr, bool machine)
+{
+	if(!machine)
+		printf("\t[.org 0x%04x]\n", addr);
+}
+
+static void sweep(const byte *mem, const range_t *range, dis_insn_t *insns, bool machine)
+{
+	const size_t n = dis_sweep(mem, range->start, range->len, insns);
+	print_org(range->start, machine);
+	for(size_t i = 0; i < n; i++)
+		print_insn(mem, &insns[i], machine, false);
+}
+
+static int trace(const byte *mem, const word *entries, size_t nentries, bool machine)
+{
+	byte *starts = calloc(MEM_SIZE / 8, 1);
+	if(!starts)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	dis_trace(mem, entries, nentries, starts);
+
+	// in address order, with an .org wherever the code does not follow on
+	uint32_t next = MEM_SIZE; 	// end of the last instruction listed
+	bool first = true;
+	for(uint32_t addr = 0; addr < MEM_SIZE; addr++)
+	{
+		if(!starts[addr / 8])
+		{
+			addr |= 7;
+			continue;
+		}
+		if(!(starts[addr / 8] & (1 << addr % 8)))
+			continue;
+
+		dis_insn_t insn;
+		dis_decode(mem, addr, &insn);
+		const bool overlaps = !first && addr < next;
+		if(addr != next && !overlaps)
+			print_org(addr, machine);
+		print_insn(mem, &insn, machine, overlaps);
+		if(!overlaps)
+			next = addr + insn.len;
+		first = false;
+	}
+	free(starts);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	bool recursive = false, machine = false, raw = false, have_start = false;
+	word entries[MAX_ENTRIES];
+	size_t nentries = 0;
+	word base = 0;
+	range_t range = { 0, 0 };
+	uint32_t len = 0;
+
+	int opt;
+	long value;
+	while((opt = getopt(argc, argv, "rme:s:n:b:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'r':
+			recursive = true;
+			break;
+		case 'm':
+			machine = true;
+			break;
+		case 'e':
+			if(nentries == MAX_ENTRIES)
+			{
+				fprintf(stderr, "Too many entry points\n");
+				return 1;
+			}
+			if((value = parse_hex(optarg, MEM_MAX)) < 0)
+				return 1;
+			entries[nentries++] = value;
+			break;
+		case 's':
+			if((value = parse_hex(optarg, MEM_MAX)) < 0)
+				return 1;
+			range.start = value;
+			have_start = true;
+			break;
+		case 'n':
+			if((value = parse_hex(optarg, MEM_SIZE)) < 0)
+				return 1;
+			len = value;
+			break;
+		case 'b':
+			if((value = parse_hex(optarg, MEM_MAX)) < 0)
+				return 1;
+			base = value;
+			raw = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind != argc - 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	byte *mem = calloc(MEM_SIZE, 1);
+	dis_insn_t *insns = malloc(MEM_SIZE * sizeof *insns);
+	if(!mem || !insns)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	static char out[1 << 20];
+	setvbuf(stdout, out, _IOFBF, sizeof out);
+
+	ef_file hdr = { 0 };
+	range_t loaded;
+	if(raw ? load_raw(argv[optind], base, mem, &loaded) < 0 : read_ef(argv[optind], &hdr) < 0)
+		return 1;
+	for(word i = 0; i < hdr.ef_nsegs; i++)
+		memcpy(mem + hdr.ef_segs[i].addr, hdr.ef_segs[i].data, hdr.ef_segs[i].len);
+
+	int status = 0;
+	if(recursive)
+	{
+		if(!nentries)
+			entries[nentries++] = hdr.ef_flags & EF_HAS_ENTRY ? hdr.ef_entry
+				: (word) (mem[RESET_VECTOR] | mem[RESET_VECTOR + 1] << 8);
+		status = trace(mem, entries, nentries, machine) < 0;
+	}
+	else if(have_start || len)
+	{
+		range.len = len && len <= (uint32_t) (MEM_SIZE - range.start) ? len : (uint32_t) (MEM_SIZE - range.start);
+		sweep(mem, &range, insns, machine);
+	}
+	else if(raw)
+		sweep(mem, &loaded, insns, machine);
+	else
+		for(word i = 0; i < hdr.ef_nsegs; i++)
+		{
+			const range_t seg = { hdr.ef_segs[i].addr, hdr.ef_segs[i].len };
+			sweep(mem, &seg, insns, machine);
+		}
+
+	fflush(stdout);
+	free_ef(&hdr);
+	free(insns);
+	free(mem);
+	return status;
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "board.h"
+
+static void dump_cpu_flags(cpu6502_t *cpu)
+{
+	const byte status = cpu_get_status(cpu);
+	puts("\nFlags: ");
+	printf("Carry: 		%d\n", status & C);
+	printf("Zero: 		%d\n", status & Z ? 1 : 0);
+	printf("Interrupt: 	%d\n", status & I ? 1 : 0);
+	printf("Decimal: 	%d\n", status & D ? 1 : 0);
+	printf("Break:		%d\n", status & B ? 1 : 0);
+	printf("Unused: 	%d\n", status & U ? 1 : 0);
+	printf("Overflow: 	%d\n", status & V ? 1 : 0);
+	printf("Negative: 	%d\n", status & N ? 1 : 0);
+}
+
+static void dump_cpu_regs(cpu6502_t *cpu)
+{
+	puts("\nRegisters: ");
+	printf("A:	0x%x\n", cpu->A);
+	printf("X:	0x%x\n", cpu->X);
+	printf("Y:	0x%x\n", cpu->Y);
+	printf("PC: 	0x%x\n", cpu->PC);
+	printf("SP: 	0x%x\n", cpu->SP);
+	printf("Cycles:	%" PRIu64 "\n", cpu->cycles);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+			"usage: %s [-b] [-J] [-V] [-s page[:count]]... [-q quantum] [-j threads] file.ef...\n"
+			"  Every file runs on its own CPU, all CPUs run in lock-step.\n"
+			"  -b  run straight-line code from the block cache\n"
+			"  -J  translate hot blocks to native code\n"
+			"  -V  like -J, and check every native block against the interpreter;\n"
+			"      exits with 2 if one differs\n"
+			"  -s  share pages (hex) between all CPUs, may be repeated\n"
+			"  -q  cycles per lock-step quantum (default %d)\n"
+			"  -j  worker threads (default one per CPU)\n", prog, BOARD_DEFAULT_QUANTUM);
+}
+
+int main(int argc, char **argv)
+{
+	board_config_t config = { .emu = { .verbose = true } };
+	struct { byte first; unsigned count; } shared[8];
+	unsigned nshared = 0;
+
+	int opt;
+	while((opt = getopt(argc, argv, "bJVs:q:j:")) != -1)
+	{
+		char *end;
+		switch(opt)
+		{
+		case 'b':
+			config.emu.block_cache = true;
+			break;
+		case 'J':
+			config.emu.jit = true;
+			break;
+		case 'V':
+			config.emu.jit_verify = true;
+			break;
+		case 's':
+			if(nshared == sizeof shared / sizeof *shared)
+			{
+				fprintf(stderr, "Too many shared regions\n");
+				exit(1);
+			}
+			shared[nshared].first = strtoul(optarg, &end, 16);
+			shared[nshared].count = *end == ':' ? strtoul(end + 1, NULL, 0) : 1;
+			nshared++;
+			break;
+		case 'q':
+			config.quantum = strtoull(optarg, NULL, 0);
+			break;
+		case 'j':
+			config.threads = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if(optind >= argc)
+	{
+		fprintf(stderr, "Insufficient arguments\n");
+		usage(argv[0]);
+		exit(1);
+	}
+
+	config.ncpus = argc - optind;
+	if(!config.threads)
+		config.threads = config.ncpus;
+	board_t *board = board_create(&config);
+	if(!board)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	for(unsigned i = 0; i < nshared; i++)
+		if(board_share(board, shared[i].first, shared[i].count) < 0)
+		{
+			fprintf(stderr, "Cannot share pages $%02x:%u\n", shared[i].first, shared[i].count);
+			board_destroy(board);
+			exit(1);
+		}
+
+	for(unsigned i = 0; i < config.ncpus; i++)
+		if(emu_load_ef(board_cpu(board, i), argv[optind + i]) < 0)
+		{
+			board_destroy(board);
+			exit(1);
+		}
+
+	board_run(board, UINT64_MAX);
+
+	int status = 0;
+	for(unsigned i = 0; i < config.ncpus; i++)
+	{
+		emu_t *emu = board_cpu(board, i);
+		if(board_stop_reason(board, i) != CPU_STOP_ILLEGAL)
+			continue;
+		if(config.ncpus > 1)
+			printf("CPU %u: ", i);
+		printf("Invalid instruction: 0x%x\n", cpu_read_byte(&emu->ram, emu->cpu.PC));
+		status = 1;
+	}
+
+	uint64_t mismatches = 0;
+	for(unsigned i = 0; i < config.ncpus; i++)
+		mismatches += emu_jit_mismatches(board_cpu(board, i));
+	if(mismatches)
+	{
+		fprintf(stderr, "jit: %" PRIu64 " native block runs differed from the interpreter\n", mismatches);
+		status = 2;
+	}
+
+	for(unsigned i = 0; i < config.ncpus && !status; i++)
+	{
+		if(config.ncpus > 1)
+			printf("\nCPU %u:\n", i);
+		dump_cpu_flags(&board_cpu(board, i)->cpu);
+		dump_cpu_regs(&board_cpu(board, i)->cpu);
+	}
+	board_destroy(board);
+	return status;
+}
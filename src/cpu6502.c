@@ -10,42 +10,41 @@
 #include <fcntl.h>
 
 #include "cpu6502.h"
-#include "ef.h"
+#include "bcache.h"
 
-static void dump_cpu_flags(cpu6502_t *cpu)
+void cpu_reset(cpu6502_t *cpu, ram_t *rm)
 {
-	puts("\nFlags: ");
-	printf("Carry: 		%d\n", cpu->status & C);
-	printf("Zero: 		%d\n", cpu->status & Z ? 1 : 0);
-	printf("Interrupt: 	%d\n", cpu->status & I ? 1 : 0);
-	printf("Decimal: 	%d\n", cpu->status & D ? 1 : 0);
-	printf("Break:		%d\n", cpu->status & B ? 1 : 0);
-	printf("Unused: 	%d\n", cpu->status & U ? 1 : 0);
-	printf("Overflow: 	%d\n", cpu->status & V ? 1 : 0);
-	printf("Negative: 	%d\n", cpu->status & N ? 1 : 0);
+	memset(cpu, 0, sizeof *cpu);
+	cpu->SP = PAGE_SIZE;
+	cpu_set_status(cpu, 0);
+	cpu->A = cpu->X = cpu->Y = 0x0;
+	cpu->pending = CPU_INT_RESET;
+	ram_clear(rm);
 }
 
-static void dump_cpu_regs(cpu6502_t *cpu)
+void cpu_set_irq(cpu6502_t *cpu, byte source, bool asserted)
 {
-	puts("\nRegisters: ");
-	printf("A:	0x%x\n", cpu->A);
-	printf("X:	0x%x\n", cpu->X);
-	printf("Y:	0x%x\n", cpu->Y);
-	printf("PC: 	0x%x\n", cpu->PC);
-	printf("SP: 	0x%x\n", cpu->SP);
+	if(asserted)
+		cpu->irq |= source;
+	else
+		cpu->irq &= ~source;
+	cpu->pending = (cpu->pending & ~CPU_INT_IRQ) | (cpu->irq ? CPU_INT_IRQ : 0);
 }
 
-void cpu_reset(cpu6502_t *cpu, ram_t *rm)
+void cpu_trigger_nmi(cpu6502_t *cpu)
 {
-	memset(cpu, 0, sizeof *cpu);
-	cpu->PC = PROG_BEGIN;
-	cpu->SP = PAGE_SIZE;
-	cpu->status = 0;
-	cpu->A = cpu->X = cpu->Y = 0x0;
-	ram_init(rm);
+	cpu->pending |= CPU_INT_NMI;
+}
+
+void cpu_trigger_reset(cpu6502_t *cpu)
+{
+	cpu->pending |= CPU_INT_RESET;
 }
 
-static uint32_t cycles = 0;
+void cpu_yield(cpu6502_t *cpu)
+{
+	cpu->pending |= CPU_INT_YIELD;
+}
 
 // Fetch byte from RAM increasing program counter once. Takes one clock cycle.
 byte cpu_fetch_byte(cpu6502_t *cpu, ram_t *ram)
@@ -119,65 +118,138 @@ void cpu_push_stack_byte(cpu6502_t *cpu, ram_t *ram, byte data)
 	cpu->SP--;
 }
 
+// The stack grows down, so the high byte ends up above the low byte
 void cpu_push_stack_word(cpu6502_t *cpu, ram_t *ram, word data)
 {
-	byte high = (data >> 8) & 0xFF;
-	byte low = (data & 0xFF);
-	if(__ORDER_LITTLE_ENDIAN__)
-	{
-		cpu_write_byte(ram, STACK_BEGIN + cpu->SP, low);
-		cpu->SP--;
-		cpu_write_byte(ram, STACK_BEGIN + cpu->SP, high);
-		cpu->SP--;
-	}
-	else
-	{
-		cpu_write_byte(ram, STACK_BEGIN + cpu->SP, high);
-		cpu->SP--;
-		cpu_write_byte(ram, STACK_BEGIN + cpu->SP, low);
-		cpu->SP--;
-	}
+	cpu_push_stack_byte(cpu, ram, data >> 8);
+	cpu_push_stack_byte(cpu, ram, data & 0xFF);
 }
 
 byte cpu_pop_stack_byte(cpu6502_t *cpu, ram_t *ram)
 {
 	cpu->SP++;
-	return cpu_read_byte(ram, cpu->SP);
+	return cpu_read_byte(ram, STACK_BEGIN + cpu->SP);
 }
 
 word cpu_pop_stack_word(cpu6502_t *cpu, ram_t *ram)
 {
-	byte high = 0x0, low = 0x0;
-	cpu->SP++;
-	if(__ORDER_LITTLE_ENDIAN__)
-	{
-		high = cpu_read_byte(ram, STACK_BEGIN + cpu->SP);
-		cpu->SP++;
-		low = cpu_read_byte(ram, STACK_BEGIN + cpu->SP);
-	}
-	else
-	{
-		low = cpu_read_byte(ram, STACK_BEGIN + cpu->SP);
-		cpu->SP++;
-		high = cpu_read_byte(ram, STACK_BEGIN + cpu->SP);
-	}
+	byte low = cpu_pop_stack_byte(cpu, ram);
+	byte high = cpu_pop_stack_byte(cpu, ram);
 	return (high << 8) | low;
 }
 
+/*
+ *
+ * Effective address helpers
+ *
+ * Base cycle costs come from cpu_optable. Read instructions using
+ * abs,X / abs,Y / (ind),Y take one extra cycle when the index carries
+ * into the next page.
+ *
+ * */
+
+static inline byte page_crossed(word a, word b)
+{
+	return ((a ^ b) >> 8) != 0;
+}
+
+// zp / zp, X / zp, Y: the index wraps within zero page
+static inline word cpu_addr_zp(cpu6502_t *cpu, ram_t *ram, byte index)
+{
+	return (byte) (cpu_fetch_byte(cpu, ram) + index);
+}
+
+// abs / abs, X / abs, Y for writes and read-modify-write, no penalty
+static inline word cpu_addr_abs(cpu6502_t *cpu, ram_t *ram, byte index)
+{
+	return cpu_fetch_word(cpu, ram) + index;
+}
+
+// (zp, X): pointer at zero page operand + X, wraps within zero page
+static inline word cpu_addr_indx(cpu6502_t *cpu, ram_t *ram)
+{
+	byte zp_addr = cpu_fetch_byte(cpu, ram) + cpu->X;
+	byte low = cpu_read_byte(ram, zp_addr);
+	byte high = cpu_read_byte(ram, (byte) (zp_addr + 1));
+	return (high << 8) | low;
+}
+
+// (zp), Y: pointer at zero page operand, then + Y
+static inline word cpu_addr_indy(cpu6502_t *cpu, ram_t *ram)
+{
+	byte zp_addr = cpu_fetch_byte(cpu, ram);
+	byte low = cpu_read_byte(ram, zp_addr);
+	byte high = cpu_read_byte(ram, (byte) (zp_addr + 1));
+	word base = (high << 8) | low;
+	return base + cpu->Y;
+}
+
+// (zp), Y for read instructions, adds page crossing penalty
+static inline word cpu_addr_indy_read(cpu6502_t *cpu, ram_t *ram)
+{
+	word addr = cpu_addr_indy(cpu, ram);
+	cpu->cycles += page_crossed(addr - cpu->Y, addr);
+	return addr;
+}
+
+// abs, X / abs, Y for read instructions, adds page crossing penalty
+static inline word cpu_addr_abs_read(cpu6502_t *cpu, ram_t *ram, byte index)
+{
+	word base = cpu_fetch_word(cpu, ram);
+	word addr = base + index;
+	cpu->cycles += page_crossed(base, addr);
+	return addr;
+}
+
 /*
  *
  * Add with carry
  *
  * */
 
+static inline void perform_adc_binary(cpu6502_t *cpu, byte fetched)
+{
+	word tmp = cpu->A + fetched + cpu->carry;
+	cpu->v_a = cpu->A;
+	cpu->v_m = fetched;
+	cpu->v_r = tmp;
+	cpu->carry = tmp >> 8;
+	cpu->A = (byte) tmp;
+	cpu_set_nz(cpu, cpu->A);
+}
+
+/*
+ * Decimal mode as on the NMOS 6502: each nibble is corrected on its own.
+ * Z comes from the binary sum, N and V from the sum before the high
+ * nibble is corrected, and C from the corrected sum.
+ */
+__attribute__((noinline, cold))
+static void perform_adc_decimal(cpu6502_t *cpu, byte fetched)
+{
+	const byte a = cpu->A;
+	int low = (a & 0x0F) + (fetched & 0x0F) + cpu->carry;
+	if(low >= 0x0A)
+		low = ((low + 0x06) & 0x0F) + 0x10;
+	int sum = (a & 0xF0) + (fetched & 0xF0) + low;
+
+	cpu->zres = a + fetched + cpu->carry;
+	cpu->nres = sum;
+	cpu->v_a = a;
+	cpu->v_m = fetched;
+	cpu->v_r = sum;
+	if(sum >= 0xA0)
+		sum += 0x60;
+	cpu->carry = sum >= 0x100;
+	cpu->A = sum;
+}
+
+// Decimal mode is rare, so binary ADC only pays for one well predicted test
 static inline void perform_adc(cpu6502_t *cpu, byte fetched)
 {
-	word tmp = fetched + cpu->A + (cpu->status & C ? 1 : 0);
-	cpu->status |= (tmp & 0x00FF) == 0 ? Z : 0; // zero
-	cpu->status |= (tmp & 0x0080) == 1 ? N : 0; // negative
-	cpu->status |= (tmp > 0x00FF) == 1 ? C : 0;
-	cpu->status |= ((~(cpu->A) ^ fetched) & (cpu->A ^ tmp) & 0x0080) ? V : 0;
-	cpu->A = (byte) (tmp & 0x00FF);
+	if(__builtin_expect(cpu->status & D, 0))
+		perform_adc_decimal(cpu, fetched);
+	else
+		perform_adc_binary(cpu, fetched);
 }
 
 void ADC_IMM(cpu6502_t *cpu, ram_t *ram)
@@ -221,9 +293,9 @@ void ADC_ZPX(cpu6502_t *cpu, ram_t *ram)
  *	ADC abs, Y	79
  *
  * */
-static inline void perform_adc_abs(cpu6502_t *cpu, ram_t *ram, off_t addr_off)
+static inline void perform_adc_abs(cpu6502_t *cpu, ram_t *ram, byte addr_off)
 {
-	word abs_addr = cpu_fetch_word(cpu, ram) + addr_off;
+	word abs_addr = cpu_addr_abs_read(cpu, ram, addr_off);
 	byte data = cpu_read_byte(ram, abs_addr);
 	perform_adc(cpu, data);
 }
@@ -252,22 +324,16 @@ void ADC_ABSY(cpu6502_t *cpu, ram_t *ram)
  *	ADC (ind, y)	71
  *
  * */
-static inline void perform_adc_ind(cpu6502_t *cpu, ram_t *ram, off_t addr_off)
-{
-	word abs_addr = cpu_fetch_word(cpu, ram);
-	word ind_addr = cpu_read_word(ram, abs_addr) + addr_off;
-	byte data = cpu_read_byte(ram, ind_addr);
-	perform_adc(cpu, data);
-}
-
 void ADC_INDX(cpu6502_t *cpu, ram_t *ram)
 {
-	perform_adc_ind(cpu, ram, cpu->X);
+	word ind_addr = cpu_addr_indx(cpu, ram);
+	perform_adc(cpu, cpu_read_byte(ram, ind_addr));
 }
 
 void ADC_INDY(cpu6502_t *cpu, ram_t *ram)
 {
-	perform_adc_ind(cpu, ram, cpu->Y);
+	word ind_addr = cpu_addr_indy_read(cpu, ram);
+	perform_adc(cpu, cpu_read_byte(ram, ind_addr));
 }
 
 /*
@@ -276,42 +342,35 @@ void ADC_INDY(cpu6502_t *cpu, ram_t *ram)
  *
  * */
 
-// Changing status bits related to ASL operation
-static inline void inc_set_status(cpu6502_t *cpu)
+// increment memory at zero page memory location
+static inline void perform_inc(cpu6502_t *cpu, ram_t *ram, word addr)
 {
-	CPU_SET_FLAGS(cpu, Z | (cpu->A & N ? N : 0));
+	byte result = cpu_read_byte(ram, addr) + 1;
+	cpu_write_byte(ram, addr, result);
+	cpu_set_nz(cpu, result);
 }
 
-// increment memory at zero page memory location
 void INC_ZP(cpu6502_t *cpu, ram_t *ram)
 {
-	byte zp_addr = cpu_fetch_byte(cpu, ram);
-	cpu_write_byte(ram, zp_addr, ram_read(ram, zp_addr) + 1);
-	inc_set_status(cpu);
+	perform_inc(cpu, ram, cpu_addr_zp(cpu, ram, 0));
 }
 
 // increment memory at zero page memory location + X
 void INC_ZPX(cpu6502_t *cpu, ram_t *ram)
 {
-	byte zp_addr = cpu_fetch_byte(cpu, ram);
-	cpu_write_byte(ram, zp_addr + cpu->X, ram_read(ram, zp_addr) + 1);
-	inc_set_status(cpu);
+	perform_inc(cpu, ram, cpu_addr_zp(cpu, ram, cpu->X));
 }
 
 // increment memory at absolute memory location
 void INC_ABS(cpu6502_t *cpu, ram_t *ram)
 {
-	word abs_addr = cpu_fetch_word(cpu, ram);
-	cpu_write_byte(ram, abs_addr, ram_read(ram, abs_addr) + 1);
-	inc_set_status(cpu);
+	perform_inc(cpu, ram, cpu_addr_abs(cpu, ram, 0));
 }
 
 // increment memory at absolute memory location + X
 void INC_ABSX(cpu6502_t *cpu, ram_t *ram)
 {
-	word abs_addr = cpu_fetch_word(cpu, ram);
-	cpu_write_byte(ram, abs_addr + cpu->X, ram_read(ram, abs_addr) + 1);
-	inc_set_status(cpu);
+	perform_inc(cpu, ram, cpu_addr_abs(cpu, ram, cpu->X));
 }
 
 /*
@@ -323,10 +382,9 @@ void INC_ABSX(cpu6502_t *cpu, ram_t *ram)
 // Changing status bits related to BIT operation
 void bit_set_status(cpu6502_t *cpu, byte data)
 {
-	// cpu->status |= (data & N); // 7th bit goes to N flag
-	// cpu->status |= (data & V); // 6th bit goes to V flag
-	CPU_SET_FLAGS(cpu, (data & N) | (data & V)); // 7th bit goes to N flag
-												// 6th bit goes to V flag
+	cpu->nres = data; 			// 7th bit goes to N flag
+	cpu_set_v(cpu, data & V); 	// 6th bit goes to V flag
+	cpu->zres = cpu->A & data;
 }
 
 void BIT_ZP(cpu6502_t *cpu, ram_t *ram)
@@ -339,7 +397,7 @@ void BIT_ZP(cpu6502_t *cpu, ram_t *ram)
 
 void BIT_ABS(cpu6502_t *cpu, ram_t *ram)
 {
-	byte abs_addr = cpu_fetch_word(cpu, ram);
+	word abs_addr = cpu_fetch_word(cpu, ram);
 	byte data = cpu_read_byte(ram, abs_addr);
 	bit_set_status(cpu, data);
 }
@@ -351,50 +409,47 @@ void BIT_ABS(cpu6502_t *cpu, ram_t *ram)
  *
  * */
 
-// Changing status bits related to ASL operation
-void asl_set_status(cpu6502_t *cpu)
+// Shift data left, bit 7 goes to carry. Returns the result with N and Z set.
+static inline byte perform_asl(cpu6502_t *cpu, byte data)
 {
-	cpu->status |= Z;
-	cpu->status |= (cpu->A & N);
-	cpu->status |= (cpu->A >> 7) & C;
+	cpu->carry = data >> 7;
+	byte result = data << 1;
+	cpu_set_nz(cpu, result);
+	return result;
 }
 
-void ASL_A(cpu6502_t *cpu)
+void ASL_A(cpu6502_t *cpu, ram_t *ram)
 {
-	cpu->A <<= 1;
-	asl_set_status(cpu);
+	(void) ram;
+	cpu->A = perform_asl(cpu, cpu->A);
+}
+
+// Read-modify-write of memory through one of the shift or rotate helpers
+static inline void perform_rmw(cpu6502_t *cpu, ram_t *ram, word addr,
+		byte (*op)(cpu6502_t *, byte))
+{
+	byte data = cpu_read_byte(ram, addr);
+	cpu_write_byte(ram, addr, op(cpu, data));
 }
 
 void ASL_ZP(cpu6502_t *cpu, ram_t *ram)
 {
-	byte zp_addr = cpu_fetch_byte(cpu, ram);
-	byte data = cpu_read_byte(ram, zp_addr);
-	cpu_write_byte(ram, zp_addr, data << 1);
-	asl_set_status(cpu);
+	perform_rmw(cpu, ram, cpu_addr_zp(cpu, ram, 0), perform_asl);
 }
 
 void ASL_ZPX(cpu6502_t *cpu, ram_t *ram)
 {
-	byte zp_addr = cpu_fetch_byte(cpu, ram);
-	byte data = cpu_read_byte(ram, zp_addr + cpu->X);
-	cpu_write_byte(ram, zp_addr, data << 1);
-	asl_set_status(cpu);
+	perform_rmw(cpu, ram, cpu_addr_zp(cpu, ram, cpu->X), perform_asl);
 }
 
 void ASL_ABS(cpu6502_t *cpu, ram_t *ram)
 {
-	byte abs_addr = cpu_fetch_word(cpu, ram);
-	byte data = cpu_read_byte(ram, abs_addr);
-	cpu_write_byte(ram, abs_addr, data << 1);
-	asl_set_status(cpu);
+	perform_rmw(cpu, ram, cpu_addr_abs(cpu, ram, 0), perform_asl);
 }
 
 void ASL_ABSX(cpu6502_t *cpu, ram_t *ram)
 {
-	byte abs_addr = cpu_fetch_word(cpu, ram);
-	byte data = cpu_read_byte(ram, abs_addr + cpu->X);
-	cpu_write_byte(ram, abs_addr, data << 1);
-	asl_set_status(cpu);
+	perform_rmw(cpu, ram, cpu_addr_abs(cpu, ram, cpu->X), perform_asl);
 }
 
 /*
@@ -406,8 +461,7 @@ void ASL_ABSX(cpu6502_t *cpu, ram_t *ram)
 // Changing status bits related to AND operation
 void and_set_status(cpu6502_t *cpu)
 {
-	cpu->status |= Z;
-	cpu->status |= (cpu->A & N);
+	cpu_set_nz(cpu, cpu->A);
 }
 
 void AND_IMM(cpu6502_t *cpu, ram_t *ram)
@@ -436,9 +490,9 @@ void AND_ZPX(cpu6502_t *cpu, ram_t *ram)
  * ABS
  *
  * */
-static void perform_and_abs(cpu6502_t *cpu, ram_t *ram, off_t addr_off)
+static void perform_and_abs(cpu6502_t *cpu, ram_t *ram, byte addr_off)
 {
-	word abs_addr = cpu_fetch_word(cpu, ram) + addr_off;
+	word abs_addr = cpu_addr_abs_read(cpu, ram, addr_off);
 	cpu->A &= cpu_read_byte(ram, abs_addr);
 	and_set_status(cpu);
 }
@@ -464,22 +518,18 @@ void AND_ABSY(cpu6502_t *cpu, ram_t *ram)
  * AND (ind, x/y)
  *
  * */
-static void perform_and_ind(cpu6502_t *cpu, ram_t *ram, off_t addr_off)
+void AND_INDX(cpu6502_t *cpu, ram_t *ram)
 {
-	word abs_addr = cpu_fetch_word(cpu, ram) + addr_off;
-	word ind_addr = cpu_read_word(ram, abs_addr);
+	word ind_addr = cpu_addr_indx(cpu, ram);
 	cpu->A &= cpu_read_byte(ram, ind_addr);
 	and_set_status(cpu);
 }
 
-void AND_INDX(cpu6502_t *cpu, ram_t *ram)
-{
-	perform_and_ind(cpu, ram, cpu->X);
-}
-
 void AND_INDY(cpu6502_t *cpu, ram_t *ram)
 {
-	perform_and_ind(cpu, ram, cpu->Y);
+	word ind_addr = cpu_addr_indy_read(cpu, ram);
+	cpu->A &= cpu_read_byte(ram, ind_addr);
+	and_set_status(cpu);
 }
 
 
@@ -493,16 +543,17 @@ void AND_INDY(cpu6502_t *cpu, ram_t *ram)
 void JMP_ABS(cpu6502_t *cpu, ram_t *ram)
 {
 	word abs_addr = cpu_fetch_word(cpu, ram);
-	printf("[PC] From: 0x%x to: ", cpu->PC);
 	cpu->PC = abs_addr;
-	printf("0x%x\n", cpu->PC);
 }
 
+// The pointer's high byte is read from the same page, so JMP ($10FF)
+// takes it from $1000 like the NMOS 6502 does
 void JMP_IND(cpu6502_t *cpu, ram_t *ram)
 {
-	word abs_addr = cpu_fetch_word(cpu, ram);
-	word ind_addr = cpu_read_word(ram, abs_addr);
-	cpu->PC = ind_addr;
+	word ptr = cpu_fetch_word(cpu, ram);
+	byte low = cpu_read_byte(ram, ptr);
+	byte high = cpu_read_byte(ram, (ptr & 0xFF00) | (byte) (ptr + 1));
+	cpu->PC = (high << 8) | low;
 }
 
 /*
@@ -512,74 +563,66 @@ void JMP_IND(cpu6502_t *cpu, ram_t *ram)
  * */
 
 // Changing status bits related to LDA operation
-void lda_set_status(cpu6502_t *cpu)
+void lda_set_status(cpu6502_t *cpu, byte data)
 {
-	cpu->status |= Z;
-	cpu->status |= (cpu->A & N) ? N : 0;
+	cpu_set_nz(cpu, data);
 }
 
 void LDA_IMM(cpu6502_t *cpu, ram_t *ram)
 {
 	byte data = cpu_fetch_byte(cpu, ram);
 	cpu->A = data;
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->A);
 }
 
 void LDA_ZP(cpu6502_t *cpu, ram_t *ram)
 {
 	byte zp_addr = cpu_fetch_byte(cpu, ram); //zero page address
 	cpu->A = cpu_read_byte(ram, zp_addr); // read from RAM
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->A);
 }
 
 void LDA_ZPX(cpu6502_t *cpu, ram_t *ram)
 {
 	byte imm_zp_addr = cpu_fetch_byte(cpu, ram);
 	imm_zp_addr += cpu->X;
-	cycles++; // ^ for addition
 	cpu->A = cpu_read_byte(ram, imm_zp_addr);
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->A);
 }
 
 void LDA_ABS(cpu6502_t *cpu, ram_t *ram)
 {
 	word addr = cpu_fetch_word(cpu, ram); // creating address
 	cpu->A = cpu_read_byte(ram, addr);
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->A);
 }
 
 void LDA_ABSX(cpu6502_t *cpu, ram_t *ram)
 {
-	word addr = cpu_fetch_word(cpu, ram) + cpu->X; // creating address by adding X
+	word addr = cpu_addr_abs_read(cpu, ram, cpu->X); // creating address by adding X
 	cpu->A = cpu_read_byte(ram, addr);
-	cycles++;
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->A);
 }
 
 void LDA_ABSY(cpu6502_t *cpu, ram_t *ram)
 {
-	word addr = cpu_fetch_word(cpu, ram) + cpu->Y; // creating address by adding Y
+	word addr = cpu_addr_abs_read(cpu, ram, cpu->Y); // creating address by adding Y
 	cpu->A = cpu_read_byte(ram, addr);
-	cycles++;
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->A);
 }
 
 void LDA_INDX(cpu6502_t *cpu, ram_t *ram)
 {
-	word abs_addr = cpu_fetch_word(cpu, ram) + cpu->X; // creating address by adding X
-	word ind_addr = cpu_read_word(ram, abs_addr);
+	word ind_addr = cpu_addr_indx(cpu, ram);
 	cpu->A = cpu_read_byte(ram, ind_addr);
-	cycles++;
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->A);
 }
 
 void LDA_INDY(cpu6502_t *cpu, ram_t *ram)
 {
-	word abs_addr = cpu_fetch_word(cpu, ram) + cpu->Y; // creating address by adding Y
-	word ind_addr = cpu_read_word(ram, abs_addr);
+	word ind_addr = cpu_addr_indy_read(cpu, ram);
 	cpu->A = cpu_read_byte(ram, ind_addr);
-	cycles++;
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->A);
 }
 
 /*
@@ -593,38 +636,36 @@ void LDX_IMM(cpu6502_t *cpu, ram_t *ram)
 {
 	byte data = cpu_fetch_byte(cpu, ram);
 	cpu->X = data;
-	lda_set_status(cpu); //TODO::: same as LDA for now
+	lda_set_status(cpu, cpu->X);
 }
 
 void LDX_ZP(cpu6502_t *cpu, ram_t *ram)
 {
 	byte zp_addr = cpu_fetch_byte(cpu, ram); //zero page address
 	cpu->X = cpu_read_byte(ram, zp_addr); // read from RAM
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->X);
 }
 
 void LDX_ZPY(cpu6502_t *cpu, ram_t *ram)
 {
 	byte imm_zp_addr = cpu_fetch_byte(cpu, ram);
 	imm_zp_addr += cpu->Y;
-	cycles++; // ^ for addition
 	cpu->X = cpu_read_byte(ram, imm_zp_addr);
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->X);
 }
 
 void LDX_ABS(cpu6502_t *cpu, ram_t *ram)
 {
 	word addr = cpu_fetch_word(cpu, ram); // creating address
 	cpu->X = cpu_read_byte(ram, addr);
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->X);
 }
 
 void LDX_ABSY(cpu6502_t *cpu, ram_t *ram)
 {
-	word addr = cpu_fetch_word(cpu, ram) + cpu->Y; // creating address by adding Y
+	word addr = cpu_addr_abs_read(cpu, ram, cpu->Y); // creating address by adding Y
 	cpu->X = cpu_read_byte(ram, addr);
-	cycles++;
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->X);
 }
 
 
@@ -639,35 +680,35 @@ void LDX_ABSY(cpu6502_t *cpu, ram_t *ram)
 {
 	byte data = cpu_fetch_byte(cpu, ram);
 	cpu->Y = data;
-	lda_set_status(cpu); //TODO::: same as LDA for now
+	lda_set_status(cpu, cpu->Y);
 }
 
 void LDY_ZP(cpu6502_t *cpu, ram_t *ram)
 {
 	byte zp_addr = cpu_fetch_byte(cpu, ram); //zero page address
 	cpu->Y = cpu_read_byte(ram, zp_addr); // read from RAM
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->Y);
 }
 
 void LDY_ZPX(cpu6502_t *cpu, ram_t *ram)
 {
 	byte imm_zp_addr = cpu_fetch_byte(cpu, ram) + cpu->X;
 	cpu->Y = cpu_read_byte(ram, imm_zp_addr);
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->Y);
 }
 
 void LDY_ABS(cpu6502_t *cpu, ram_t *ram)
 {
 	word addr = cpu_fetch_word(cpu, ram); // creating address
 	cpu->Y = cpu_read_byte(ram, addr);
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->Y);
 }
 
 void LDY_ABSX(cpu6502_t *cpu, ram_t *ram)
 {
-	word addr = cpu_fetch_word(cpu, ram) + cpu->X; // creating address by adding Y
+	word addr = cpu_addr_abs_read(cpu, ram, cpu->X); // creating address by adding X
 	cpu->Y = cpu_read_byte(ram, addr);
-	lda_set_status(cpu);
+	lda_set_status(cpu, cpu->Y);
 }
 
 /*
@@ -681,7 +722,6 @@ void JSR(cpu6502_t *cpu, ram_t *ram)
 	word sub_addr = cpu_fetch_word(cpu, ram);
 	cpu_push_stack_word(cpu, ram, cpu->PC - 1);
 	cpu->PC = sub_addr; // copy subroutine address to program counter
-	cycles++; 			// 1 cycle to set program counter to subroutine address
 }
 
 /*
@@ -694,13 +734,31 @@ void RTS(cpu6502_t *cpu, ram_t *ram)
 {
 	word addr = cpu_pop_stack_word(cpu, ram);
 	cpu->PC = addr + 1;
-	cycles += 2; // for setting PC to return address
 }
 
 
 /*
  * SBC
 */
+
+// On the NMOS 6502 decimal SBC sets every flag as binary SBC does, only
+// the result is corrected
+__attribute__((noinline, cold))
+static void perform_sbc_decimal(cpu6502_t *cpu, byte fetched)
+{
+	const byte a = cpu->A;
+	const byte borrow = !cpu->carry;
+	perform_adc_binary(cpu, ~fetched);
+
+	int low = (a & 0x0F) - (fetched & 0x0F) - borrow;
+	if(low < 0)
+		low = ((low - 0x06) & 0x0F) - 0x10;
+	int diff = (a & 0xF0) - (fetched & 0xF0) + low;
+	if(diff < 0)
+		diff -= 0x60;
+	cpu->A = diff;
+}
+
 static inline void perform_sbc(cpu6502_t *cpu, byte fetched)
 {
 	/*
@@ -712,17 +770,13 @@ static inline void perform_sbc(cpu6502_t *cpu, byte fetched)
 	the minuend. When you add two numbers like this, it effectively
 	subtracts them. It works because the sum overflows and leaves the
 	remainder, which is why the carry flag is set."
+
+	The carry is the inverted borrow, so A - M - !C is A + ~M + C.
 	*/
-	#if 1
-	word negate = (((word) fetched) ^ 0x00FF) + 1; // to two's compliment
-	word tmp = ((word) cpu->A) + negate + ((cpu->status & C) ? 1 : 0);
-	cpu->status |= (tmp >> 0x7) & 0x1 ? C : 0;
-	cpu->status |= (tmp & 0x0080) ? N : 0;
-	cpu->status |= (tmp ^ (word) cpu->A) & (tmp ^ negate) & 0x0080 ? V : 0;
-	cpu->A = tmp & 0x00FF;
-	#else
-	perform_adc(cpu, ~(fetched));
-	#endif
+	if(__builtin_expect(cpu->status & D, 0))
+		perform_sbc_decimal(cpu, fetched);
+	else
+		perform_adc_binary(cpu, ~fetched);
 }
 
 void SBC_IMM(cpu6502_t *cpu, ram_t *ram)
@@ -748,9 +802,9 @@ void SBC_ZPX(cpu6502_t *cpu, ram_t *ram)
 	perform_sbc_zp(cpu, ram, cpu->X);
 }
 
-static inline void perform_sbc_abs(cpu6502_t *cpu, ram_t *ram, off_t addr_off)
+static inline void perform_sbc_abs(cpu6502_t *cpu, ram_t *ram, byte addr_off)
 {
-	word abs_addr = cpu_fetch_word(cpu, ram) + addr_off;
+	word abs_addr = cpu_addr_abs_read(cpu, ram, addr_off);
 	byte data = cpu_read_byte(ram, abs_addr);
 	perform_sbc(cpu, data);
 }
@@ -770,22 +824,16 @@ void SBC_ABSY(cpu6502_t *cpu, ram_t *ram)
 	perform_sbc_abs(cpu, ram, cpu->Y);
 }
 
-static inline void perform_sbc_ind(cpu6502_t *cpu, ram_t *ram, off_t addr_off)
-{
-	word ind_addr = cpu_fetch_word(cpu, ram) + addr_off;
-	word abs_addr = cpu_read_word(ram, ind_addr);
-	byte data = cpu_read_byte(ram, abs_addr);
-	perform_sbc(cpu, data);
-}
-
 void SBC_INDX(cpu6502_t *cpu, ram_t *ram)
 {
-	perform_sbc_ind(cpu, ram, cpu->X);
+	word abs_addr = cpu_addr_indx(cpu, ram);
+	perform_sbc(cpu, cpu_read_byte(ram, abs_addr));
 }
 
 void SBC_INDY(cpu6502_t *cpu, ram_t *ram)
 {
-	perform_sbc_ind(cpu, ram, cpu->Y);
+	word abs_addr = cpu_addr_indy_read(cpu, ram);
+	perform_sbc(cpu, cpu_read_byte(ram, abs_addr));
 }
 
 
@@ -794,14 +842,17 @@ void SBC_INDY(cpu6502_t *cpu, ram_t *ram)
  * Stack operations
  *
  */
-void TXS(cpu6502_t *cpu)
+void TXS(cpu6502_t *cpu, ram_t *ram)
 {
+	(void) ram;
 	cpu->SP = cpu->X;
 }
 
-void TSX(cpu6502_t *cpu)
+void TSX(cpu6502_t *cpu, ram_t *ram)
 {
+	(void) ram;
 	cpu->X = cpu->SP;
+	cpu_set_nz(cpu, cpu->X);
 }
 
 void PHA(cpu6502_t *cpu, ram_t *ram)
@@ -812,16 +863,25 @@ void PHA(cpu6502_t *cpu, ram_t *ram)
 void PLA(cpu6502_t *cpu, ram_t *ram)
 {
 	cpu->A = cpu_pop_stack_byte(cpu, ram);
+	cpu_set_nz(cpu, cpu->A);
 }
 
+// PHP and BRK push the status with B and U set
 void PHP(cpu6502_t *cpu, ram_t *ram)
 {
-	cpu_push_stack_byte(cpu, ram, cpu->status);
+	cpu_push_stack_byte(cpu, ram, cpu_get_status(cpu) | B | U);
+}
+
+// B and U only exist on the stack, pulling keeps the current ones
+static inline void cpu_pull_status(cpu6502_t *cpu, ram_t *ram)
+{
+	byte pulled = cpu_pop_stack_byte(cpu, ram);
+	cpu_set_status(cpu, (pulled & ~(B | U)) | (cpu->status & (B | U)));
 }
 
 void PLP(cpu6502_t *cpu, ram_t *ram)
 {
-	cpu->status = cpu_pop_stack_byte(cpu, ram);
+	cpu_pull_status(cpu, ram);
 }
 
 /*
@@ -831,13 +891,13 @@ void PLP(cpu6502_t *cpu, ram_t *ram)
  */
 void STA_ZP(cpu6502_t *cpu, ram_t *ram)
 {
-	word zp_addr = cpu_fetch_byte(cpu, ram);
+	word zp_addr = cpu_addr_zp(cpu, ram, 0);
 	cpu_write_byte(ram, zp_addr, cpu->A);
 }
 
 void STA_ZPX(cpu6502_t *cpu, ram_t *ram)
 {
-	word zp_addr = cpu_fetch_byte(cpu, ram) + cpu->X;
+	word zp_addr = cpu_addr_zp(cpu, ram, cpu->X);
 	cpu_write_byte(ram, zp_addr, cpu->A);
 }
 
@@ -860,21 +920,16 @@ void STA_ABSY(cpu6502_t *cpu, ram_t *ram)
 }
 
 /* STA indirect */
-static inline void perform_sta_ind(cpu6502_t *cpu, ram_t *ram, off_t addr_off)
-{
-	word ind_addr = cpu_fetch_word(cpu, ram) + addr_off;
-	word abs_addr = cpu_read_word(ram, ind_addr);
-	cpu_write_byte(ram, abs_addr, cpu->A);
-}
-
 void STA_INDX(cpu6502_t *cpu, ram_t *ram)
 {
-	perform_sta_ind(cpu, ram, cpu->X);
+	word abs_addr = cpu_addr_indx(cpu, ram);
+	cpu_write_byte(ram, abs_addr, cpu->A);
 }
 
 void STA_INDY(cpu6502_t *cpu, ram_t *ram)
 {
-	perform_sta_ind(cpu, ram, cpu->Y);
+	word abs_addr = cpu_addr_indy(cpu, ram);
+	cpu_write_byte(ram, abs_addr, cpu->A);
 }
 
 /* STX */
@@ -886,7 +941,7 @@ void STX_ZP(cpu6502_t *cpu, ram_t *ram)
 
 void STX_ZPY(cpu6502_t *cpu, ram_t *ram)
 {
-	word zp_addr = cpu_fetch_byte(cpu, ram) + cpu->Y;
+	word zp_addr = cpu_addr_zp(cpu, ram, cpu->Y);
 	cpu_write_byte(ram, zp_addr, cpu->X);
 }
 
@@ -906,7 +961,7 @@ void STY_ZP(cpu6502_t *cpu, ram_t *ram)
 
 void STY_ZPX(cpu6502_t *cpu, ram_t *ram)
 {
-	word zp_addr = cpu_fetch_byte(cpu, ram) + cpu->X;
+	word zp_addr = cpu_addr_zp(cpu, ram, cpu->X);
 	cpu_write_byte(ram, zp_addr, cpu->Y);
 }
 
@@ -916,8 +971,10 @@ void STY_ABS(cpu6502_t *cpu, ram_t *ram)
 	cpu_write_byte(ram, abs_addr, cpu->Y);
 }
 
-void NOP()
+void NOP(cpu6502_t *cpu, ram_t *ram)
 {
+	(void) cpu;
+	(void) ram;
 	// no operation
 }
 
@@ -926,386 +983,774 @@ void NOP()
  * Register instructions
  *
  */
-void TAX(cpu6502_t *cpu)
+void TAX(cpu6502_t *cpu, ram_t *ram)
 {
-	cpu->A = cpu->X;
+	(void) ram;
+	cpu->X = cpu->A;
+	cpu_set_nz(cpu, cpu->X);
 }
 
-void TXA(cpu6502_t *cpu)
+void TXA(cpu6502_t *cpu, ram_t *ram)
 {
-	cpu->X = cpu->A;
+	(void) ram;
+	cpu->A = cpu->X;
+	cpu_set_nz(cpu, cpu->A);
 }
 
-void DEX(cpu6502_t *cpu)
+void DEX(cpu6502_t *cpu, ram_t *ram)
 {
+	(void) ram;
 	cpu->X--;
+	cpu_set_nz(cpu, cpu->X);
 }
 
-void INX(cpu6502_t *cpu)
+void INX(cpu6502_t *cpu, ram_t *ram)
 {
+	(void) ram;
 	cpu->X++;
+	cpu_set_nz(cpu, cpu->X);
 }
 
-void TAY(cpu6502_t *cpu)
+void TAY(cpu6502_t *cpu, ram_t *ram)
 {
-	cpu->A = cpu->Y;
+	(void) ram;
+	cpu->Y = cpu->A;
+	cpu_set_nz(cpu, cpu->Y);
 }
 
-void TYA(cpu6502_t *cpu)
+void TYA(cpu6502_t *cpu, ram_t *ram)
 {
-	cpu->Y = cpu->A;
+	(void) ram;
+	cpu->A = cpu->Y;
+	cpu_set_nz(cpu, cpu->A);
 }
 
-void DEY(cpu6502_t *cpu)
+void DEY(cpu6502_t *cpu, ram_t *ram)
 {
+	(void) ram;
 	cpu->Y--;
+	cpu_set_nz(cpu, cpu->Y);
 }
 
-void INY(cpu6502_t *cpu)
+void INY(cpu6502_t *cpu, ram_t *ram)
 {
+	(void) ram;
 	cpu->Y++;
+	cpu_set_nz(cpu, cpu->Y);
 }
 
 
 
 /*
  *
- * Execute instruction from memory
+ * Branches
  *
- * */
-
-void cpu_execute(cpu6502_t *cpu, ram_t *ram)
+ * A taken branch costs one extra cycle, plus one more when the
+ * target is on a different page than the next instruction.
+ *
+ */
+static inline void cpu_branch(cpu6502_t *cpu, ram_t *ram, bool taken)
 {
-	bool process_complete = false;
-	while(!process_complete)
+	int8_t offset = (int8_t) cpu_fetch_byte(cpu, ram);
+	if(taken)
 	{
-		byte opcode = cpu_fetch_byte(cpu, ram);
-		switch(opcode)
-		{
-		case INS_LDA_IMM:
-			LDA_IMM(cpu, ram);
-		break;
+		word target = cpu->PC + offset;
+		cpu->cycles += 1 + page_crossed(cpu->PC, target);
+		cpu->PC = target;
+	}
+}
 
-		case INS_LDA_ZP:
-			LDA_ZP(cpu, ram);
-		break;
+void BPL(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu_branch(cpu, ram, !cpu_flag_n(cpu));
+}
 
-		case INS_LDA_ZPX:
-			LDA_ZPX(cpu, ram);
-		break;
+void BMI(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu_branch(cpu, ram, cpu_flag_n(cpu));
+}
 
-		case INS_LDA_ABS:
-			LDA_ABS(cpu, ram);
-		break;
+void BVC(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu_branch(cpu, ram, !cpu_flag_v(cpu));
+}
 
-		case INS_LDA_ABSX:
-			LDA_ABSX(cpu, ram);
-		break;
+void BVS(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu_branch(cpu, ram, cpu_flag_v(cpu));
+}
 
-		case INS_LDA_ABSY:
-			LDA_ABSY(cpu, ram);
-		break;
+void BCC(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu_branch(cpu, ram, !cpu->carry);
+}
 
-		case INS_LDA_INDX:
-			LDA_INDX(cpu, ram);
-			break;
+void BCS(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu_branch(cpu, ram, cpu->carry);
+}
 
-		case INS_LDA_INDY:
-			LDA_INDY(cpu, ram);
-			break;
+void BNE(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu_branch(cpu, ram, !cpu_flag_z(cpu));
+}
 
-		case INS_LDX_IMM:
-			LDX_IMM(cpu, ram);
-			break;
+void BEQ(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu_branch(cpu, ram, cpu_flag_z(cpu));
+}
 
-		case INS_LDX_ZP:
-			LDX_ZP(cpu, ram);
-			break;
+/*
+ *
+ * Shift right and rotate
+ *
+ * */
 
-		case INS_LDX_ZPY:
-			LDX_ZPY(cpu, ram);
-			break;
+// Shift data right, bit 0 goes to carry
+static inline byte perform_lsr(cpu6502_t *cpu, byte data)
+{
+	cpu->carry = data & 0x01;
+	byte result = data >> 1;
+	cpu_set_nz(cpu, result);
+	return result;
+}
 
-		case INS_LDX_ABS:
-			LDX_ABS(cpu, ram);
-			break;
+// Rotate data left through carry
+static inline byte perform_rol(cpu6502_t *cpu, byte data)
+{
+	byte result = (data << 1) | cpu->carry;
+	cpu->carry = data >> 7;
+	cpu_set_nz(cpu, result);
+	return result;
+}
 
-		case INS_LDX_ABSY:
-			LDX_ABSY(cpu, ram);
-			break;
+// Rotate data right through carry
+static inline byte perform_ror(cpu6502_t *cpu, byte data)
+{
+	byte result = (data >> 1) | (cpu->carry << 7);
+	cpu->carry = data & 0x01;
+	cpu_set_nz(cpu, result);
+	return result;
+}
 
-		case INS_LDY_IMM:
-			LDY_IMM(cpu, ram);
-			break;
+void LSR_ACC(cpu6502_t *cpu, ram_t *ram)
+{
+	(void) ram;
+	cpu->A = perform_lsr(cpu, cpu->A);
+}
 
-		case INS_LDY_ZP:
-			LDY_ZP(cpu, ram);
-			break;
+void LSR_ZP(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_zp(cpu, ram, 0), perform_lsr);
+}
 
-		case INS_LDY_ZPX:
-			LDY_ZPX(cpu, ram);
-			break;
+void LSR_ZPX(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_zp(cpu, ram, cpu->X), perform_lsr);
+}
 
-		case INS_LDY_ABS:
-			LDY_ABS(cpu, ram);
-			break;
+void LSR_ABS(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_abs(cpu, ram, 0), perform_lsr);
+}
 
-		case INS_LDY_ABSX:
-			LDY_ABSX(cpu, ram);
-			break;
+void LSR_ABSX(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_abs(cpu, ram, cpu->X), perform_lsr);
+}
 
-		case INS_JSR:
-			JSR(cpu, ram);
-			break;
+void ROL_ACC(cpu6502_t *cpu, ram_t *ram)
+{
+	(void) ram;
+	cpu->A = perform_rol(cpu, cpu->A);
+}
 
-		case INS_RTS:
-			RTS(cpu, ram);
-			break;
+void ROL_ZP(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_zp(cpu, ram, 0), perform_rol);
+}
 
-		case INS_ADC_IMM:
-			ADC_IMM(cpu, ram);
-			break;
+void ROL_ZPX(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_zp(cpu, ram, cpu->X), perform_rol);
+}
 
-		case INS_ADC_ZP:
-			ADC_ZP(cpu, ram);
-			break;
+void ROL_ABS(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_abs(cpu, ram, 0), perform_rol);
+}
 
-		case INS_ADC_ZPX:
-			ADC_ZPX(cpu, ram);
-			break;
+void ROL_ABSX(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_abs(cpu, ram, cpu->X), perform_rol);
+}
 
-		case INS_ADC_ABS:
-			ADC_ABS(cpu, ram);
-			break;
+void ROR_ACC(cpu6502_t *cpu, ram_t *ram)
+{
+	(void) ram;
+	cpu->A = perform_ror(cpu, cpu->A);
+}
 
-		case INS_ADC_ABSX:
-			ADC_ABSX(cpu, ram);
-			break;
+void ROR_ZP(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_zp(cpu, ram, 0), perform_ror);
+}
 
-		case INS_ADC_ABSY:
-			ADC_ABSY(cpu, ram);
-			break;
+void ROR_ZPX(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_zp(cpu, ram, cpu->X), perform_ror);
+}
 
-		case INS_ADC_INDX:
-			ADC_INDX(cpu, ram);
-			break;
+void ROR_ABS(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_abs(cpu, ram, 0), perform_ror);
+}
 
-		case INS_INC_ZP:
-			INC_ZP(cpu, ram);
-			break;
+void ROR_ABSX(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_rmw(cpu, ram, cpu_addr_abs(cpu, ram, cpu->X), perform_ror);
+}
 
-		case INS_INC_ZPX:
-			INC_ZPX(cpu, ram);
-			break;
+/*
+ *
+ * Decrement by 1
+ *
+ * */
 
-		case INS_INC_ABS:
-			INC_ABS(cpu, ram);
-			break;
+static inline void perform_dec(cpu6502_t *cpu, ram_t *ram, word addr)
+{
+	byte result = cpu_read_byte(ram, addr) - 1;
+	cpu_write_byte(ram, addr, result);
+	cpu_set_nz(cpu, result);
+}
 
-		case INS_INC_ABSX:
-			INC_ABSX(cpu, ram);
-			break;
+void DEC_ZP(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_dec(cpu, ram, cpu_addr_zp(cpu, ram, 0));
+}
 
-		case INS_CLC:
-			CLC(cpu);
-			break;
+void DEC_ZPX(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_dec(cpu, ram, cpu_addr_zp(cpu, ram, cpu->X));
+}
 
-		case INS_SEC:
-			SEC(cpu);
-			break;
+void DEC_ABS(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_dec(cpu, ram, cpu_addr_abs(cpu, ram, 0));
+}
 
-		case INS_CLI:
-			CLI(cpu);
-			break;
+void DEC_ABSX(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_dec(cpu, ram, cpu_addr_abs(cpu, ram, cpu->X));
+}
 
-		case INS_SEI:
-			SEI(cpu);
-			break;
+/*
+ *
+ * OR and exclusive OR with accumulator
+ *
+ * Same flags as AND
+ *
+ * */
 
-		case INS_CLV:
-			CLV(cpu);
-			break;
+void ORA_IMM(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A |= cpu_fetch_byte(cpu, ram);
+	and_set_status(cpu);
+}
 
-		case INS_CLD:
-			CLD(cpu);
-			break;
+void ORA_ZP(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A |= cpu_read_byte(ram, cpu_addr_zp(cpu, ram, 0));
+	and_set_status(cpu);
+}
 
-		case INS_SED:
-			SED(cpu);
-			break;
+void ORA_ZPX(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A |= cpu_read_byte(ram, cpu_addr_zp(cpu, ram, cpu->X));
+	and_set_status(cpu);
+}
 
-		case INS_BIT_ZP:
-			BIT_ZP(cpu, ram);
-			break;
+void ORA_ABS(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A |= cpu_read_byte(ram, cpu_addr_abs_read(cpu, ram, 0));
+	and_set_status(cpu);
+}
 
-		case INS_BIT_ABS:
-			BIT_ABS(cpu, ram);
-			break;
+void ORA_ABSX(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A |= cpu_read_byte(ram, cpu_addr_abs_read(cpu, ram, cpu->X));
+	and_set_status(cpu);
+}
 
-		case INS_AND_IMM:
-			AND_IMM(cpu, ram);
-			break;
+void ORA_ABSY(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A |= cpu_read_byte(ram, cpu_addr_abs_read(cpu, ram, cpu->Y));
+	and_set_status(cpu);
+}
 
-		case INS_AND_ZP:
-			AND_ZP(cpu, ram);
-			break;
+void ORA_INDX(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A |= cpu_read_byte(ram, cpu_addr_indx(cpu, ram));
+	and_set_status(cpu);
+}
 
-		case INS_AND_ZPX:
-			AND_ZPX(cpu, ram);
-			break;
+void ORA_INDY(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A |= cpu_read_byte(ram, cpu_addr_indy_read(cpu, ram));
+	and_set_status(cpu);
+}
 
-		case INS_AND_ABS:
-			AND_ABS(cpu, ram);
-			break;
+void EOR_IMM(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A ^= cpu_fetch_byte(cpu, ram);
+	and_set_status(cpu);
+}
 
-		case INS_AND_ABSX:
-			AND_ABSX(cpu, ram);
-			break;
+void EOR_ZP(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A ^= cpu_read_byte(ram, cpu_addr_zp(cpu, ram, 0));
+	and_set_status(cpu);
+}
 
-		case INS_AND_ABSY:
-			AND_ABSY(cpu, ram);
-			break;
+void EOR_ZPX(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A ^= cpu_read_byte(ram, cpu_addr_zp(cpu, ram, cpu->X));
+	and_set_status(cpu);
+}
 
-		case INS_AND_INDX:
-			AND_INDX(cpu, ram);
-			break;
+void EOR_ABS(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A ^= cpu_read_byte(ram, cpu_addr_abs_read(cpu, ram, 0));
+	and_set_status(cpu);
+}
 
-		case INS_AND_INDY:
-			AND_INDY(cpu, ram);
-			break;
+void EOR_ABSX(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A ^= cpu_read_byte(ram, cpu_addr_abs_read(cpu, ram, cpu->X));
+	and_set_status(cpu);
+}
 
-		case INS_JMP_ABS:
-			JMP_ABS(cpu, ram);
-			break;
+void EOR_ABSY(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A ^= cpu_read_byte(ram, cpu_addr_abs_read(cpu, ram, cpu->Y));
+	and_set_status(cpu);
+}
 
-		case INS_JMP_IND:
-			JMP_IND(cpu, ram);
-			break;
+void EOR_INDX(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A ^= cpu_read_byte(ram, cpu_addr_indx(cpu, ram));
+	and_set_status(cpu);
+}
 
-		case INS_ASL_A:
-			ASL_A(cpu);
-			break;
+void EOR_INDY(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->A ^= cpu_read_byte(ram, cpu_addr_indy_read(cpu, ram));
+	and_set_status(cpu);
+}
 
-		case INS_ASL_ZP:
-			ASL_ZP(cpu, ram);
-			break;
+/*
+ *
+ * Compare
+ *
+ * C is set when reg >= data, N and Z come from reg - data
+ *
+ * */
 
-		case INS_ASL_ZPX:
-			ASL_ZPX(cpu, ram);
-			break;
+static inline void perform_cmp(cpu6502_t *cpu, byte reg, byte data)
+{
+	cpu->carry = reg >= data;
+	cpu_set_nz(cpu, reg - data);
+}
 
-		case INS_ASL_ABS:
-			ASL_ABS(cpu, ram);
-			break;
+void CMP_IMM(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->A, cpu_fetch_byte(cpu, ram));
+}
 
-		case INS_ASL_ABSX:
-			ASL_ABSX(cpu, ram);
-			break;
+void CMP_ZP(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->A, cpu_read_byte(ram, cpu_addr_zp(cpu, ram, 0)));
+}
 
-		case INS_SBC_IMM:
-			SBC_IMM(cpu, ram);
-			break;
+void CMP_ZPX(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->A, cpu_read_byte(ram, cpu_addr_zp(cpu, ram, cpu->X)));
+}
 
-		case INS_SBC_ZP:
-			SBC_ZP(cpu, ram);
-			break;
+void CMP_ABS(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->A, cpu_read_byte(ram, cpu_addr_abs_read(cpu, ram, 0)));
+}
 
-		case INS_SBC_ZPX:
-			SBC_ZPX(cpu, ram);
-			break;
+void CMP_ABSX(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->A, cpu_read_byte(ram, cpu_addr_abs_read(cpu, ram, cpu->X)));
+}
 
-		case INS_SBC_ABS:
-			SBC_ABS(cpu, ram);
-			break;
+void CMP_ABSY(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->A, cpu_read_byte(ram, cpu_addr_abs_read(cpu, ram, cpu->Y)));
+}
 
-		case INS_SBC_ABSX:
-			SBC_ABSX(cpu, ram);
-			break;
+void CMP_INDX(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->A, cpu_read_byte(ram, cpu_addr_indx(cpu, ram)));
+}
 
-		case INS_SBC_ABSY:
-			SBC_ABSY(cpu, ram);
-			break;
+void CMP_INDY(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->A, cpu_read_byte(ram, cpu_addr_indy_read(cpu, ram)));
+}
 
-		case INS_SBC_INDX:
-			SBC_INDX(cpu, ram);
-			break;
+void CPX_IMM(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->X, cpu_fetch_byte(cpu, ram));
+}
 
-		case INS_SBC_INDY:
-			SBC_INDY(cpu, ram);
-			break;
+void CPX_ZP(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->X, cpu_read_byte(ram, cpu_addr_zp(cpu, ram, 0)));
+}
 
-		case INS_KIL:
-			cpu->PC++;
-			process_complete = true;
-			break;
-
-		case INS_NOP:
-			NOP(cpu);
-			break;
-
-		default:
-			printf("Invalid instruction: 0x%x\n", opcode);
-			ram_free(ram);
-			exit(1);
-			break;
-		}
+void CPX_ABS(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->X, cpu_read_byte(ram, cpu_addr_abs(cpu, ram, 0)));
+}
+
+void CPY_IMM(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->Y, cpu_fetch_byte(cpu, ram));
+}
+
+void CPY_ZP(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->Y, cpu_read_byte(ram, cpu_addr_zp(cpu, ram, 0)));
+}
+
+void CPY_ABS(cpu6502_t *cpu, ram_t *ram)
+{
+	perform_cmp(cpu, cpu->Y, cpu_read_byte(ram, cpu_addr_abs(cpu, ram, 0)));
+}
+
+/*
+ *
+ * Break and return from interrupt
+ *
+ * BRK skips a padding byte, pushes the return address and the status
+ * with B set, then jumps through the IRQ vector with I set.
+ *
+ */
+void BRK(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu->PC++;
+	cpu_push_stack_word(cpu, ram, cpu->PC);
+	cpu_push_stack_byte(cpu, ram, cpu_get_status(cpu) | B | U);
+	cpu->status |= I;
+	cpu->PC = cpu_read_word(ram, IRQ_VECTOR);
+}
+
+void RTI(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu_pull_status(cpu, ram);
+	cpu->PC = cpu_pop_stack_word(cpu, ram);
+}
+
+/*
+ *
+ * Interrupt sequence
+ *
+ * Like BRK, but the pushed status has B clear and PC is not advanced.
+ * Returns false when nothing was taken, i.e. only a masked IRQ is
+ * pending. Kept out of line so the run loop only pays for the test of
+ * cpu->pending.
+ *
+ */
+__attribute__((noinline, cold))
+static bool cpu_interrupt(cpu6502_t *cpu, ram_t *ram)
+{
+	word vector;
+	if(cpu->pending & CPU_INT_RESET)
+	{
+		cpu->pending &= ~CPU_INT_RESET;
+		cpu->SP -= 3;
+		cpu->status |= I;
+		cpu->PC = cpu_read_word(ram, RESET_VECTOR);
+		cpu->cycles += 7;
+		return true;
 	}
+
+	if(cpu->pending & CPU_INT_NMI)
+	{
+		cpu->pending &= ~CPU_INT_NMI;
+		vector = NMI_VECTOR;
+	}
+	else if(!(cpu->status & I))
+		vector = IRQ_VECTOR;
+	else
+		return false;
+
+	cpu_push_stack_word(cpu, ram, cpu->PC);
+	cpu_push_stack_byte(cpu, ram, (cpu_get_status(cpu) & ~B) | U);
+	cpu->status |= I;
+	cpu->PC = cpu_read_word(ram, vector);
+	cpu->cycles += 7;
+	return true;
+}
+
+/*
+ *
+ * Dispatch table, generated from opcodes.def
+ *
+ * */
+const cpu_op_t cpu_optable[256] =
+{
+#define OP(name, code, mode, cycles) [code] = { name, AM_##mode, cycles },
+#define OP_NYI(name, code, mode, cycles) [code] = { NULL, AM_##mode, cycles },
+#include "opcodes.def"
+};
+
+/*
+ *
+ * Execute instruction from memory
+ *
+ * */
+
+static bool cpu_at_breakpoint(const cpu6502_t *cpu)
+{
+	for(byte i = 0; i < cpu->n_breakpoints; i++)
+		if(cpu->breakpoints[i] == cpu->PC)
+			return true;
+	return false;
+}
+
+// Taken before any interrupt, which waits for the next cpu_run
+static inline cpu_stop_t cpu_take_yield(cpu6502_t *cpu)
+{
+	cpu->pending &= ~CPU_INT_YIELD;
+	return CPU_STOP_BUDGET;
 }
 
-void load_into_memory(ram_t *ram, const char *fname)
+// cpu_run_until is inlined once per budget kind, so this folds to one field
+#define BUDGET_COUNTER(cpu, kind) \
+	((kind) == CPU_BUDGET_CYCLES ? (cpu)->cycles : (cpu)->instructions)
+
+// Run the cached block at PC if the budget lets every op of it start,
+// exactly as stepping would. Returns false if the caller has to step
+// one instruction instead.
+static inline bool cpu_run_block(cpu6502_t *cpu, ram_t *ram,
+		cpu_budget_t kind, uint64_t deadline)
 {
-	ef_file hdr = read_ef(fname);
-	const word MN = (hdr.ef_magic[0] << 8) | hdr.ef_magic[1];
+	cpu_bcache_t *cache = cpu->bcache;
+	bcache_block_t *block = bcache_lookup(cache, ram, cpu->PC);
+	if(!block)
+		return false;
+
+	const uint64_t worst = kind == CPU_BUDGET_CYCLES ? block->span : block->n - 1u;
+	if(BUDGET_COUNTER(cpu, kind) + worst >= deadline)
+		return false;
+
+	// handlers only ever add to the counters, so account the block up front
+	cpu->cycles += block->cycles;
+	cpu->instructions += block->n;
 
-#define MAGIC_NUMBER (word) (('E' << 8) | 'F')
-	if(MN != MAGIC_NUMBER)
+	unsigned done;
+	if(block->native)
+		done = cache->shadow ? bcache_run_verified(cache, block, cpu, ram)
+			: block->native(cpu, ram);
+	else
 	{
-		fprintf(stderr, "Invalid EF file\n");
-		exit(1);
+		done = bcache_interpret(block, cpu, ram);
+		if(cache->jit && ++block->runs == BCACHE_JIT_THRESHOLD)
+			bcache_translate(cache, block);
 	}
 
-	puts("EF file info:");
-	printf("Magic: %c %c\n", hdr.ef_magic[0], hdr.ef_magic[1]);
-	printf("Size: %d\n", hdr.ef_size);
-	printf("_start:\n \t%s\n", hdr.ef_data);
+	// stopped early by a write to code, take back what did not run
+	for(unsigned i = done; i < block->n; i++)
+	{
+		cpu->cycles -= block->ops[i].cycles;
+		cpu->instructions--;
+	}
+	return true;
+}
 
-	// putting jump instruction manually for debugging purpose
-	word begin = PROG_BEGIN;
-	ram->data[begin++] = INS_JMP_ABS;
-	ram->data[begin++] = 0x00;
-	ram->data[begin] = 0x10;
+#if defined(CPU_THREADED) && defined(__GNUC__)
 
-#define EXEC_START 0x1000
+/*
+ * Direct-threaded backend (make BACKEND=threaded).
+ *
+ * Uses GCC labels-as-values: every handler is called directly from its
+ * own label and ends with its own indirect jump to the next opcode, so
+ * there is no central dispatch branch for the predictor to miss on.
+ * Architectural results are identical to the table backend below.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#pragma GCC diagnostic ignored "-Woverride-init"
 
-	word bidx = 0;
-	word i = EXEC_START;
-	for(; i < EXEC_START + hdr.ef_size; i++)
+static inline cpu_stop_t cpu_run_until(cpu6502_t *cpu, ram_t *ram,
+		cpu_budget_t kind, uint64_t deadline)
+{
+	static void *const labels[256] =
+	{
+		[0 ... 255] = &&op_invalid,
+#define OP(name, code, mode, cycles) [code] = &&op_##name,
+#define OP_NYI(name, code, mode, cycles)
+#include "opcodes.def"
+	};
+
+	byte opcode;
+
+#define FETCH() \
+	do \
+	{ \
+		if(BUDGET_COUNTER(cpu, kind) >= deadline) \
+			return CPU_STOP_BUDGET; \
+		if(__builtin_expect(cpu->pending, 0)) \
+		{ \
+			if(cpu->pending & CPU_INT_YIELD) \
+				return cpu_take_yield(cpu); \
+			if(cpu_interrupt(cpu, ram)) \
+				goto interrupted; \
+		} \
+		opcode = cpu_fetch_byte(cpu, ram); \
+		goto *labels[opcode]; \
+	} while(0)
+
+#define DISPATCH() \
+	do \
+	{ \
+		cpu->instructions++; \
+		if(cpu->n_breakpoints && cpu_at_breakpoint(cpu)) \
+			return CPU_STOP_BREAKPOINT; \
+		FETCH(); \
+	} while(0)
+
+	if(cpu->bcache && !cpu->n_breakpoints)
+		goto blocks;
+	FETCH();
+
+#define OP(name, code, mode, base_cycles) \
+	op_##name: \
+		cpu->cycles += base_cycles; \
+		name(cpu, ram); \
+		if(bcache_ends_block(code, AM_##mode) && cpu->bcache && !cpu->n_breakpoints) \
+		{ \
+			cpu->instructions++; \
+			goto blocks; \
+		} \
+		DISPATCH();
+#define OP_NYI(name, code, mode, cycles)
+#include "opcodes.def"
+
+blocks:
+	do
 	{
-		ram->data[i] = hdr.ef_data[bidx++];
+		if(BUDGET_COUNTER(cpu, kind) >= deadline)
+			return CPU_STOP_BUDGET;
+		if(__builtin_expect(cpu->pending, 0))
+		{
+			if(cpu->pending & CPU_INT_YIELD)
+				return cpu_take_yield(cpu);
+			if(cpu_interrupt(cpu, ram))
+				goto interrupted;
+		}
 	}
+	while(cpu_run_block(cpu, ram, kind, deadline));
+	opcode = cpu_fetch_byte(cpu, ram);
+	goto *labels[opcode];
+
+interrupted:
+	if(cpu->n_breakpoints && cpu_at_breakpoint(cpu))
+		return CPU_STOP_BREAKPOINT;
+	if(cpu->bcache && !cpu->n_breakpoints)
+		goto blocks;
+	FETCH();
 
-	// putting exit instruction manually for debugging purpose
-	// ram->data[i] = INS_KIL;
-	free_ef(&hdr);
+op_invalid:
+	cpu->PC--;
+	return opcode == INS_KIL ? CPU_STOP_KIL : CPU_STOP_ILLEGAL;
+#undef DISPATCH
+#undef FETCH
 }
 
-int main(int argc, char **argv)
+#pragma GCC diagnostic pop
+
+#else
+
+static inline cpu_stop_t cpu_run_until(cpu6502_t *cpu, ram_t *ram,
+		cpu_budget_t kind, uint64_t deadline)
 {
-	if(argc < 2)
+	bool probe = cpu->bcache && !cpu->n_breakpoints;
+	while(BUDGET_COUNTER(cpu, kind) < deadline)
 	{
-		fprintf(stderr, "Insufficient arguments\n");
-		exit(1);
+		if(__builtin_expect(cpu->pending & CPU_INT_YIELD, 0))
+			return cpu_take_yield(cpu);
+		if(__builtin_expect(cpu->pending, 0) && cpu_interrupt(cpu, ram))
+		{
+			if(cpu->n_breakpoints && cpu_at_breakpoint(cpu))
+				return CPU_STOP_BREAKPOINT;
+			probe = cpu->bcache && !cpu->n_breakpoints;
+			continue;
+		}
+
+		if(probe && cpu_run_block(cpu, ram, kind, deadline))
+			continue;
+
+		byte opcode = cpu_fetch_byte(cpu, ram);
+		const cpu_op_t *op = &cpu_optable[opcode];
+		if(!op->handler)
+		{
+			cpu->PC--;
+			return opcode == INS_KIL ? CPU_STOP_KIL : CPU_STOP_ILLEGAL;
+		}
+
+		cpu->cycles += op->cycles;
+		op->handler(cpu, ram);
+		cpu->instructions++;
+		probe = cpu->bcache && !cpu->n_breakpoints && bcache_ends_block(opcode, op->mode);
+
+		if(cpu->n_breakpoints && cpu_at_breakpoint(cpu))
+			return CPU_STOP_BREAKPOINT;
 	}
+	return CPU_STOP_BUDGET;
+}
 
-	ram_t ram;
-	cpu6502_t cpu;
-
-	ram_init(&ram);
-	cpu_reset(&cpu, &ram);
-	load_into_memory(&ram, argv[1]);
-	cpu_execute(&cpu, &ram);
-	dump_cpu_flags(&cpu);
-	dump_cpu_regs(&cpu);
-	ram_free(&ram);
-	return 0;
+#endif
+
+cpu_stop_t cpu_run(cpu6502_t *cpu, ram_t *ram, cpu_budget_t kind, uint64_t max)
+{
+	uint64_t now = BUDGET_COUNTER(cpu, kind);
+	uint64_t deadline = now + max < now ? UINT64_MAX : now + max;
+	if(kind == CPU_BUDGET_CYCLES)
+		return cpu_run_until(cpu, ram, CPU_BUDGET_CYCLES, deadline);
+	return cpu_run_until(cpu, ram, CPU_BUDGET_INSTRUCTIONS, deadline);
+}
+
+cpu_stop_t cpu_execute(cpu6502_t *cpu, ram_t *ram)
+{
+	cpu_stop_t stop;
+	do
+		stop = cpu_run(cpu, ram, CPU_BUDGET_CYCLES, UINT64_MAX);
+	while(stop == CPU_STOP_BUDGET);
+	return stop;
+}
+
+uint64_t cpu_run_cycles(cpu6502_t *cpu, ram_t *ram, uint64_t cycles)
+{
+	uint64_t start = cpu->cycles;
+	cpu_run(cpu, ram, CPU_BUDGET_CYCLES, cycles);
+	return cpu->cycles - start;
+}
+
+bool cpu_add_breakpoint(cpu6502_t *cpu, word addr)
+{
+	if(cpu->n_breakpoints == CPU_MAX_BREAKPOINTS)
+		return false;
+	cpu->breakpoints[cpu->n_breakpoints++] = addr;
+	return true;
+}
+
+void cpu_clear_breakpoints(cpu6502_t *cpu)
+{
+	cpu->n_breakpoints = 0;
 }
@@ -0,0 +1,287 @@
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu6502.h"
+#include "dis.h"
+
+/*
+ * Per opcode names and flags, generated from opcodes.def like the
+ * dispatch table. Every name there starts with the mnemonic.
+ */
+static const struct { const char *name; byte code, mode; } dis_ops[] =
+{
+#define OP(name, code, mode, cycles) { #name, code, AM_##mode },
+#include "opcodes.def"
+};
+
+static char dis_mnemonics[256][4]; 	// "" for opcodes the CPU does not know
+static byte dis_flags[256];
+static bool dis_zp_form[256]; 		// an absolute mode whose mnemonic also has the zero page form
+static pthread_once_t dis_once = PTHREAD_ONCE_INIT;
+
+static const char *const dis_mode_names[] =
+{
+	[AM_IMP] = "imp", [AM_ACC] = "acc", [AM_IMM] = "imm",
+	[AM_ZP] = "zp", [AM_ZPX] = "zpx", [AM_ZPY] = "zpy",
+	[AM_ABS] = "abs", [AM_ABSX] = "absx", [AM_ABSY] = "absy",
+	[AM_IND] = "ind", [AM_INDX] = "indx", [AM_INDY] = "indy",
+	[AM_REL] = "rel"
+};
+
+static byte dis_zp_mode(byte mode)
+{
+	return mode == AM_ABSX ? AM_ZPX : mode == AM_ABSY ? AM_ZPY : AM_ZP;
+}
+
+static void dis_build_tables(void)
+{
+	const size_t n = sizeof dis_ops / sizeof *dis_ops;
+	for(size_t i = 0; i < n; i++)
+	{
+		const byte code = dis_ops[i].code;
+		for(int k = 0; k < 3; k++)
+			dis_mnemonics[code][k] = tolower((unsigned char) dis_ops[i].name[k]);
+
+		switch(code)
+		{
+		case INS_JMP_ABS:
+		case INS_JMP_IND:
+			dis_flags[code] = DIS_JUMP | DIS_STOP;
+			break;
+		case INS_JSR:
+			dis_flags[code] = DIS_CALL;
+			break;
+		case INS_RTS:
+		case INS_RTI:
+		case INS_BRK:
+		case INS_KIL:
+			dis_flags[code] = DIS_STOP;
+			break;
+		default:
+			dis_flags[code] = dis_ops[i].mode == AM_REL ? DIS_BRANCH : 0;
+		}
+
+		const byte mode = dis_ops[i].mode;
+		if(mode != AM_ABS && mode != AM_ABSX && mode != AM_ABSY)
+			continue;
+		for(size_t j = 0; j < n; j++)
+			if(dis_ops[j].mode == dis_zp_mode(mode) && strncmp(dis_ops[j].name, dis_ops[i].name, 3) == 0)
+				dis_zp_form[code] = true;
+	}
+}
+
+void dis_decode(const byte *mem, word addr, dis_insn_t *insn)
+{
+	pthread_once(&dis_once, dis_build_tables);
+
+	const byte opcode = mem[addr];
+	insn->addr = addr;
+	insn->opcode = opcode;
+	if(!dis_mnemonics[opcode][0])
+	{
+		insn->mode = AM_IMP;
+		insn->len = 1;
+		insn->flags = DIS_ILLEGAL;
+		insn->operand = 0;
+		return;
+	}
+
+	insn->mode = cpu_optable[opcode].mode;
+	insn->len = cpu_op_length(insn->mode);
+	insn->flags = dis_flags[opcode];
+	const byte lo = mem[(word) (addr + 1)];
+	const byte hi = mem[(word) (addr + 2)];
+	if(insn->len == 3)
+		insn->operand = lo | hi << 8;
+	else if(insn->mode == AM_REL)
+		insn->operand = addr + 2 + (int8_t) lo;
+	else
+		insn->operand = insn->len == 2 ? lo : 0;
+}
+
+const char *dis_mnemonic(const dis_insn_t *insn)
+{
+	pthread_once(&dis_once, dis_build_tables);
+	return insn->flags & DIS_ILLEGAL ? NULL : dis_mnemonics[insn->opcode];
+}
+
+const char *dis_mode_name(byte mode)
+{
+	return mode < sizeof dis_mode_names / sizeof *dis_mode_names ? dis_mode_names[mode] : "?";
+}
+
+/*
+ * Text, written by hand: a full listing is mostly formatting
+ */
+
+static char *dis_put(char *p, const char *s)
+{
+	while(*s)
+		*p++ = *s++;
+	return p;
+}
+
+static char *dis_put_hex(char *p, unsigned value, int digits)
+{
+	static const char hex[] = "0123456789abcdef";
+	*p++ = '0';
+	*p++ = 'x';
+	for(int i = digits - 1; i >= 0; i--)
+		*p++ = hex[value >> (4 * i) & 0xF];
+	return p;
+}
+
+// [.byte ...] of the instruction's bytes, for what the assembler would
+// encode differently
+// The first `len` bytes of the instruction as data
+static char *dis_put_bytes(char *p, const dis_insn_t *insn, unsigned len)
+{
+	p = dis_put(p, "[.byte ");
+	p = dis_put_hex(p, insn->opcode, 2);
+	if(len < 2)
+		return dis_put(p, "]");
+	p = dis_put(p, ", ");
+	if(insn->len == 2)
+		p = dis_put_hex(p, (insn->mode == AM_REL ? insn->operand - insn->addr - 2 : insn->operand) & 0xFF, 2);
+	else
+	{
+		p = dis_put_hex(p, insn->operand & 0xFF, 2);
+		if(len == 3)
+		{
+			p = dis_put(p, ", ");
+			p = dis_put_hex(p, insn->operand >> 8, 2);
+		}
+	}
+	return dis_put(p, "]");
+}
+
+size_t dis_text(const dis_insn_t *insn, char *buf)
+{
+	pthread_once(&dis_once, dis_build_tables);
+
+	char *p = buf;
+	if(insn->flags & DIS_ILLEGAL)
+	{
+		p = dis_put_bytes(p, insn, 1);
+		*p = '\0';
+		return p - buf;
+	}
+
+	// Absolute operands below 0x100 assemble to zero page when the
+	// mnemonic has it, and branches and operands can wrap around the end
+	// of memory, which the assembler does not do: keep the bytes and show
+	// the instruction. Only bytes below the end of memory are emitted.
+	const long target = insn->addr + 2 + (int8_t) (insn->operand - insn->addr - 2);
+	const unsigned fits = MEM_SIZE - insn->addr < insn->len ? MEM_SIZE - insn->addr : insn->len;
+	const bool as_bytes = fits < insn->len
+		|| (dis_zp_form[insn->opcode] && insn->operand < 0x100)
+		|| (insn->mode == AM_REL && (target < 0 || target > MEM_MAX));
+	if(as_bytes)
+	{
+		p = dis_put_bytes(p, insn, fits);
+		p = dis_put(p, " ; ");
+	}
+
+	p = dis_put(p, dis_mnemonics[insn->opcode]);
+	switch(insn->mode)
+	{
+	case AM_IMP:
+		break;
+	case AM_ACC:
+		p = dis_put(p, " a");
+		break;
+	case AM_IMM:
+		p = dis_put(p, " #");
+		p = dis_put_hex(p, insn->operand, 2);
+		break;
+	case AM_ZP:
+	case AM_ZPX:
+	case AM_ZPY:
+		p = dis_put(p, " %");
+		p = dis_put_hex(p, insn->operand, 2);
+		p = dis_put(p, insn->mode == AM_ZPX ? ",x" : insn->mode == AM_ZPY ? ",y" : "");
+		break;
+	case AM_ABS:
+	case AM_ABSX:
+	case AM_ABSY:
+	case AM_REL:
+		*p++ = ' ';
+		p = dis_put_hex(p, insn->operand, 4);
+		p = dis_put(p, insn->mode == AM_ABSX ? ",x" : insn->mode == AM_ABSY ? ",y" : "");
+		break;
+	case AM_IND:
+		p = dis_put(p, " [");
+		p = dis_put_hex(p, insn->operand, 4);
+		*p++ = ']';
+		break;
+	case AM_INDX:
+	case AM_INDY:
+		p = dis_put(p, " [");
+		p = dis_put_hex(p, insn->operand, 2);
+		p = dis_put(p, insn->mode == AM_INDX ? ",x]" : "],y");
+		break;
+	}
+	if(fits < insn->len)
+		p = dis_put(p, " (past the end)");
+	else if(as_bytes)
+		p = dis_put(p, insn->mode == AM_REL ? " (wraps)" : " (absolute)");
+	*p = '\0';
+	return p - buf;
+}
+
+/*
+ * Sweep and trace
+ */
+
+size_t dis_sweep(const byte *mem, word start, uint32_t len, dis_insn_t *out)
+{
+	size_t n = 0;
+	for(uint32_t off = 0; off < len; off += out[n++].len)
+		dis_decode(mem, start + off, &out[n]);
+	return n;
+}
+
+static bool dis_seen(const byte *starts, word addr)
+{
+	return starts[addr / 8] & (1 << addr % 8);
+}
+
+size_t dis_trace(const byte *mem, const word *entries, size_t n, byte *starts)
+{
+	// Every instruction pushes at most one target and is only decoded
+	// once, so the stack never holds more than this
+	word *stack = malloc((MEM_SIZE + n) * sizeof *stack);
+	if(!stack)
+		return 0;
+	size_t sp = 0, found = 0;
+	for(size_t i = n; i > 0; i--)
+		stack[sp++] = entries[i - 1];
+
+	while(sp)
+	{
+		word addr = stack[--sp];
+		while(!dis_seen(starts, addr))
+		{
+			dis_insn_t insn;
+			dis_decode(mem, addr, &insn);
+			if(insn.flags & DIS_ILLEGAL)
+				break;
+
+			starts[addr / 8] |= 1 << addr % 8;
+			found++;
+			const bool target = (insn.flags & (DIS_BRANCH | DIS_CALL))
+				|| ((insn.flags & DIS_JUMP) && insn.mode == AM_ABS);
+			if(target && !dis_seen(starts, insn.operand))
+				stack[sp++] = insn.operand;
+			if(insn.flags & DIS_STOP)
+				break;
+			addr += insn.len;
+		}
+	}
+
+	free(stack);
+	return found;
+}
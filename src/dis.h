@@ -0,0 +1,71 @@
+#ifndef DIS_H
+#define DIS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bytes.h"
+
+/*
+ *
+ * Disassembler
+ *
+ * Decodes 6502 code in a flat MEM_SIZE byte image with the opcode table
+ * the CPU dispatches on, so it knows exactly the instructions the CPU
+ * runs. Addresses wrap around at the end of memory like the CPU's.
+ *
+ * dis_sweep decodes a range instruction after instruction. dis_trace
+ * follows the control flow from entry points instead, through jumps,
+ * calls and both ways of every branch, so data between code is not
+ * taken for instructions.
+ *
+ * The text form is the syntax of asm.h, so a listing assembles back to
+ * the same bytes.
+ *
+ * */
+
+// Instruction flags
+#define DIS_ILLEGAL 	0x01 	// not an opcode the CPU knows, decoded as one data byte
+#define DIS_BRANCH 		0x02 	// conditional, operand is the target
+#define DIS_JUMP 		0x04 	// JMP, the operand is the target unless indirect
+#define DIS_CALL 		0x08 	// JSR, the operand is the target
+#define DIS_STOP 		0x10 	// the next instruction does not follow: JMP, RTS, RTI, BRK, KIL
+
+// Room for any dis_text result, NUL included
+#define DIS_TEXT_MAX 	64
+
+typedef struct dis_insn
+{
+	word addr;
+	byte opcode;
+	byte mode; 			// addr_mode_t
+	byte len; 			// in bytes, opcode included
+	byte flags; 		// DIS_*
+	word operand; 		// the byte or word after the opcode, the target for branches
+} dis_insn_t;
+
+// The instruction at `addr`
+void dis_decode(const byte *mem, word addr, dis_insn_t *insn);
+
+// Three letter mnemonic, lower case, or NULL for DIS_ILLEGAL
+const char *dis_mnemonic(const dis_insn_t *insn);
+
+// Short name of an addressing mode, e.g. "zpx"
+const char *dis_mode_name(byte mode);
+
+// Write the instruction as source text to buf, which has room for
+// DIS_TEXT_MAX bytes. Returns the length without the NUL.
+size_t dis_text(const dis_insn_t *insn, char *buf);
+
+// Decode the `len` bytes from `start` one instruction after the other
+// into `out`, which has room for `len` entries. The last instruction
+// may run past the range. Returns the number of instructions.
+size_t dis_sweep(const byte *mem, word start, uint32_t len, dis_insn_t *out);
+
+// Set the bit of every instruction start in `starts`, a MEM_SIZE bit
+// map the caller clears, that control flow reaches from the `n`
+// entries. Illegal opcodes and indirect jumps end a path. Returns the
+// number of instructions found.
+size_t dis_trace(const byte *mem, const word *entries, size_t n, byte *starts);
+
+#endif
@@ -1,50 +1,266 @@
 #include "ef.h"
+#include "ram.h"
 
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <stdlib.h>
 #include <sys/mman.h>
+#include <stdlib.h>
 #include <string.h>
 
-ef_file read_ef(const char *effname)
+static inline word get_word(const byte *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_dword(const byte *p)
+{
+	return get_word(p) | ((uint32_t) get_word(p + 2) << 16);
+}
+
+uint32_t ef_checksum(const byte *data, size_t len)
+{
+	uint32_t h = 0x811c9dc5;
+	for(size_t i = 0; i < len; i++)
+		h = (h ^ data[i]) * 0x01000193;
+	return h;
+}
+
+static int parse_v1(const char *effname, const byte *file, size_t len, ef_file *hdr)
+{
+	const word size = get_word(file + 2);
+	if(size > len - EF_HEADER_SIZE)
+	{
+		fprintf(stderr, "Truncated EF file: %s (%u bytes expected, %zu present)\n",
+				effname, size, len - EF_HEADER_SIZE);
+		return -1;
+	}
+	if(EF_V1_LOAD + size > MEM_SIZE)
+	{
+		fprintf(stderr, "EF segment 0 runs past the end of memory: %s\n", effname);
+		return -1;
+	}
+
+	hdr->ef_segs = malloc(sizeof *hdr->ef_segs);
+	if(!hdr->ef_segs)
+		return -1;
+	hdr->ef_segs[0] = (ef_segment) { EF_V1_LOAD, size, file + EF_HEADER_SIZE };
+	hdr->ef_nsegs = 1;
+	hdr->ef_version = 1;
+	hdr->ef_flags = EF_HAS_ENTRY;
+	hdr->ef_entry = EF_V1_LOAD;
+	hdr->ef_size = size;
+	return 0;
+}
+
+static int parse_v2(const char *effname, const byte *file, size_t len, ef_file *hdr)
+{
+	if(len < EF_V2_HEADER_SIZE || file[4] != 2)
+	{
+		fprintf(stderr, "Unsupported EF version: %s\n", effname);
+		return -1;
+	}
+
+	if(ef_checksum(file + EF_V2_HEADER_SIZE, len - EF_V2_HEADER_SIZE) != get_dword(file + 12))
+	{
+		fprintf(stderr, "EF checksum mismatch: %s\n", effname);
+		return -1;
+	}
+
+	hdr->ef_version = file[4];
+	hdr->ef_flags = file[5];
+	hdr->ef_entry = get_word(file + 6);
+	hdr->ef_nsegs = get_word(file + 8);
+	hdr->ef_nsyms = get_word(file + 10);
+
+	size_t off = EF_V2_HEADER_SIZE;
+	if((size_t) hdr->ef_nsegs * EF_V2_SEGMENT_SIZE > len - off)
+		goto truncated;
+
+	hdr->ef_segs = calloc(hdr->ef_nsegs + 1, sizeof *hdr->ef_segs);
+	hdr->ef_syms = calloc(hdr->ef_nsyms + 1, sizeof *hdr->ef_syms);
+	if(!hdr->ef_segs || !hdr->ef_syms)
+		return -1;
+
+	uint32_t total = 0;
+	for(word i = 0; i < hdr->ef_nsegs; i++, off += EF_V2_SEGMENT_SIZE)
+	{
+		ef_segment *seg = &hdr->ef_segs[i];
+		seg->addr = get_word(file + off);
+		seg->len = get_word(file + off + 2);
+		const uint32_t data = get_dword(file + off + 4);
+		if(data > len || seg->len > len - data)
+			goto truncated;
+		if(seg->addr + seg->len > MEM_SIZE)
+		{
+			fprintf(stderr, "EF segment %u runs past the end of memory: %s\n", i, effname);
+			return -1;
+		}
+		seg->data = file + data;
+		total += seg->len;
+	}
+	hdr->ef_size = total;
+
+	for(word i = 0; i < hdr->ef_nsyms; i++)
+	{
+		ef_symbol *sym = &hdr->ef_syms[i];
+		if(len - off < 3)
+			goto truncated;
+		sym->value = get_word(file + off);
+		sym->len = file[off + 2];
+		off += 3;
+		if(len - off < sym->len)
+			goto truncated;
+		sym->name = (const char*) file + off;
+		off += sym->len;
+	}
+	return 0;
+
+truncated:
+	fprintf(stderr, "Truncated EF file: %s\n", effname);
+	return -1;
+}
+
+int ef_parse(const byte *image, size_t len, const char *effname, ef_file *hdr)
+{
+	*hdr = (ef_file) { 0 };
+	if(len < EF_HEADER_SIZE)
+	{
+		fprintf(stderr, "Invalid EF file: %s\n", effname);
+		return -1;
+	}
+
+	hdr->ef_magic[0] = image[0];
+	hdr->ef_magic[1] = image[1];
+	const word MN = (hdr->ef_magic[0] << 8) | hdr->ef_magic[1];
+	if(MN != EF_MAGIC)
+	{
+		fprintf(stderr, "Invalid EF file: %s\n", effname);
+		return -1;
+	}
+
+	int ret = get_word(image + 2) == EF_V2_MARK
+		? parse_v2(effname, image, len, hdr)
+		: parse_v1(effname, image, len, hdr);
+	if(ret < 0)
+	{
+		free_ef(hdr);
+		return -1;
+	}
+
+	hdr->ef_data = hdr->ef_nsegs ? hdr->ef_segs[0].data : NULL;
+	return 0;
+}
+
+int read_ef(const char *effname, ef_file *hdr)
 {
 	int fd = open(effname, O_RDONLY);
 	if(fd < 0)
 	{
 		fprintf(stderr, "File not found or permission denied: %s\n", effname);
-		exit(1);
+		return -1;
 	}
 
 	struct stat statbuf;
 	if(fstat(fd, &statbuf) < 0)
 	{
 		fprintf(stderr, "Error getting information of: %s\n", effname);
-		exit(2);
+		close(fd);
+		return -1;
 	}
 
 	const size_t LEN = statbuf.st_size;
-	char *mapped_file = mmap(NULL, LEN, PROT_READ, MAP_SHARED, fd, 0); 
+	if(LEN < EF_HEADER_SIZE)
+	{
+		fprintf(stderr, "Invalid EF file: %s\n", effname);
+		close(fd);
+		return -1;
+	}
+
+	const byte *mapped_file = mmap(NULL, LEN, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
 
 	if(mapped_file == MAP_FAILED)
 	{
 		fprintf(stderr, "mmap failed\n");
-		exit(4);
+		return -1;
+	}
+
+	if(ef_parse(mapped_file, LEN, effname, hdr) < 0)
+	{
+		munmap((void*) mapped_file, LEN);
+		return -1;
+	}
+	hdr->ef_map = (void*) mapped_file;
+	hdr->ef_map_len = LEN;
+	return 0;
+}
+
+static inline void put_word(byte *p, word w)
+{
+	p[0] = w & 0xFF;
+	p[1] = w >> 8;
+}
+
+static inline void put_dword(byte *p, uint32_t d)
+{
+	put_word(p, d & 0xFFFF);
+	put_word(p + 2, d >> 16);
+}
+
+byte *ef_build(const ef_file *hdr, size_t *len)
+{
+	size_t size = EF_V2_HEADER_SIZE + (size_t) hdr->ef_nsegs * EF_V2_SEGMENT_SIZE;
+	for(word i = 0; i < hdr->ef_nsyms; i++)
+		size += 3 + hdr->ef_syms[i].len;
+	size_t payload = size;
+	for(word i = 0; i < hdr->ef_nsegs; i++)
+		size += hdr->ef_segs[i].len;
+
+	byte *image = malloc(size);
+	if(!image)
+		return NULL;
+
+	image[0] = 'E';
+	image[1] = 'F';
+	put_word(image + 2, EF_V2_MARK);
+	image[4] = 2;
+	image[5] = hdr->ef_flags;
+	put_word(image + 6, hdr->ef_entry);
+	put_word(image + 8, hdr->ef_nsegs);
+	put_word(image + 10, hdr->ef_nsyms);
+
+	byte *p = image + EF_V2_HEADER_SIZE;
+	for(word i = 0; i < hdr->ef_nsegs; i++, p += EF_V2_SEGMENT_SIZE)
+	{
+		const ef_segment *seg = &hdr->ef_segs[i];
+		put_word(p, seg->addr);
+		put_word(p + 2, seg->len);
+		put_dword(p + 4, payload);
+		memcpy(image + payload, seg->data, seg->len);
+		payload += seg->len;
+	}
+	for(word i = 0; i < hdr->ef_nsyms; i++)
+	{
+		const ef_symbol *sym = &hdr->ef_syms[i];
+		put_word(p, sym->value);
+		p[2] = sym->len;
+		memcpy(p + 3, sym->name, sym->len);
+		p += 3 + sym->len;
 	}
-	
-	ef_file hdr;
-	hdr.ef_magic[0] = *(mapped_file);
-	hdr.ef_magic[1] = *(mapped_file + 1);
-	hdr.ef_size = (word) *(mapped_file + 2);
-	hdr.ef_data = (byte*) strdup(mapped_file + 4);
 
-	munmap(mapped_file, LEN);
-	return hdr;
+	put_dword(image + 12, ef_checksum(image + EF_V2_HEADER_SIZE, size - EF_V2_HEADER_SIZE));
+	*len = size;
+	return image;
 }
 
 void free_ef(ef_file *hdr)
 {
-	free(hdr->ef_data);
+	if(hdr->ef_map)
+		munmap(hdr->ef_map, hdr->ef_map_len);
+	free(hdr->ef_segs);
+	free(hdr->ef_syms);
+	*hdr = (ef_file) { 0 };
 }
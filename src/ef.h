@@ -1,16 +1,97 @@
 #ifndef EF_H
 #define EF_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "bytes.h"
 
+/*
+ *
+ * EF file layout, all numbers little endian
+ *
+ * v1, a single segment loaded at EF_V1_LOAD
+ * 	offset 0 	'E' 'F'
+ * 	offset 2 	payload size, 16-bit, at most MEM_SIZE - EF_V1_LOAD
+ * 	offset 4 	payload, raw binary
+ *
+ * v2, the v1 size field holds EF_V2_MARK, which no v1 payload can have
+ * 	offset 0 	'E' 'F'
+ * 	offset 2 	EF_V2_MARK
+ * 	offset 4 	version, 2
+ * 	offset 5 	flags, EF_HAS_ENTRY
+ * 	offset 6 	entry point, 16-bit
+ * 	offset 8 	number of segments, 16-bit
+ * 	offset 10 	number of symbols, 16-bit
+ * 	offset 12 	checksum of bytes [16, end of file), FNV-1a 32-bit
+ * 	offset 16 	segment table, per segment:
+ * 					load address 16-bit, length 16-bit, file offset 32-bit
+ * 	then 		symbol table, per symbol:
+ * 					value 16-bit, name length 8-bit, name bytes
+ * 	then 		segment payloads, wherever the file offsets point
+ *
+ * */
+
+#define EF_HEADER_SIZE 		4
+#define EF_V2_HEADER_SIZE 	16
+#define EF_V2_SEGMENT_SIZE 	8
+#define EF_V2_MARK 			0xFFFF
+#define EF_V1_LOAD 			0x1000
+
+// v2 flags
+#define EF_HAS_ENTRY 		0x01
+
+typedef struct
+{
+	word 		addr;
+	word 		len;
+	const byte 	*data; 		// points into the mapped file
+} ef_segment;
+
+typedef struct
+{
+	word 		value;
+	byte 		len;
+	const char 	*name; 		// not NUL terminated, points into the mapped file
+} ef_symbol;
+
 typedef struct // __attribute__((packed))
 {
 	byte 		ef_magic[2];
-	word 		ef_size;
-	byte		*ef_data;
+	byte 		ef_version;
+	byte 		ef_flags;
+	word 		ef_entry;
+	uint32_t 	ef_size; 	// total payload bytes over all segments
+	const byte	*ef_data; 	// first segment payload, valid until free_ef
+
+	word 		ef_nsegs;
+	ef_segment 	*ef_segs;
+	word 		ef_nsyms;
+	ef_symbol 	*ef_syms;
+
+	void 		*ef_map;
+	size_t 		ef_map_len;
 } ef_file;
 
-ef_file read_ef(const char *effname);
+#define EF_MAGIC (word) (('E' << 8) | 'F')
+
+// Maps the file and validates the header, the tables and the checksum.
+// Payloads are not copied. v1 files are presented as one segment at
+// EF_V1_LOAD with that address as entry point.
+// Returns 0 on success, -1 on error (message printed to stderr)
+int read_ef(const char *effname, ef_file *hdr);
 void free_ef(ef_file *hdr);
 
+// Like read_ef for an image already in memory, e.g. from the assembler.
+// The image is not copied and has to outlive hdr; `effname` only names
+// it in error messages.
+int ef_parse(const byte *image, size_t len, const char *effname, ef_file *hdr);
+
+// Encode hdr as an EF v2 image: the entry point and flags, the segments
+// and the symbols. ef_size, ef_data and ef_map are ignored. Returns a
+// malloc'd image of *len bytes, or NULL on allocation failure.
+byte *ef_build(const ef_file *hdr, size_t *len);
+
+uint32_t ef_checksum(const byte *data, size_t len);
+
 #endif
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emu.h"
+#include "bcache.h"
+#include "ef.h"
+
+int emu_init(emu_t *emu, const emu_config_t *config)
+{
+	emu->config = config ? *config : (emu_config_t) { 0 };
+	emu->bcache = NULL;
+	emu->ram.data = NULL;
+	sched_init(&emu->sched);
+	if(emu->config.jit || emu->config.jit_verify)
+		emu->config.block_cache = true;
+	if(emu->config.block_cache && !(emu->bcache = bcache_create()))
+		return -1;
+	if(emu->config.jit || emu->config.jit_verify)
+		bcache_enable_jit(emu->bcache, emu->config.jit_verify); 	// interpreted if unavailable
+	if(ram_init(&emu->ram, emu->config.arena) < 0)
+		return -1;
+	emu_reset(emu);
+	return 0;
+}
+
+void emu_free(emu_t *emu)
+{
+	bcache_free(emu->bcache);
+	emu->bcache = NULL;
+	sched_free(&emu->sched);
+	if(emu->ram.data)
+		ram_free(&emu->ram);
+}
+
+void emu_reset(emu_t *emu)
+{
+	cpu_reset(&emu->cpu, &emu->ram);
+	emu->cpu.bcache = emu->bcache;
+	sched_clear(&emu->sched);
+}
+
+// Copy the segments of a parsed EF file into memory, frees hdr
+static int emu_load(emu_t *emu, ef_file *hdr)
+{
+	if(emu->config.verbose)
+	{
+		puts("EF file info:");
+		printf("Magic: %c %c\n", hdr->ef_magic[0], hdr->ef_magic[1]);
+		printf("Version: %u\n", hdr->ef_version);
+		printf("Size: %u\n", hdr->ef_size);
+		if(hdr->ef_flags & EF_HAS_ENTRY)
+			printf("Entry: $%04x\n", hdr->ef_entry);
+		for(word i = 0; i < hdr->ef_nsegs; i++)
+		{
+			const ef_segment *seg = &hdr->ef_segs[i];
+			printf("Segment $%04x, %u bytes:\n \t", seg->addr, seg->len);
+			for(word j = 0; j < seg->len && j < 16; j++)
+				printf("%02x ", seg->data[j]);
+			puts(seg->len > 16 ? "..." : "");
+		}
+		for(word i = 0; i < hdr->ef_nsyms; i++)
+			printf("Symbol %.*s = $%04x\n", hdr->ef_syms[i].len, hdr->ef_syms[i].name,
+					hdr->ef_syms[i].value);
+	}
+
+	ram_t *ram = &emu->ram;
+
+	for(word i = 0; i < hdr->ef_nsegs; i++)
+	{
+		const ef_segment *seg = &hdr->ef_segs[i];
+		memcpy(ram->data + seg->addr, seg->data, seg->len);
+		ram_touch(ram, seg->addr, seg->len);
+	}
+
+	// the pending reset after emu_reset jumps through the reset vector,
+	// which a segment with a vector table sets itself
+	bool has_vector = false;
+	for(word i = 0; i < hdr->ef_nsegs; i++)
+	{
+		const ef_segment *seg = &hdr->ef_segs[i];
+		if(seg->len && seg->addr < RESET_VECTOR + 2 && seg->addr + seg->len > RESET_VECTOR)
+			has_vector = true;
+	}
+	if((hdr->ef_flags & EF_HAS_ENTRY) && !has_vector)
+		cpu_write_word(ram, RESET_VECTOR, hdr->ef_entry);
+
+	free_ef(hdr);
+	return 0;
+}
+
+int emu_load_ef(emu_t *emu, const char *fname)
+{
+	ef_file hdr;
+	if(read_ef(fname, &hdr) < 0)
+		return -1;
+	return emu_load(emu, &hdr);
+}
+
+int emu_load_ef_image(emu_t *emu, const byte *image, size_t len)
+{
+	ef_file hdr;
+	if(ef_parse(image, len, "<memory>", &hdr) < 0)
+		return -1;
+	return emu_load(emu, &hdr);
+}
+
+// Most cycles one instruction can take, including an interrupt
+// sequence taken right before it
+#define EMU_MAX_STEP_CYCLES 14
+
+uint64_t emu_schedule(emu_t *emu, uint64_t when, sched_fn_t fn, void *ctx)
+{
+	// the slice running now ends at the earliest event it saw, or later
+	// if there was none: only an event before that needs it cut short
+	const bool earlier = when < sched_next(&emu->sched);
+	const uint64_t id = sched_add(&emu->sched, when, fn, ctx);
+	if(id && earlier)
+		cpu_yield(&emu->cpu);
+	return id;
+}
+
+cpu_stop_t emu_run(emu_t *emu, cpu_budget_t kind, uint64_t max)
+{
+	cpu6502_t *cpu = &emu->cpu;
+	sched_t *sched = &emu->sched;
+
+	uint64_t *counter = kind == CPU_BUDGET_CYCLES ? &cpu->cycles : &cpu->instructions;
+	const uint64_t end = *counter + max < *counter ? UINT64_MAX : *counter + max;
+	for(;;)
+	{
+		sched_dispatch(sched, cpu->cycles);
+		if(*counter >= end)
+			return CPU_STOP_BUDGET;
+
+		// run up to the next event, which is in the future after
+		// dispatching. Events added meanwhile are seen at the end of the
+		// slice, emu_schedule cuts it short for one that comes earlier.
+		const uint64_t next = sched_next(sched);
+		uint64_t slice = end - *counter;
+		if(kind == CPU_BUDGET_CYCLES && next - cpu->cycles < slice)
+			slice = next - cpu->cycles;
+		else if(kind == CPU_BUDGET_INSTRUCTIONS && next != UINT64_MAX)
+		{
+			// instructions never take more than EMU_MAX_STEP_CYCLES, so
+			// this many cannot run past the event by more than one
+			uint64_t safe = (next - cpu->cycles) / EMU_MAX_STEP_CYCLES;
+			slice = safe < 1 ? 1 : safe < slice ? safe : slice;
+		}
+
+		// a yield left from outside a slice has nothing to cut short
+		cpu->pending &= ~CPU_INT_YIELD;
+		cpu_stop_t stop = cpu_run(cpu, &emu->ram, kind, slice);
+		if(stop != CPU_STOP_BUDGET)
+		{
+			sched_dispatch(sched, cpu->cycles);
+			return stop;
+		}
+	}
+}
+
+uint64_t emu_jit_mismatches(const emu_t *emu)
+{
+	return emu->bcache ? emu->bcache->mismatches : 0;
+}
+
+emu_snapshot_t *emu_snapshot(emu_t *emu)
+{
+	emu_snapshot_t *snap = malloc(sizeof *snap);
+	if(!snap)
+		return NULL;
+	snap->cpu = emu->cpu;
+	if(ram_snapshot(&emu->ram, snap->pages) < 0)
+	{
+		free(snap);
+		return NULL;
+	}
+	return snap;
+}
+
+void emu_restore(emu_t *emu, const emu_snapshot_t *snap)
+{
+	emu->cpu = snap->cpu;
+	emu->cpu.bcache = emu->bcache;
+	ram_restore(&emu->ram, snap->pages);
+}
+
+void emu_snapshot_free(emu_snapshot_t *snap)
+{
+	if(!snap)
+		return;
+	ram_snapshot_release(snap->pages);
+	free(snap);
+}
@@ -0,0 +1,94 @@
+#ifndef EMU_H
+#define EMU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpu6502.h"
+#include "ram.h"
+#include "sched.h"
+
+/*
+ *
+ * Emulator instance
+ *
+ * Everything one emulated machine needs lives in emu_t, there is no
+ * global mutable state. Independent instances can run on different
+ * threads at the same time.
+ *
+ * */
+
+typedef struct emu_config
+{
+	bool verbose; 			// print EF file info when loading
+	ram_arena_t *arena; 	// take memory from here if not NULL
+	bool block_cache; 		// run straight-line code from a decode cache
+	bool jit; 				// translate hot blocks to native code, implies block_cache
+	bool jit_verify; 		// check every native block run against the interpreter
+} emu_config_t;
+
+typedef struct emu
+{
+	cpu6502_t cpu;
+	ram_t ram;
+	emu_config_t config;
+	struct cpu_bcache *bcache; 	// NULL unless config.block_cache
+	sched_t sched; 				// device events, keyed on cpu.cycles
+} emu_t;
+
+// config may be NULL for defaults. Returns 0 on success, -1 on failure.
+int emu_init(emu_t *emu, const emu_config_t *config);
+void emu_free(emu_t *emu);
+
+// Also drops every scheduled event, the cycle count starts over
+void emu_reset(emu_t *emu);
+
+// Returns 0 on success, -1 on error (message printed to stderr). The
+// entry point, if the file has one, is written to RESET_VECTOR, which
+// the reset left pending by emu_reset jumps through. A segment that
+// covers RESET_VECTOR, e.g. a vector table at NMI_VECTOR, wins over the
+// entry point.
+int emu_load_ef(emu_t *emu, const char *fname);
+
+// emu_load_ef for an EF image in memory, e.g. straight from asm_assemble
+int emu_load_ef_image(emu_t *emu, const byte *image, size_t len);
+
+// Like cpu_run, but stops the CPU at every scheduled event and runs
+// it. An event runs after the instruction during which its cycle is
+// reached, the same granularity as a cycle budget. Without events
+// this is a single cpu_run call. Snapshots do not include events.
+cpu_stop_t emu_run(emu_t *emu, cpu_budget_t kind, uint64_t max);
+
+// sched_add on emu->sched for devices. An event added from a device
+// callback while emu_run is running the CPU, e.g. a write arming a
+// timer, ends the current slice early if it is due before the slice
+// would have ended, so it is not dispatched late.
+uint64_t emu_schedule(emu_t *emu, uint64_t when, sched_fn_t fn, void *ctx);
+
+// With config.jit_verify, how many native block runs differed from the
+// interpreter so far, each also reported on stderr. 0 otherwise.
+uint64_t emu_jit_mismatches(const emu_t *emu);
+
+/*
+ *
+ * Snapshots
+ *
+ * A snapshot holds the CPU state and a copy-on-write reference to
+ * every page of the instance's own RAM, so taking one only copies the
+ * pages written since the last snapshot or restore. A snapshot may be
+ * restored any number of times, also into another instance.
+ *
+ * */
+
+typedef struct emu_snapshot
+{
+	cpu6502_t cpu;
+	ram_block_t *pages[RAM_PAGES];
+} emu_snapshot_t;
+
+// Returns NULL on allocation failure
+emu_snapshot_t *emu_snapshot(emu_t *emu);
+void emu_restore(emu_t *emu, const emu_snapshot_t *snap);
+void emu_snapshot_free(emu_snapshot_t *snap);
+
+#endif
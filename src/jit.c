@@ -0,0 +1,423 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "jit.h"
+#include "bcache.h"
+
+#if defined(__x86_64__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+struct jit
+{
+	byte *base;
+	size_t size;
+	size_t used;
+};
+
+// Upper bounds of the emitted code, checked before a block is emitted
+#define JIT_FRAME_BYTES 	40
+#define JIT_OP_BYTES 		160
+
+#define CPU_OFF(field) offsetof(cpu6502_t, field)
+
+_Static_assert(CPU_OFF(PC) < 0x80 && CPU_OFF(v_r) < 0x80 && CPU_OFF(pending) < 0x80
+		&& CPU_OFF(status) < 0x80,
+		"register fields must be reachable with an 8 bit displacement");
+
+typedef struct emit
+{
+	byte *p;
+} emit_t;
+
+static void emit8(emit_t *e, unsigned v)
+{
+	*e->p++ = v;
+}
+
+static void emit32(emit_t *e, uint32_t v)
+{
+	for(int i = 0; i < 4; i++)
+		emit8(e, v >> (8 * i));
+}
+
+static void emit64(emit_t *e, uint64_t v)
+{
+	emit32(e, v);
+	emit32(e, v >> 32);
+}
+
+static void emit_bytes(emit_t *e, const byte *bytes, size_t n)
+{
+	for(size_t i = 0; i < n; i++)
+		emit8(e, bytes[i]);
+}
+
+// Point the rel32 at `at` to `target`
+static void emit_patch(byte *at, const byte *target)
+{
+	emit_t fix = { at };
+	emit32(&fix, target - (at + 4));
+}
+
+// jcc rel32 with the target left open, returns where to patch it
+static byte *emit_jcc(emit_t *e, byte cc)
+{
+	emit_bytes(e, (const byte[]) { 0x0F, cc }, 2);
+	byte *at = e->p;
+	emit32(e, 0);
+	return at;
+}
+
+#define JCC_JZ 		0x84
+#define JCC_JNZ 	0x85
+
+// and/or byte [rbx + status], imm8
+static void emit_status(emit_t *e, bool set, byte flags)
+{
+	emit_bytes(e, (const byte[]) { 0x80, set ? 0x4B : 0x63, CPU_OFF(status) }, 3);
+	emit8(e, set ? flags : (byte) ~flags);
+}
+
+// mov byte [rbx + field], imm8
+static void emit_store(emit_t *e, byte field, byte value)
+{
+	emit_bytes(e, (const byte[]) { 0xC6, 0x43, field, value }, 4);
+}
+
+// mov al, [rbx + from]; mov [rbx + to], al
+static void emit_move(emit_t *e, byte from, byte to)
+{
+	emit_bytes(e, (const byte[]) { 0x8A, 0x43, from, 0x88, 0x43, to }, 6);
+}
+
+// mov [rbx + nres], al; mov [rbx + zres], al, after emit_move
+static void emit_nz(emit_t *e)
+{
+	emit_bytes(e, (const byte[]) { 0x88, 0x43, CPU_OFF(nres), 0x88, 0x43, CPU_OFF(zres) }, 6);
+}
+
+// mov al, [rbx + reg]; inc/dec al; mov [rbx + reg], al, and N and Z
+static void emit_step(emit_t *e, byte reg, bool inc)
+{
+	emit_bytes(e, (const byte[]) { 0x8A, 0x43, reg, 0xFE, inc ? 0xC0 : 0xC8, 0x88, 0x43, reg }, 8);
+	emit_nz(e);
+}
+
+// Instructions that only touch registers are emitted inline. Returns
+// false if the op needs its handler. CLI goes through its handler, so
+// the pending check after it sees an IRQ it unmasks.
+static bool emit_inline(emit_t *e, byte opcode)
+{
+	switch(opcode)
+	{
+	case INS_CLC: emit_store(e, CPU_OFF(carry), 0); return true;
+	case INS_SEC: emit_store(e, CPU_OFF(carry), 1); return true;
+	case INS_SEI: emit_status(e, true, I); return true;
+	case INS_CLV:
+		emit_store(e, CPU_OFF(v_a), 0);
+		emit_store(e, CPU_OFF(v_m), 0);
+		emit_store(e, CPU_OFF(v_r), 0);
+		return true;
+	case INS_CLD: emit_status(e, false, D); return true;
+	case INS_SED: emit_status(e, true, D); return true;
+	case INS_TXS: emit_move(e, CPU_OFF(X), CPU_OFF(SP)); return true;
+	case INS_TSX: emit_move(e, CPU_OFF(SP), CPU_OFF(X)); emit_nz(e); return true;
+	case INS_TAX: emit_move(e, CPU_OFF(A), CPU_OFF(X)); emit_nz(e); return true;
+	case INS_TAY: emit_move(e, CPU_OFF(A), CPU_OFF(Y)); emit_nz(e); return true;
+	case INS_TXA: emit_move(e, CPU_OFF(X), CPU_OFF(A)); emit_nz(e); return true;
+	case INS_TYA: emit_move(e, CPU_OFF(Y), CPU_OFF(A)); emit_nz(e); return true;
+	case INS_INX: emit_step(e, CPU_OFF(X), true); return true;
+	case INS_INY: emit_step(e, CPU_OFF(Y), true); return true;
+	case INS_DEX: emit_step(e, CPU_OFF(X), false); return true;
+	case INS_DEY: emit_step(e, CPU_OFF(Y), false); return true;
+	case INS_NOP: return true;
+	default: return false;
+	}
+}
+
+typedef enum jit_alu
+{
+	JIT_LD,
+	JIT_ST,
+	JIT_AND,
+	JIT_ORA,
+	JIT_EOR,
+	JIT_ADC,
+	JIT_SBC,
+	JIT_CMP
+} jit_alu_t;
+
+// Loads, stores and ALU ops with an immediate or zero page operand, and
+// the register they work on
+static bool jit_alu_op(byte opcode, jit_alu_t *alu, byte *reg)
+{
+	switch(opcode)
+	{
+	case INS_LDA_IMM: case INS_LDA_ZP: *alu = JIT_LD; *reg = CPU_OFF(A); return true;
+	case INS_LDX_IMM: case INS_LDX_ZP: *alu = JIT_LD; *reg = CPU_OFF(X); return true;
+	case INS_LDY_IMM: case INS_LDY_ZP: *alu = JIT_LD; *reg = CPU_OFF(Y); return true;
+	case INS_STA_ZP: *alu = JIT_ST; *reg = CPU_OFF(A); return true;
+	case INS_STX_ZP: *alu = JIT_ST; *reg = CPU_OFF(X); return true;
+	case INS_STY_ZP: *alu = JIT_ST; *reg = CPU_OFF(Y); return true;
+	case INS_AND_IMM: case INS_AND_ZP: *alu = JIT_AND; *reg = CPU_OFF(A); return true;
+	case INS_ORA_IMM: case INS_ORA_ZP: *alu = JIT_ORA; *reg = CPU_OFF(A); return true;
+	case INS_EOR_IMM: case INS_EOR_ZP: *alu = JIT_EOR; *reg = CPU_OFF(A); return true;
+	case INS_ADC_IMM: case INS_ADC_ZP: *alu = JIT_ADC; *reg = CPU_OFF(A); return true;
+	case INS_SBC_IMM: case INS_SBC_ZP: *alu = JIT_SBC; *reg = CPU_OFF(A); return true;
+	case INS_CMP_IMM: case INS_CMP_ZP: *alu = JIT_CMP; *reg = CPU_OFF(A); return true;
+	case INS_CPX_IMM: case INS_CPX_ZP: *alu = JIT_CMP; *reg = CPU_OFF(X); return true;
+	case INS_CPY_IMM: case INS_CPY_ZP: *alu = JIT_CMP; *reg = CPU_OFF(Y); return true;
+	default: return false;
+	}
+}
+
+/*
+ * Inline op with its operand, PC already past the opcode
+ *
+ * 	test byte [rbx + status], D; jnz slow 	; ADC, SBC
+ * 	mov rax, [r12 + rd[0] or wr[0]] 		; zero page
+ * 	test rax, rax; jz slow
+ * 	add word [rbx + PC], 1
+ * 	mov cl, imm or movzx ecx, byte [rax + zp]
+ * 	the op on cl, flags stored like the handler does
+ *
+ * The jumps to the handler call are left in `slow`. Returns false if
+ * the op has no inline form.
+ */
+static bool emit_alu(emit_t *e, const bcache_op_t *op, byte **slow, unsigned *nslow)
+{
+	jit_alu_t alu;
+	byte reg;
+	if(!jit_alu_op(op->opcode, &alu, &reg))
+		return false;
+
+	const bool zp = cpu_optable[op->opcode].mode == AM_ZP;
+	const byte imm = op->operand;
+	if(alu == JIT_ADC || alu == JIT_SBC)
+	{
+		emit_bytes(e, (const byte[]) { 0xF6, 0x43, CPU_OFF(status), D }, 4);
+		slow[(*nslow)++] = emit_jcc(e, JCC_JNZ);
+	}
+	if(zp)
+	{
+		emit_bytes(e, (const byte[]) { 0x49, 0x8B, 0x84, 0x24 }, 4);
+		emit32(e, alu == JIT_ST ? offsetof(ram_t, wr) : offsetof(ram_t, rd));
+		emit_bytes(e, (const byte[]) { 0x48, 0x85, 0xC0 }, 3);
+		slow[(*nslow)++] = emit_jcc(e, JCC_JZ);
+	}
+	emit_bytes(e, (const byte[]) { 0x66, 0x83, 0x43, CPU_OFF(PC), 0x01 }, 5);
+
+	if(alu == JIT_ST)
+	{
+		// mov cl, [rbx + reg]; mov [rax + zp], cl
+		emit_bytes(e, (const byte[]) { 0x8A, 0x4B, reg, 0x88, 0x88 }, 5);
+		emit32(e, imm);
+		return true;
+	}
+
+	if(zp)
+	{
+		emit_bytes(e, (const byte[]) { 0x0F, 0xB6, 0x88 }, 3);
+		emit32(e, imm);
+	}
+	else
+		emit_bytes(e, (const byte[]) { 0xB1, imm }, 2);
+
+	switch(alu)
+	{
+	case JIT_LD:
+		// mov [rbx + reg], cl; mov [rbx + nres], cl; mov [rbx + zres], cl
+		emit_bytes(e, (const byte[]) { 0x88, 0x4B, reg, 0x88, 0x4B, CPU_OFF(nres),
+				0x88, 0x4B, CPU_OFF(zres) }, 9);
+		break;
+	case JIT_AND:
+	case JIT_ORA:
+	case JIT_EOR:
+		// mov al, [rbx + A]; and/or/xor al, cl; mov [rbx + A], al
+		emit_bytes(e, (const byte[]) { 0x8A, 0x43, reg,
+				alu == JIT_AND ? 0x20 : alu == JIT_ORA ? 0x08 : 0x30, 0xC8,
+				0x88, 0x43, reg }, 8);
+		emit_nz(e);
+		break;
+	case JIT_CMP:
+		// mov al, [rbx + reg]; sub al, cl; setae [rbx + carry]
+		emit_bytes(e, (const byte[]) { 0x8A, 0x43, reg, 0x28, 0xC8,
+				0x0F, 0x93, 0x43, CPU_OFF(carry) }, 9);
+		emit_nz(e);
+		break;
+	case JIT_SBC:
+		emit_bytes(e, (const byte[]) { 0xF6, 0xD1 }, 2); 	// not cl, then as ADC
+		// fall through
+	case JIT_ADC:
+		// mov al, [rbx + A]; mov [rbx + v_a], al; mov [rbx + v_m], cl
+		// mov dl, [rbx + carry]; add dl, 0xff 	; CF = carry
+		// adc al, cl; setc [rbx + carry]
+		// mov [rbx + A], al; mov [rbx + v_r], al
+		emit_bytes(e, (const byte[]) { 0x8A, 0x43, reg, 0x88, 0x43, CPU_OFF(v_a),
+				0x88, 0x4B, CPU_OFF(v_m), 0x8A, 0x53, CPU_OFF(carry), 0x80, 0xC2, 0xFF,
+				0x10, 0xC8, 0x0F, 0x92, 0x43, CPU_OFF(carry),
+				0x88, 0x43, reg, 0x88, 0x43, CPU_OFF(v_r) }, 27);
+		emit_nz(e);
+		break;
+	case JIT_ST:
+		break;
+	}
+	return true;
+}
+
+jit_t *jit_create(size_t code_size)
+{
+	jit_t *jit = malloc(sizeof *jit);
+	if(!jit)
+		return NULL;
+	jit->base = mmap(NULL, code_size, PROT_READ | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(jit->base == MAP_FAILED)
+	{
+		free(jit);
+		return NULL;
+	}
+	jit->size = code_size;
+	jit->used = 0;
+	return jit;
+}
+
+void jit_free(jit_t *jit)
+{
+	if(!jit)
+		return;
+	munmap(jit->base, jit->size);
+	free(jit);
+}
+
+void jit_flush(jit_t *jit)
+{
+	jit->used = 0;
+}
+
+/*
+ * Generated function, rbx = cpu, r12 = ram, r13d = ram->code_gen on entry
+ *
+ * 	push rbx; push r12; push r13
+ * 	mov rbx, rdi; mov r12, rsi
+ * 	mov r13d, [r12 + code_gen]
+ * 	per op:
+ * 		add word [rbx + PC], 1
+ * 		inline op, or
+ * 		inline op with its operand; jmp next, slow paths to slow, or
+ * 	slow:
+ * 		mov rdi, rbx; mov rsi, r12; mov rax, handler; call rax
+ * 		mov eax, ops done; cmp [r12 + code_gen], r13d; jne out
+ * 		movzx ecx, byte [rbx + pending]
+ * 		test cl, ~IRQ; jnz out
+ * 		test cl, IRQ; jz next
+ * 		test byte [rbx + status], I; jz out 	; cpu_interrupt_due
+ * 	next:
+ * 	mov eax, n
+ * out:
+ * 	pop r13; pop r12; pop rbx; ret
+ */
+jit_fn_t jit_compile(jit_t *jit, const bcache_block_t *block)
+{
+	const size_t need = JIT_FRAME_BYTES + block->n * JIT_OP_BYTES;
+	if(jit->size - jit->used < need)
+		return NULL;
+
+	byte *start = jit->base + jit->used;
+	if(mprotect(jit->base, jit->size, PROT_READ | PROT_WRITE) < 0)
+		return NULL;
+
+	const uint32_t code_gen = offsetof(ram_t, code_gen);
+	emit_t e = { start };
+	byte *exits[3 * BCACHE_MAX_OPS];
+	unsigned n_exits = 0;
+
+	emit_bytes(&e, (const byte[]) { 0x53, 0x41, 0x54, 0x41, 0x55 }, 5);
+	emit_bytes(&e, (const byte[]) { 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4 }, 6);
+	emit_bytes(&e, (const byte[]) { 0x45, 0x8B, 0xAC, 0x24 }, 4);
+	emit32(&e, code_gen);
+
+	for(byte i = 0; i < block->n; i++)
+	{
+		const bcache_op_t *op = &block->ops[i];
+		emit_bytes(&e, (const byte[]) { 0x66, 0x83, 0x43, CPU_OFF(PC), 0x01 }, 5);
+		if(emit_inline(&e, op->opcode))
+			continue;
+
+		byte *slow[2], *over = NULL;
+		unsigned n_slow = 0;
+		if(emit_alu(&e, op, slow, &n_slow))
+		{
+			if(!n_slow)
+				continue;
+			emit8(&e, 0xE9); 	// jmp over the handler call
+			over = e.p;
+			emit32(&e, 0);
+			for(unsigned j = 0; j < n_slow; j++)
+				emit_patch(slow[j], e.p);
+		}
+
+		emit_bytes(&e, (const byte[]) { 0x48, 0x89, 0xDF, 0x4C, 0x89, 0xE6, 0x48, 0xB8 }, 8);
+		emit64(&e, (uintptr_t) op->handler);
+		emit_bytes(&e, (const byte[]) { 0xFF, 0xD0 }, 2);
+		if(i + 1 < block->n) 	// nothing left to skip after the last one
+		{
+			emit8(&e, 0xB8);
+			emit32(&e, i + 1);
+			emit_bytes(&e, (const byte[]) { 0x45, 0x39, 0xAC, 0x24 }, 4);
+			emit32(&e, code_gen);
+			exits[n_exits++] = emit_jcc(&e, JCC_JNZ);
+			emit_bytes(&e, (const byte[]) { 0x0F, 0xB6, 0x4B, CPU_OFF(pending) }, 4);
+			emit_bytes(&e, (const byte[]) { 0xF6, 0xC1, (byte) ~CPU_INT_IRQ }, 3);
+			exits[n_exits++] = emit_jcc(&e, JCC_JNZ);
+			emit_bytes(&e, (const byte[]) { 0xF6, 0xC1, CPU_INT_IRQ, 0x74, 10 }, 5);
+			emit_bytes(&e, (const byte[]) { 0xF6, 0x43, CPU_OFF(status), I }, 4);
+			exits[n_exits++] = emit_jcc(&e, JCC_JZ);
+		}
+		if(over)
+			emit_patch(over, e.p);
+	}
+
+	emit8(&e, 0xB8);
+	emit32(&e, block->n);
+	for(unsigned i = 0; i < n_exits; i++)
+		emit_patch(exits[i], e.p);
+	emit_bytes(&e, (const byte[]) { 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3 }, 6);
+
+	jit->used += e.p - start;
+	if(mprotect(jit->base, jit->size, PROT_READ | PROT_EXEC) < 0)
+		return NULL;
+
+	jit_fn_t fn;
+	*(void **) &fn = start; 	// object to function pointer, as with dlsym
+	return fn;
+}
+
+#else
+
+jit_t *jit_create(size_t code_size)
+{
+	(void) code_size;
+	return NULL;
+}
+
+void jit_free(jit_t *jit)
+{
+	(void) jit;
+}
+
+jit_fn_t jit_compile(jit_t *jit, const bcache_block_t *block)
+{
+	(void) jit;
+	(void) block;
+	return NULL;
+}
+
+void jit_flush(jit_t *jit)
+{
+	(void) jit;
+}
+
+#endif
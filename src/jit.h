@@ -0,0 +1,50 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu6502.h"
+
+/*
+ *
+ * x86-64 translator for cached blocks
+ *
+ * A block that ran often enough is translated into one native function.
+ * Flag ops other than CLI, register transfers, INX/INY/DEX/DEY, and
+ * loads, stores and ALU ops with an immediate or zero page operand are
+ * emitted inline, with the lazy flag fields set in place. Zero page
+ * accesses go through ram->rd[0] and ram->wr[0] and fall back to the
+ * handler when the page has no pointer, as do ADC and SBC in decimal
+ * mode. Everything else is a direct call of its handler, so the
+ * interpreter stays the reference for the semantics, which verify mode
+ * checks. After every call the native code compares ram->code_gen with
+ * its value on entry and tests cpu_interrupt_due, and leaves early when
+ * the handler wrote to cached code or an interrupt can be taken, exactly
+ * like the interpreted block loop. An IRQ masked by I runs on.
+ *
+ * Code lives in one mapping that is writable only while a block is
+ * being emitted. When it is full the caller flushes it and all
+ * translations start over. On other architectures jit_create returns
+ * NULL and blocks keep running interpreted.
+ *
+ * */
+
+struct bcache_block;
+
+// Returns how many ops of the block ran
+typedef unsigned (*jit_fn_t)(cpu6502_t *cpu, ram_t *ram);
+
+typedef struct jit jit_t;
+
+// Returns NULL on failure or when the host is not x86-64
+jit_t *jit_create(size_t code_size);
+void jit_free(jit_t *jit);
+
+// Returns NULL when the code buffer is full
+jit_fn_t jit_compile(jit_t *jit, const struct bcache_block *block);
+
+// Drop every translation, the functions returned so far become invalid
+void jit_flush(jit_t *jit);
+
+#endif
@@ -0,0 +1,531 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lanes.h"
+
+// One byte register of every lane. GCC lowers the operations to whatever
+// vector unit the target has (SSE2, AVX2, AVX-512) or to plain loops.
+typedef byte lanes_vec_t __attribute__((vector_size(LANES_MAX)));
+
+#define LANES_SAME 	256 	// entries in the table of checked instructions
+
+struct lanes
+{
+	unsigned n;
+	uint32_t running; 		// bit per lane that has not stopped
+
+	lanes_vec_t A, X, Y, SP, status;
+	lanes_vec_t nres, zres, carry, v_a, v_m, v_r; 	// lazy flags as in cpu6502_t
+	word PC[LANES_MAX];
+	uint64_t cycles[LANES_MAX];
+	uint64_t instructions[LANES_MAX];
+	cpu_stop_t stops[LANES_MAX];
+
+	// Instructions known to be the same in a set of lanes, valid while
+	// epoch is unchanged. Checked pages are watched, and a write to one in
+	// any lane bumps its code_gen and with that the epoch.
+	struct lanes_same
+	{
+		word pc;
+		uint32_t lanes;
+		uint64_t epoch;
+	} same[LANES_SAME];
+	uint64_t epoch;
+	uint32_t code_gen[LANES_MAX]; 	// ram.code_gen of each lane as of the last check
+
+	uint64_t vector_ops, scalar_ops;
+	ram_t ram[];
+};
+
+#define for_each_lane(i, set) \
+	for(uint32_t _set = (set), i; _set && (i = __builtin_ctz(_set), 1); _set &= _set - 1)
+
+lanes_t *lanes_create(unsigned n, ram_arena_t *arena)
+{
+	if(!n || n > LANES_MAX)
+		return NULL;
+
+	// the vectors need their natural alignment, which malloc does not give
+	const size_t align = sizeof(lanes_vec_t);
+	size_t size = sizeof(lanes_t) + n * sizeof(ram_t);
+	size = (size + align - 1) / align * align;
+	lanes_t *lanes = aligned_alloc(align, size);
+	if(!lanes)
+		return NULL;
+	memset(lanes, 0, size);
+	lanes->n = n;
+
+	for(unsigned i = 0; i < n; i++)
+		if(ram_init(&lanes->ram[i], arena) < 0)
+		{
+			lanes->n = i;
+			lanes_destroy(lanes);
+			return NULL;
+		}
+	lanes->running = n == LANES_MAX ? UINT32_MAX : (UINT32_C(1) << n) - 1;
+	return lanes;
+}
+
+void lanes_destroy(lanes_t *lanes)
+{
+	if(!lanes)
+		return;
+	for(unsigned i = 0; i < lanes->n; i++)
+		ram_free(&lanes->ram[i]);
+	free(lanes);
+}
+
+unsigned lanes_count(const lanes_t *lanes)
+{
+	return lanes->n;
+}
+
+ram_t *lanes_ram(lanes_t *lanes, unsigned lane)
+{
+	return &lanes->ram[lane];
+}
+
+void lanes_get(const lanes_t *lanes, unsigned i, cpu6502_t *cpu)
+{
+	memset(cpu, 0, sizeof *cpu);
+	cpu->A = lanes->A[i];
+	cpu->X = lanes->X[i];
+	cpu->Y = lanes->Y[i];
+	cpu->SP = lanes->SP[i];
+	cpu->PC = lanes->PC[i];
+	cpu->status = lanes->status[i];
+	cpu->nres = lanes->nres[i];
+	cpu->zres = lanes->zres[i];
+	cpu->carry = lanes->carry[i];
+	cpu->v_a = lanes->v_a[i];
+	cpu->v_m = lanes->v_m[i];
+	cpu->v_r = lanes->v_r[i];
+	cpu->cycles = lanes->cycles[i];
+	cpu->instructions = lanes->instructions[i];
+}
+
+void lanes_set(lanes_t *lanes, unsigned i, const cpu6502_t *cpu)
+{
+	lanes->A[i] = cpu->A;
+	lanes->X[i] = cpu->X;
+	lanes->Y[i] = cpu->Y;
+	lanes->SP[i] = cpu->SP;
+	lanes->PC[i] = cpu->PC;
+	lanes->status[i] = cpu->status;
+	lanes->nres[i] = cpu->nres;
+	lanes->zres[i] = cpu->zres;
+	lanes->carry[i] = cpu->carry;
+	lanes->v_a[i] = cpu->v_a;
+	lanes->v_m[i] = cpu->v_m;
+	lanes->v_r[i] = cpu->v_r;
+	lanes->cycles[i] = cpu->cycles;
+	lanes->instructions[i] = cpu->instructions;
+}
+
+void lanes_reset(lanes_t *lanes, const ram_t *image)
+{
+	for(unsigned i = 0; i < lanes->n; i++)
+	{
+		ram_t *ram = &lanes->ram[i];
+		memcpy(ram->data, image->data, MEM_SIZE);
+		ram_touch(ram, 0, MEM_SIZE);
+
+		// as after cpu_reset and the reset sequence the first cpu_run takes
+		cpu6502_t cpu;
+		memset(&cpu, 0, sizeof cpu);
+		cpu.SP = PAGE_SIZE - 3;
+		cpu_set_status(&cpu, I);
+		cpu.PC = cpu_read_word(ram, RESET_VECTOR);
+		cpu.cycles = 7;
+		lanes_set(lanes, i, &cpu);
+		lanes->stops[i] = CPU_STOP_BUDGET;
+	}
+	lanes->running = lanes->n == LANES_MAX ? UINT32_MAX : (UINT32_C(1) << lanes->n) - 1;
+}
+
+// Byte at `addr` in every lane of `group`
+static void lanes_gather(lanes_t *lanes, uint32_t group, word addr, lanes_vec_t *out)
+{
+	for_each_lane(i, group)
+		(*out)[i] = ram_read(&lanes->ram[i], addr);
+}
+
+// Forget the checked instructions if a lane of `group` wrote to code
+static void lanes_code_written(lanes_t *lanes, uint32_t group)
+{
+	bool written = false;
+	for_each_lane(i, group)
+		if(lanes->ram[i].code_gen != lanes->code_gen[i])
+		{
+			lanes->code_gen[i] = lanes->ram[i].code_gen;
+			written = true;
+		}
+	lanes->epoch += written;
+}
+
+static void lanes_scatter(lanes_t *lanes, uint32_t group, word addr, const lanes_vec_t *in)
+{
+	for_each_lane(i, group)
+		ram_write(&lanes->ram[i], addr, (*in)[i]);
+	lanes_code_written(lanes, group);
+}
+
+/*
+ * Run the registers and memory part of one instruction on whole vectors
+ * for every lane of `group`, which all have `code` at their PC. `m` has
+ * 0xFF for the lanes of the group, the others are left as they are by
+ * blending with it. PC and the counters are up to the caller; branches
+ * only set `taken` for the lanes that branch.
+ * Returns false, before touching anything, for instructions that have
+ * to go through the scalar handlers.
+ */
+static bool lanes_vector(lanes_t *lanes, uint32_t group, const lanes_vec_t *mask,
+		const byte *code, lanes_vec_t *taken)
+{
+	const cpu_op_t *op = &cpu_optable[code[0]];
+	const word addr = op->mode == AM_ZP ? code[1] : code[1] | code[2] << 8;
+	const lanes_vec_t m = *mask;
+	lanes_vec_t v = { 0 }, r;
+
+#define BLEND(reg, val) (lanes->reg = ((val) & m) | (lanes->reg & ~m))
+#define SET_NZ(val) (BLEND(nres, val), BLEND(zres, val))
+#define OPERAND() \
+	do \
+	{ \
+		if(op->mode == AM_IMM) \
+			v += code[1]; \
+		else \
+			lanes_gather(lanes, group, addr, &v); \
+	} while(0)
+
+	switch(code[0])
+	{
+	case INS_LDA_IMM: case INS_LDA_ZP: case INS_LDA_ABS:
+		OPERAND(); BLEND(A, v); SET_NZ(v); break;
+	case INS_LDX_IMM: case INS_LDX_ZP: case INS_LDX_ABS:
+		OPERAND(); BLEND(X, v); SET_NZ(v); break;
+	case INS_LDY_IMM: case INS_LDY_ZP: case INS_LDY_ABS:
+		OPERAND(); BLEND(Y, v); SET_NZ(v); break;
+
+	case INS_STA_ZP: case INS_STA_ABS:
+		lanes_scatter(lanes, group, addr, &lanes->A); break;
+	case INS_STX_ZP: case INS_STX_ABS:
+		lanes_scatter(lanes, group, addr, &lanes->X); break;
+	case INS_STY_ZP: case INS_STY_ABS:
+		lanes_scatter(lanes, group, addr, &lanes->Y); break;
+
+	case INS_AND_IMM: case INS_AND_ZP: case INS_AND_ABS:
+		OPERAND(); r = lanes->A & v; BLEND(A, r); SET_NZ(r); break;
+	case INS_ORA_IMM: case INS_ORA_ZP: case INS_ORA_ABS:
+		OPERAND(); r = lanes->A | v; BLEND(A, r); SET_NZ(r); break;
+	case INS_EOR_IMM: case INS_EOR_ZP: case INS_EOR_ABS:
+		OPERAND(); r = lanes->A ^ v; BLEND(A, r); SET_NZ(r); break;
+
+	case INS_ADC_IMM: case INS_ADC_ZP: case INS_ADC_ABS:
+	case INS_SBC_IMM: case INS_SBC_ZP: case INS_SBC_ABS:
+	{
+		// decimal mode only in the scalar handlers
+		const lanes_vec_t dec = lanes->status & m & D;
+		for(unsigned i = 0; i < LANES_MAX; i++)
+			if(dec[i])
+				return false;
+
+		OPERAND();
+		if(code[0] == INS_SBC_IMM || code[0] == INS_SBC_ZP || code[0] == INS_SBC_ABS)
+			v = ~v;
+		const lanes_vec_t a = lanes->A, c = lanes->carry;
+		r = a + v + c;
+		// the 9th bit: a + v wrapped if r < a, a + v + 1 if r <= a
+		const lanes_vec_t cout = (((lanes_vec_t) (r < a) & ~-c) | ((lanes_vec_t) (r <= a) & -c)) & 1;
+		BLEND(v_a, a);
+		BLEND(v_m, v);
+		BLEND(v_r, r);
+		BLEND(carry, cout);
+		BLEND(A, r);
+		SET_NZ(r);
+		break;
+	}
+
+	case INS_CMP_IMM: case INS_CMP_ZP: case INS_CMP_ABS:
+		OPERAND(); r = lanes->A; goto compare;
+	case INS_CPX_IMM: case INS_CPX_ZP: case INS_CPX_ABS:
+		OPERAND(); r = lanes->X; goto compare;
+	case INS_CPY_IMM: case INS_CPY_ZP: case INS_CPY_ABS:
+		OPERAND(); r = lanes->Y;
+	compare:
+		BLEND(carry, (lanes_vec_t) (r >= v) & 1);
+		SET_NZ(r - v);
+		break;
+
+	case INS_TAX: BLEND(X, lanes->A); SET_NZ(lanes->A); break;
+	case INS_TAY: BLEND(Y, lanes->A); SET_NZ(lanes->A); break;
+	case INS_TXA: BLEND(A, lanes->X); SET_NZ(lanes->X); break;
+	case INS_TYA: BLEND(A, lanes->Y); SET_NZ(lanes->Y); break;
+	case INS_TSX: BLEND(X, lanes->SP); SET_NZ(lanes->SP); break;
+	case INS_TXS: BLEND(SP, lanes->X); break;
+
+	case INS_INX: r = lanes->X + 1; BLEND(X, r); SET_NZ(r); break;
+	case INS_DEX: r = lanes->X - 1; BLEND(X, r); SET_NZ(r); break;
+	case INS_INY: r = lanes->Y + 1; BLEND(Y, r); SET_NZ(r); break;
+	case INS_DEY: r = lanes->Y - 1; BLEND(Y, r); SET_NZ(r); break;
+
+	case INS_ASL_A:
+		r = lanes->A << 1; BLEND(carry, lanes->A >> 7); BLEND(A, r); SET_NZ(r); break;
+	case INS_LSR_ACC:
+		r = lanes->A >> 1; BLEND(carry, lanes->A & 1); BLEND(A, r); SET_NZ(r); break;
+	case INS_ROL_ACC:
+		r = lanes->A << 1 | lanes->carry; BLEND(carry, lanes->A >> 7); BLEND(A, r); SET_NZ(r); break;
+	case INS_ROR_ACC:
+		r = lanes->A >> 1 | lanes->carry << 7; BLEND(carry, lanes->A & 1); BLEND(A, r); SET_NZ(r); break;
+
+	case INS_CLC: BLEND(carry, v); break;
+	case INS_SEC: BLEND(carry, v + 1); break;
+	case INS_CLV: BLEND(v_a, v); BLEND(v_m, v); BLEND(v_r, v); break;
+	case INS_CLI: BLEND(status, lanes->status & (byte) ~I); break;
+	case INS_SEI: BLEND(status, lanes->status | I); break;
+	case INS_CLD: BLEND(status, lanes->status & (byte) ~D); break;
+	case INS_SED: BLEND(status, lanes->status | D); break;
+	case INS_NOP: break;
+
+	case INS_BPL: r = (lanes_vec_t) ((lanes->nres & 0x80) == 0); goto branch;
+	case INS_BMI: r = (lanes_vec_t) ((lanes->nres & 0x80) != 0); goto branch;
+	case INS_BVC: case INS_BVS:
+		r = (lanes->v_a ^ lanes->v_r) & (lanes->v_m ^ lanes->v_r) & 0x80;
+		r = (lanes_vec_t) (code[0] == INS_BVS ? r != 0 : r == 0);
+		goto branch;
+	case INS_BCC: r = (lanes_vec_t) (lanes->carry == 0); goto branch;
+	case INS_BCS: r = (lanes_vec_t) (lanes->carry != 0); goto branch;
+	case INS_BNE: r = (lanes_vec_t) (lanes->zres != 0); goto branch;
+	case INS_BEQ: r = (lanes_vec_t) (lanes->zres == 0);
+	branch:
+		*taken = r & m;
+		break;
+
+	default:
+		return false;
+	}
+#undef OPERAND
+#undef SET_NZ
+#undef BLEND
+	return true;
+}
+
+// One instruction of lane `i` through the scalar handler
+static void lanes_scalar(lanes_t *lanes, unsigned i, const cpu_op_t *op)
+{
+	cpu6502_t cpu;
+	lanes_get(lanes, i, &cpu);
+	cpu.PC++;
+	cpu.cycles += op->cycles;
+	op->handler(&cpu, &lanes->ram[i]);
+	cpu.instructions++;
+	lanes_set(lanes, i, &cpu);
+}
+
+// Whether every lane of `group` has the `len` bytes of `code` at `pc`
+static bool lanes_same_code(lanes_t *lanes, uint32_t group, word pc,
+		const byte *code, unsigned len)
+{
+	for_each_lane(i, group)
+		for(unsigned k = 0; k < len; k++)
+			if(ram_read(&lanes->ram[i], pc + k) != code[k])
+				return false;
+	return true;
+}
+
+// lanes_same_code through the table of instructions checked before
+static bool lanes_checked_code(lanes_t *lanes, uint32_t group, word pc,
+		const byte *code, unsigned len)
+{
+	struct lanes_same *same = &lanes->same[(pc ^ pc >> 8) % LANES_SAME];
+	if(same->epoch == lanes->epoch && same->pc == pc && !(group & ~same->lanes))
+		return true;
+	if(!lanes_same_code(lanes, group, pc, code, len))
+		return false;
+
+	const word last = pc + len - 1;
+	for_each_lane(i, group)
+		if(!ram_watch_code(&lanes->ram[i], pc >> 8) || !ram_watch_code(&lanes->ram[i], last >> 8))
+			return true; 	// device or shared memory, check it every time
+	same->pc = pc;
+	same->lanes = group;
+	same->epoch = lanes->epoch;
+	return true;
+}
+
+// Cycles the lanes of `group` can all run before one of them reaches
+// its deadline
+static uint64_t lanes_slack(const lanes_t *lanes, uint32_t group, const uint64_t *deadline)
+{
+	uint64_t slack = UINT64_MAX;
+	for_each_lane(i, group)
+	{
+		const uint64_t left = lanes->cycles[i] < deadline[i] ? deadline[i] - lanes->cycles[i] : 0;
+		if(left < slack)
+			slack = left;
+	}
+	return slack;
+}
+
+static void lanes_flush(lanes_t *lanes, uint32_t group, word pc, uint64_t cycles,
+		uint64_t instructions)
+{
+	for_each_lane(i, group)
+	{
+		lanes->PC[i] = pc;
+		lanes->cycles[i] += cycles;
+		lanes->instructions[i] += instructions;
+	}
+	lanes->vector_ops += instructions * __builtin_popcount(group);
+}
+
+/*
+ * Run the lanes of `group`, which share PC and the instruction there,
+ * together for as long as they stay together. While they do, PC and the
+ * counters advance the same for all of them and are only kept once, in
+ * locals, until the group breaks up or falls back to the scalar handlers.
+ */
+static void lanes_lockstep(lanes_t *lanes, uint32_t group, const uint64_t *deadline)
+{
+	const unsigned lead = __builtin_ctz(group);
+	ram_t *const ram = &lanes->ram[lead];
+	lanes_vec_t m = { 0 };
+	for_each_lane(i, group)
+		m[i] = 0xFF;
+
+	word pc = lanes->PC[lead];
+	uint64_t slack = lanes_slack(lanes, group, deadline);
+	uint64_t cycles = 0, instructions = 0; 	// run by every lane since the last flush
+	bool checked = true; 					// the caller compared the first instruction
+
+	while(cycles < slack)
+	{
+		byte code[3] = { ram_read(ram, pc) };
+		const cpu_op_t *op = &cpu_optable[code[0]];
+		const unsigned len = cpu_op_length(op->mode);
+		for(unsigned k = 1; k < len; k++)
+			code[k] = ram_read(ram, pc + k);
+		if(!op->handler || (!checked && !lanes_checked_code(lanes, group, pc, code, len)))
+			break; 	// the caller stops the lanes or splits the group
+		checked = false;
+
+		lanes_vec_t taken = { 0 };
+		if(!lanes_vector(lanes, group, &m, code, &taken))
+		{
+			lanes_flush(lanes, group, pc, cycles, instructions);
+			cycles = instructions = 0;
+			for_each_lane(i, group)
+				lanes_scalar(lanes, i, op);
+			lanes->scalar_ops += __builtin_popcount(group);
+			lanes_code_written(lanes, group);
+
+			pc = lanes->PC[lead];
+			for_each_lane(i, group)
+				if(lanes->PC[i] != pc)
+					return;
+			slack = lanes_slack(lanes, group, deadline);
+			continue;
+		}
+
+		cycles += op->cycles;
+		instructions++;
+		if(op->mode != AM_REL)
+		{
+			pc += len;
+			continue;
+		}
+
+		const word next = pc + 2, target = next + (int8_t) code[1];
+		const unsigned penalty = 1 + ((next ^ target) > 0xFF);
+		bool any = false, all = true;
+		for_each_lane(i, group)
+		{
+			any |= taken[i] != 0;
+			all &= taken[i] != 0;
+		}
+		if(all)
+		{
+			cycles += penalty;
+			pc = target;
+		}
+		else if(any)
+		{
+			// the lanes part ways here
+			lanes_flush(lanes, group, next, cycles, instructions);
+			for_each_lane(i, group)
+				if(taken[i])
+				{
+					lanes->PC[i] = target;
+					lanes->cycles[i] += penalty;
+				}
+			return;
+		}
+		else
+			pc = next;
+	}
+	lanes_flush(lanes, group, pc, cycles, instructions);
+}
+
+unsigned lanes_run(lanes_t *lanes, uint64_t cycles)
+{
+	uint64_t deadline[LANES_MAX];
+	for_each_lane(i, lanes->running)
+		deadline[i] = lanes->cycles[i] + cycles < lanes->cycles[i] ? UINT64_MAX : lanes->cycles[i] + cycles;
+
+	// memory may have been written from outside since the last run
+	lanes->epoch++;
+	uint32_t live = lanes->running;
+	for(;;)
+	{
+		// lanes that used up their budget sit out, the leader is the
+		// lowest PC left, the lowest lane on ties
+		unsigned lead = LANES_MAX;
+		for_each_lane(i, live)
+			if(lanes->cycles[i] >= deadline[i])
+				live &= ~(UINT32_C(1) << i);
+			else if(lead == LANES_MAX || lanes->PC[i] < lanes->PC[lead])
+				lead = i;
+		if(!live)
+			break;
+
+		const word pc = lanes->PC[lead];
+		byte code[3] = { ram_read(&lanes->ram[lead], pc) };
+		const cpu_op_t *op = &cpu_optable[code[0]];
+		const unsigned len = cpu_op_length(op->mode);
+		for(unsigned k = 1; k < len; k++)
+			code[k] = ram_read(&lanes->ram[lead], pc + k);
+
+		uint32_t group = 0;
+		for_each_lane(i, live)
+			if(lanes->PC[i] == pc && lanes_same_code(lanes, UINT32_C(1) << i, pc, code, len))
+				group |= UINT32_C(1) << i;
+
+		if(!op->handler)
+		{
+			for_each_lane(i, group)
+				lanes->stops[i] = code[0] == INS_KIL ? CPU_STOP_KIL : CPU_STOP_ILLEGAL;
+			lanes->running &= ~group;
+			live &= ~group;
+			continue;
+		}
+		lanes_lockstep(lanes, group, deadline);
+	}
+	return __builtin_popcount(lanes->running);
+}
+
+cpu_stop_t lanes_stop_reason(const lanes_t *lanes, unsigned lane)
+{
+	return lanes->stops[lane];
+}
+
+void lanes_resume(lanes_t *lanes, unsigned lane)
+{
+	lanes->stops[lane] = CPU_STOP_BUDGET;
+	lanes->running |= UINT32_C(1) << lane;
+}
+
+void lanes_stats(const lanes_t *lanes, uint64_t *vector, uint64_t *scalar)
+{
+	*vector = lanes->vector_ops;
+	*scalar = lanes->scalar_ops;
+}
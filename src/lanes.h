@@ -0,0 +1,73 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpu6502.h"
+#include "ram.h"
+
+/*
+ *
+ * Many-machines core
+ *
+ * Runs up to LANES_MAX copies of one program side by side, for fuzzing
+ * and parameter sweeps where only the inputs differ. Every lane is a
+ * full machine with its own registers and its own RAM, but the
+ * registers are kept as a structure of arrays, one vector per register
+ * across all lanes.
+ *
+ * Lanes that sit at the same PC with the same code there form a group
+ * and run the instruction together: register, flag, immediate, branch
+ * and plain zero page or absolute loads and stores are done on whole
+ * vectors, the rest runs through the scalar handlers one lane at a
+ * time. When lanes diverge, the group with the lowest PC runs first,
+ * which lets lanes that left a loop early wait at its exit for the
+ * others and run together again from there.
+ *
+ * Every lane gives the same results as a cpu6502_t run on its own with
+ * the same budget. Interrupt lines, breakpoints and the block cache are
+ * not modelled, and code is expected to be in plain memory.
+ *
+ * */
+
+#define LANES_MAX 	32
+
+typedef struct lanes lanes_t;
+
+// `n` lanes, 1 to LANES_MAX, with zeroed memory from the heap or from
+// `arena` when it is not NULL. Returns NULL on failure.
+lanes_t *lanes_create(unsigned n, ram_arena_t *arena);
+void lanes_destroy(lanes_t *lanes);
+
+unsigned lanes_count(const lanes_t *lanes);
+
+// Memory of one lane, to write its inputs or read its results
+ram_t *lanes_ram(lanes_t *lanes, unsigned lane);
+
+// Copy the own memory of `image` into every lane and put every lane in
+// the state cpu_reset and the reset sequence leave a CPU in, at the
+// address in RESET_VECTOR. Device mappings of `image` are not copied.
+void lanes_reset(lanes_t *lanes, const ram_t *image);
+
+// Registers and counters of one lane as a scalar CPU, and back. Set
+// ignores the interrupt lines, breakpoints and the block cache.
+void lanes_get(const lanes_t *lanes, unsigned lane, cpu6502_t *cpu);
+void lanes_set(lanes_t *lanes, unsigned lane, const cpu6502_t *cpu);
+
+// Run every lane for `cycles` more cycles, with the same overshoot as
+// cpu_run, or until it stops on KIL or an illegal opcode. A lane that
+// stopped stays stopped. Returns how many lanes are still running.
+unsigned lanes_run(lanes_t *lanes, uint64_t cycles);
+
+// CPU_STOP_BUDGET while the lane is running, else why it stopped
+cpu_stop_t lanes_stop_reason(const lanes_t *lanes, unsigned lane);
+
+// Let a stopped lane run again in the next lanes_run
+void lanes_resume(lanes_t *lanes, unsigned lane);
+
+// Instructions run so far on whole vectors and one lane at a time,
+// counted per lane, to tell how well the lanes stay together
+void lanes_stats(const lanes_t *lanes, uint64_t *vector, uint64_t *scalar);
+
+#endif
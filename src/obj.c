@@ -0,0 +1,612 @@
+#include "obj.h"
+#include "ram.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static inline word get_word(const byte *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_dword(const byte *p)
+{
+	return get_word(p) | ((uint32_t) get_word(p + 2) << 16);
+}
+
+static inline void put_word(byte *p, word w)
+{
+	p[0] = w & 0xFF;
+	p[1] = w >> 8;
+}
+
+static inline void put_dword(byte *p, uint32_t d)
+{
+	put_word(p, d & 0xFFFF);
+	put_word(p + 2, d >> 16);
+}
+
+static unsigned obj_reloc_width(byte kind)
+{
+	return kind == OBJ_R_WORD ? 2 : 1;
+}
+
+int obj_parse(const byte *image, size_t len, obj_file *obj)
+{
+	*obj = (obj_file) { 0 };
+	if(len < OBJ_HEADER_SIZE || image[0] != 'E' || image[1] != 'O' || image[2] != OBJ_VERSION)
+		return -1;
+	if(ef_checksum(image + OBJ_HEADER_SIZE, len - OBJ_HEADER_SIZE) != get_dword(image + 16))
+		return -1;
+
+	obj->obj_flags = image[3];
+	obj->obj_entry = get_word(image + 4);
+	obj->obj_entry_section = image[6];
+	obj->obj_nsegs = get_word(image + 8);
+	obj->obj_nsyms = get_word(image + 10);
+	obj->obj_nrelocs = get_dword(image + 12);
+	if(!obj->obj_nsegs || obj->obj_entry_section > OBJ_TEXT)
+		return -1;
+
+	size_t off = OBJ_HEADER_SIZE;
+	if((size_t) obj->obj_nsegs * EF_V2_SEGMENT_SIZE > len - off)
+		return -1;
+	if(obj->obj_nrelocs > (len - off) / OBJ_RELOC_SIZE)
+		return -1;
+
+	obj->obj_segs = calloc(obj->obj_nsegs, sizeof *obj->obj_segs);
+	obj->obj_syms = calloc(obj->obj_nsyms + 1, sizeof *obj->obj_syms);
+	obj->obj_relocs = calloc(obj->obj_nrelocs + 1, sizeof *obj->obj_relocs);
+	if(!obj->obj_segs || !obj->obj_syms || !obj->obj_relocs)
+		goto invalid;
+
+	for(word i = 0; i < obj->obj_nsegs; i++, off += EF_V2_SEGMENT_SIZE)
+	{
+		ef_segment *seg = &obj->obj_segs[i];
+		seg->addr = get_word(image + off);
+		seg->len = get_word(image + off + 2);
+		const uint32_t data = get_dword(image + off + 4);
+		if(data > len || seg->len > len - data || seg->addr + seg->len > MEM_SIZE)
+			goto invalid;
+		seg->data = image + data;
+	}
+
+	for(word i = 0; i < obj->obj_nsyms; i++)
+	{
+		obj_symbol *sym = &obj->obj_syms[i];
+		if(len - off < OBJ_SYMBOL_SIZE)
+			goto invalid;
+		sym->value = get_word(image + off);
+		sym->section = image[off + 2];
+		sym->flags = image[off + 3];
+		sym->len = image[off + 4];
+		off += OBJ_SYMBOL_SIZE;
+		if(len - off < sym->len || sym->section > OBJ_EXTERN)
+			goto invalid;
+		sym->name = (const char*) image + off;
+		off += sym->len;
+	}
+
+	if((size_t) obj->obj_nrelocs * OBJ_RELOC_SIZE > len - off)
+		goto invalid;
+	for(uint32_t i = 0; i < obj->obj_nrelocs; i++, off += OBJ_RELOC_SIZE)
+	{
+		obj_reloc *rel = &obj->obj_relocs[i];
+		rel->seg = get_word(image + off);
+		rel->offset = get_word(image + off + 2);
+		rel->kind = image[off + 4];
+		rel->section = image[off + 5];
+		rel->sym = get_word(image + off + 6);
+		rel->addend = (int32_t) get_dword(image + off + 8);
+		rel->line = get_dword(image + off + 12);
+		if(rel->seg >= obj->obj_nsegs || rel->kind > OBJ_R_BRANCH || rel->section > OBJ_EXTERN
+			|| rel->offset + obj_reloc_width(rel->kind) > obj->obj_segs[rel->seg].len
+			|| (rel->section == OBJ_EXTERN && rel->sym >= obj->obj_nsyms))
+			goto invalid;
+	}
+	return 0;
+
+invalid:
+	obj_free(obj);
+	return -1;
+}
+
+void obj_free(obj_file *obj)
+{
+	free(obj->obj_segs);
+	free(obj->obj_syms);
+	free(obj->obj_relocs);
+	*obj = (obj_file) { 0 };
+}
+
+byte *obj_build(const obj_file *obj, size_t *len)
+{
+	size_t size = OBJ_HEADER_SIZE + (size_t) obj->obj_nsegs * EF_V2_SEGMENT_SIZE
+		+ (size_t) obj->obj_nrelocs * OBJ_RELOC_SIZE;
+	for(word i = 0; i < obj->obj_nsyms; i++)
+		size += OBJ_SYMBOL_SIZE + obj->obj_syms[i].len;
+	size_t payload = size;
+	for(word i = 0; i < obj->obj_nsegs; i++)
+		size += obj->obj_segs[i].len;
+
+	byte *image = malloc(size);
+	if(!image)
+		return NULL;
+
+	image[0] = 'E';
+	image[1] = 'O';
+	image[2] = OBJ_VERSION;
+	image[3] = obj->obj_flags;
+	put_word(image + 4, obj->obj_entry);
+	image[6] = obj->obj_entry_section;
+	image[7] = 0;
+	put_word(image + 8, obj->obj_nsegs);
+	put_word(image + 10, obj->obj_nsyms);
+	put_dword(image + 12, obj->obj_nrelocs);
+
+	byte *p = image + OBJ_HEADER_SIZE;
+	for(word i = 0; i < obj->obj_nsegs; i++, p += EF_V2_SEGMENT_SIZE)
+	{
+		const ef_segment *seg = &obj->obj_segs[i];
+		put_word(p, seg->addr);
+		put_word(p + 2, seg->len);
+		put_dword(p + 4, payload);
+		memcpy(image + payload, seg->data, seg->len);
+		payload += seg->len;
+	}
+	for(word i = 0; i < obj->obj_nsyms; i++)
+	{
+		const obj_symbol *sym = &obj->obj_syms[i];
+		put_word(p, sym->value);
+		p[2] = sym->section;
+		p[3] = sym->flags;
+		p[4] = sym->len;
+		memcpy(p + OBJ_SYMBOL_SIZE, sym->name, sym->len);
+		p += OBJ_SYMBOL_SIZE + sym->len;
+	}
+	for(uint32_t i = 0; i < obj->obj_nrelocs; i++, p += OBJ_RELOC_SIZE)
+	{
+		const obj_reloc *rel = &obj->obj_relocs[i];
+		put_word(p, rel->seg);
+		put_word(p + 2, rel->offset);
+		p[4] = rel->kind;
+		p[5] = rel->section;
+		put_word(p + 6, rel->sym);
+		put_dword(p + 8, (uint32_t) rel->addend);
+		put_dword(p + 12, rel->line);
+	}
+
+	put_dword(image + 16, ef_checksum(image + OBJ_HEADER_SIZE, size - OBJ_HEADER_SIZE));
+	*len = size;
+	return image;
+}
+
+/*
+ * Linker
+ */
+
+typedef struct obj_global
+{
+	const obj_symbol *sym;
+	word value;
+	size_t unit;
+} obj_global_t;
+
+typedef struct obj_linker
+{
+	const obj_file *objs;
+	size_t n;
+	asm_error_t *err;
+
+	byte *image; 				// MEM_SIZE bytes, the output segments point into it
+	byte used[MEM_SIZE / 8]; 	// bit per address taken by a segment
+	word *text; 				// load address of every unit's text section
+
+	obj_global_t *globals; 		// sorted by name
+	size_t nglobals;
+} obj_linker_t;
+
+static int obj_fail(obj_linker_t *ln, size_t unit, unsigned line, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	ln->err->unit = unit;
+	ln->err->line = line;
+	vsnprintf(ln->err->msg, sizeof ln->err->msg, fmt, ap);
+	va_end(ap);
+	return -1;
+}
+
+// First taken address in [addr, addr + len), or -1 if they are all free
+static long obj_first_used(const obj_linker_t *ln, uint32_t addr, uint32_t len)
+{
+	for(uint32_t a = addr; a < addr + len; a++)
+		if(ln->used[a / 8] & (1 << a % 8))
+			return a;
+	return -1;
+}
+
+static void obj_place(obj_linker_t *ln, uint32_t addr, const ef_segment *seg)
+{
+	memcpy(ln->image + addr, seg->data, seg->len);
+	for(uint32_t a = addr; a < addr + seg->len; a++)
+		ln->used[a / 8] |= 1 << a % 8;
+}
+
+static int obj_place_sections(obj_linker_t *ln)
+{
+	for(size_t u = 0; u < ln->n; u++)
+		for(word s = 1; s < ln->objs[u].obj_nsegs; s++)
+		{
+			const ef_segment *seg = &ln->objs[u].obj_segs[s];
+			const long taken = obj_first_used(ln, seg->addr, seg->len);
+			if(taken >= 0)
+				return obj_fail(ln, u, 0, "code at $%04lx overlaps an earlier object", taken);
+			obj_place(ln, seg->addr, seg);
+		}
+
+	// Text sections go in unit order, each past the last one and past
+	// any absolute segment in its way
+	uint32_t next = OBJ_TEXT_BASE;
+	for(size_t u = 0; u < ln->n; u++)
+	{
+		const ef_segment *seg = &ln->objs[u].obj_segs[0];
+		if(!seg->len)
+			continue;
+		long taken;
+		while(next + seg->len <= MEM_SIZE && (taken = obj_first_used(ln, next, seg->len)) >= 0)
+			next = taken + 1;
+		if(next + seg->len > MEM_SIZE)
+			return obj_fail(ln, u, 0, "no room for %u bytes of code", seg->len);
+		ln->text[u] = next;
+		obj_place(ln, next, seg);
+		next += seg->len;
+	}
+	return 0;
+}
+
+static word obj_resolve(const obj_linker_t *ln, size_t unit, const obj_symbol *sym)
+{
+	return sym->value + (sym->section == OBJ_TEXT ? ln->text[unit] : 0);
+}
+
+static int obj_name_cmp(const obj_symbol *a, const obj_symbol *b)
+{
+	const int cmp = memcmp(a->name, b->name, a->len < b->len ? a->len : b->len);
+	return cmp ? cmp : a->len - b->len;
+}
+
+static int obj_global_cmp(const void *a, const void *b)
+{
+	return obj_name_cmp(((const obj_global_t*) a)->sym, ((const obj_global_t*) b)->sym);
+}
+
+static int obj_collect_globals(obj_linker_t *ln)
+{
+	size_t count = 0;
+	for(size_t u = 0; u < ln->n; u++)
+		count += ln->objs[u].obj_nsyms;
+	ln->globals = malloc((count + 1) * sizeof *ln->globals);
+	if(!ln->globals)
+		return obj_fail(ln, 0, 0, "out of memory");
+
+	for(size_t u = 0; u < ln->n; u++)
+		for(word i = 0; i < ln->objs[u].obj_nsyms; i++)
+		{
+			const obj_symbol *sym = &ln->objs[u].obj_syms[i];
+			if((sym->flags & OBJ_GLOBAL) && sym->section != OBJ_EXTERN)
+				ln->globals[ln->nglobals++] = (obj_global_t) { sym, obj_resolve(ln, u, sym), u };
+		}
+
+	qsort(ln->globals, ln->nglobals, sizeof *ln->globals, obj_global_cmp);
+	for(size_t i = 1; i < ln->nglobals; i++)
+		if(obj_global_cmp(&ln->globals[i - 1], &ln->globals[i]) == 0)
+		{
+			const obj_global_t *dup = ln->globals[i - 1].unit > ln->globals[i].unit
+				? &ln->globals[i - 1] : &ln->globals[i];
+			return obj_fail(ln, dup->unit, 0, "global '%.*s' is already defined by another object",
+					dup->sym->len, dup->sym->name);
+		}
+	return 0;
+}
+
+static int obj_relocate(obj_linker_t *ln, size_t unit, const obj_reloc *rel)
+{
+	const obj_file *obj = &ln->objs[unit];
+	long target = rel->addend;
+	if(rel->section == OBJ_TEXT)
+		target += ln->text[unit];
+	else if(rel->section == OBJ_EXTERN)
+	{
+		const obj_global_t key = { &obj->obj_syms[rel->sym], 0, 0 };
+		const obj_global_t *def = bsearch(&key, ln->globals, ln->nglobals, sizeof *ln->globals, obj_global_cmp);
+		if(!def)
+			return obj_fail(ln, unit, rel->line, "undefined symbol '%.*s'", key.sym->len, key.sym->name);
+		target += def->value;
+	}
+
+	const word addr = rel->offset + (rel->seg ? obj->obj_segs[rel->seg].addr : ln->text[unit]);
+	byte *p = ln->image + addr;
+	switch(rel->kind)
+	{
+	case OBJ_R_WORD:
+		if(target < 0 || target > MEM_MAX)
+			return obj_fail(ln, unit, rel->line, "address out of range");
+		put_word(p, target);
+		break;
+	case OBJ_R_BYTE:
+		if(target < 0 || target > 0xFF)
+			return obj_fail(ln, unit, rel->line, "$%04lx does not fit a byte", target & 0xFFFF);
+		*p = target;
+		break;
+	case OBJ_R_LOW:
+		*p = target & 0xFF;
+		break;
+	case OBJ_R_HIGH:
+		*p = target >> 8 & 0xFF;
+		break;
+	case OBJ_R_BRANCH:
+	{
+		const long offset = target - (addr + 1);
+		if(offset < -128 || offset > 127)
+			return obj_fail(ln, unit, rel->line, "branch target $%04lx out of range", target & 0xFFFF);
+		*p = offset & 0xFF;
+		break;
+	}
+	}
+	return 0;
+}
+
+static byte *obj_output(obj_linker_t *ln, size_t *len)
+{
+	size_t nsegs = 0, nsyms = 0;
+	for(size_t u = 0; u < ln->n; u++)
+	{
+		nsegs += ln->objs[u].obj_nsegs;
+		for(word i = 0; i < ln->objs[u].obj_nsyms; i++)
+			nsyms += ln->objs[u].obj_syms[i].section != OBJ_EXTERN;
+	}
+	if(nsegs > 0xFFFF || nsyms > 0xFFFF)
+	{
+		obj_fail(ln, 0, 0, "more than 65535 %s", nsegs > 0xFFFF ? "segments" : "symbols");
+		return NULL;
+	}
+
+	ef_file hdr = { 0 };
+	hdr.ef_segs = malloc((nsegs + 1) * sizeof *hdr.ef_segs);
+	hdr.ef_syms = malloc((nsyms + 1) * sizeof *hdr.ef_syms);
+	if(!hdr.ef_segs || !hdr.ef_syms)
+	{
+		free(hdr.ef_segs);
+		free(hdr.ef_syms);
+		obj_fail(ln, 0, 0, "out of memory");
+		return NULL;
+	}
+
+	for(size_t u = 0; u < ln->n; u++)
+	{
+		const obj_file *obj = &ln->objs[u];
+		if(!(hdr.ef_flags & EF_HAS_ENTRY) && (obj->obj_flags & OBJ_HAS_ENTRY))
+		{
+			hdr.ef_flags |= EF_HAS_ENTRY;
+			hdr.ef_entry = obj->obj_entry + (obj->obj_entry_section == OBJ_TEXT ? ln->text[u] : 0);
+		}
+
+		for(word s = 0; s < obj->obj_nsegs; s++)
+		{
+			const ef_segment *seg = &obj->obj_segs[s];
+			const word addr = s ? seg->addr : ln->text[u];
+			if(seg->len)
+				hdr.ef_segs[hdr.ef_nsegs++] = (ef_segment) { addr, seg->len, ln->image + addr };
+		}
+
+		for(word i = 0; i < obj->obj_nsyms; i++)
+		{
+			const obj_symbol *sym = &obj->obj_syms[i];
+			if(sym->section != OBJ_EXTERN)
+				hdr.ef_syms[hdr.ef_nsyms++] = (ef_symbol) { obj_resolve(ln, u, sym), sym->len, sym->name };
+		}
+	}
+
+	byte *ef = ef_build(&hdr, len);
+	if(!ef)
+		obj_fail(ln, 0, 0, "out of memory");
+	free(hdr.ef_segs);
+	free(hdr.ef_syms);
+	return ef;
+}
+
+byte *obj_link(const obj_file *objs, size_t n, size_t *len, asm_error_t *err)
+{
+	*err = (asm_error_t) { 0 };
+	obj_linker_t *ln = calloc(1, sizeof *ln);
+	if(!ln)
+	{
+		snprintf(err->msg, sizeof err->msg, "out of memory");
+		return NULL;
+	}
+	ln->objs = objs;
+	ln->n = n;
+	ln->err = err;
+	ln->image = malloc(MEM_SIZE);
+	ln->text = calloc(n + 1, sizeof *ln->text);
+
+	byte *ef = NULL;
+	if(!ln->image || !ln->text)
+		obj_fail(ln, 0, 0, "out of memory");
+	else if(obj_place_sections(ln) == 0 && obj_collect_globals(ln) == 0)
+	{
+		int ret = 0;
+		for(size_t u = 0; u < n && ret == 0; u++)
+			for(uint32_t r = 0; r < objs[u].obj_nrelocs && ret == 0; r++)
+				ret = obj_relocate(ln, u, &objs[u].obj_relocs[r]);
+		if(ret == 0)
+			ef = obj_output(ln, len);
+	}
+
+	free(ln->globals);
+	free(ln->text);
+	free(ln->image);
+	free(ln);
+	return ef;
+}
+
+/*
+ * Object cache
+ */
+
+uint64_t obj_key(const char *src, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325 ^ OBJ_VERSION;
+	for(size_t i = 0; i < len; i++)
+		h = (h ^ (byte) src[i]) * 0x100000001b3;
+	return h;
+}
+
+static char *obj_cache_path(const char *dir, uint64_t key)
+{
+	const size_t len = strlen(dir) + 1 + 16 + sizeof ".o";
+	char *path = malloc(len);
+	if(path)
+		snprintf(path, len, "%s/%016" PRIx64 ".o", dir, key);
+	return path;
+}
+
+byte *obj_cache_load(const char *dir, uint64_t key, size_t *len)
+{
+	char *path = obj_cache_path(dir, key);
+	const int fd = path ? open(path, O_RDONLY) : -1;
+	free(path);
+	if(fd < 0)
+		return NULL;
+
+	struct stat statbuf;
+	byte *obj = NULL;
+	if(fstat(fd, &statbuf) == 0 && statbuf.st_size > 0)
+		obj = malloc(statbuf.st_size);
+
+	size_t got = 0;
+	while(obj && got < (size_t) statbuf.st_size)
+	{
+		const ssize_t ret = read(fd, obj + got, statbuf.st_size - got);
+		if(ret <= 0)
+		{
+			free(obj);
+			obj = NULL;
+		}
+		else
+			got += ret;
+	}
+	close(fd);
+	*len = got;
+	return obj;
+}
+
+int obj_cache_store(const char *dir, uint64_t key, const byte *obj, size_t len)
+{
+	char *path = obj_cache_path(dir, key);
+	const size_t tmp_len = strlen(dir) + sizeof "/.tmp.XXXXXX";
+	char *tmp = malloc(tmp_len);
+	if(!path || !tmp)
+	{
+		free(path);
+		free(tmp);
+		return -1;
+	}
+	snprintf(tmp, tmp_len, "%s/.tmp.XXXXXX", dir);
+
+	int ret = -1;
+	const int fd = mkstemp(tmp);
+	if(fd >= 0)
+	{
+		size_t done = 0;
+		ssize_t put = 0;
+		while(done < len && (put = write(fd, obj + done, len - done)) > 0)
+			done += put;
+		if(close(fd) == 0 && done == len && rename(tmp, path) == 0)
+			ret = 0;
+		else
+			unlink(tmp);
+	}
+	free(tmp);
+	free(path);
+	return ret;
+}
+
+byte *obj_cache_object(const char *dir, const char *src, size_t len, size_t *out_len,
+		asm_error_t *err, bool *hit)
+{
+	const uint64_t key = obj_key(src, len);
+	byte *obj = obj_cache_load(dir, key, out_len);
+	obj_file check;
+	*hit = obj && obj_parse(obj, *out_len, &check) == 0;
+	if(*hit)
+	{
+		obj_free(&check);
+		*err = (asm_error_t) { 0 };
+		return obj;
+	}
+	free(obj);
+
+	obj = asm_object(src, len, out_len, err);
+	if(obj)
+		obj_cache_store(dir, key, obj, *out_len);
+	return obj;
+}
+
+/*
+ * Source files
+ */
+
+char *obj_read_source(const char *fname, size_t *len)
+{
+	FILE *fp = fopen(fname, "rb");
+	if(!fp)
+		return NULL;
+
+	size_t cap = 4096;
+	char *buf = malloc(cap);
+	*len = 0;
+	size_t got;
+	while(buf && (got = fread(buf + *len, 1, cap - *len, fp)) > 0)
+	{
+		*len += got;
+		if(*len == cap)
+		{
+			char *grown = realloc(buf, cap *= 2);
+			if(!grown)
+				free(buf);
+			buf = grown;
+		}
+	}
+	if(buf && ferror(fp))
+	{
+		free(buf);
+		buf = NULL;
+		errno = EIO;
+	}
+	fclose(fp);
+	return buf;
+}
+
+char *obj_output_name(const char *src)
+{
+	const char *slash = strrchr(src, '/');
+	const char *dot = strrchr(src, '.');
+	const size_t stem = dot && (!slash || dot > slash) ? (size_t) (dot - src) : strlen(src);
+	char *out = malloc(stem + 4);
+	if(out)
+	{
+		memcpy(out, src, stem);
+		strcpy(out + stem, ".ef");
+	}
+	return out;
+}
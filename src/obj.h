@@ -0,0 +1,161 @@
+#ifndef OBJ_H
+#define OBJ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "asm.h"
+#include "bytes.h"
+#include "ef.h"
+
+/*
+ *
+ * Relocatable objects
+ *
+ * asm_object turns one source file, a translation unit, into an object:
+ * its code with the addresses that are not known yet left open, and a
+ * list of relocations that fill them in. obj_link places the objects of
+ * a program in memory, resolves the symbols they share and writes the
+ * EF image. A unit only depends on its own source, so objects can be
+ * cached by the contents of the source and only changed units have to
+ * be assembled again.
+ *
+ * Code before the first .org of a unit is its text section, which the
+ * linker places after the text of the units before it, from
+ * OBJ_TEXT_BASE up, around the absolute segments. Code after an .org
+ * stays where it is.
+ *
+ * Layout, all numbers little endian
+ * 	offset 0 	'E' 'O'
+ * 	offset 2 	version, OBJ_VERSION
+ * 	offset 3 	flags, OBJ_HAS_ENTRY
+ * 	offset 4 	entry point, 16-bit
+ * 	offset 6 	section of the entry point, 8-bit, then a zero byte
+ * 	offset 8 	number of segments, 16-bit, at least 1
+ * 	offset 10 	number of symbols, 16-bit
+ * 	offset 12 	number of relocations, 32-bit
+ * 	offset 16 	checksum of bytes [20, end of file), FNV-1a 32-bit
+ * 	offset 20 	segment table as in EF v2, segment 0 is the text section
+ * 				and its load address is 0
+ * 	then 		symbol table, per symbol:
+ * 					value 16-bit, section 8-bit, flags 8-bit,
+ * 					name length 8-bit, name bytes
+ * 	then 		relocation table, per relocation:
+ * 					segment 16-bit, offset in the segment 16-bit,
+ * 					kind 8-bit, section of the target 8-bit, symbol
+ * 					16-bit, addend 32-bit signed, source line 32-bit
+ * 	then 		segment payloads
+ *
+ * */
+
+#define OBJ_VERSION 		2 	// bump when the assembler output changes, it keys the cache
+#define OBJ_HEADER_SIZE 	20
+#define OBJ_SYMBOL_SIZE 	5
+#define OBJ_RELOC_SIZE 		16
+#define OBJ_TEXT_BASE 		EF_V1_LOAD
+
+// flags
+#define OBJ_HAS_ENTRY 		0x01
+
+// Sections of symbols, relocation targets and the entry point
+#define OBJ_ABSOLUTE 		0
+#define OBJ_TEXT 			1 	// relative to the unit's text section
+#define OBJ_EXTERN 			2 	// defined by another unit, symbols and relocations only
+
+// Symbol flags
+#define OBJ_GLOBAL 			0x01 	// other units may use it
+
+// Relocation kinds: what is written at the offset
+#define OBJ_R_WORD 			0 	// the address
+#define OBJ_R_BYTE 			1 	// the value, which has to fit a byte
+#define OBJ_R_LOW 			2 	// the low byte
+#define OBJ_R_HIGH 			3 	// the high byte
+#define OBJ_R_BRANCH 		4 	// a branch offset to the address, from after the byte
+
+typedef struct
+{
+	word 		value;
+	byte 		section;
+	byte 		flags;
+	byte 		len;
+	const char 	*name; 		// not NUL terminated, points into the image
+} obj_symbol;
+
+typedef struct
+{
+	word 		seg;
+	word 		offset;
+	byte 		kind;
+	byte 		section; 	// target is the addend, in this section
+	word 		sym; 		// the symbol, for OBJ_EXTERN
+	int32_t 	addend;
+	uint32_t 	line; 		// for error messages
+} obj_reloc;
+
+typedef struct
+{
+	byte 		obj_flags;
+	byte 		obj_entry_section;
+	word 		obj_entry;
+
+	word 		obj_nsegs;
+	ef_segment 	*obj_segs; 	// [0] is the text section
+	word 		obj_nsyms;
+	obj_symbol 	*obj_syms;
+	uint32_t 	obj_nrelocs;
+	obj_reloc 	*obj_relocs;
+} obj_file;
+
+// Validate an object image and point obj into it. The image is not
+// copied and has to outlive obj. Returns 0 on success, -1 if the image
+// is not a valid object or on allocation failure.
+int obj_parse(const byte *image, size_t len, obj_file *obj);
+void obj_free(obj_file *obj);
+
+// Encode obj. Returns a malloc'd image of *len bytes, or NULL on
+// allocation failure.
+byte *obj_build(const obj_file *obj, size_t *len);
+
+// Link `n` objects into an EF v2 image. The entry point is the first
+// one an object has, and every symbol defined by any object goes to
+// the symbol table. Returns a malloc'd image of *len bytes, or NULL
+// with the reason in *err, err->unit being the index of the object.
+byte *obj_link(const obj_file *objs, size_t n, size_t *len, asm_error_t *err);
+
+/*
+ * Object cache
+ *
+ * A directory of objects named after obj_key of their source. Entries
+ * are written to a temporary file and renamed into place, so several
+ * processes or threads may share a directory.
+ */
+
+uint64_t obj_key(const char *src, size_t len);
+
+// The malloc'd object stored for `key`, or NULL if there is none. The
+// contents are not validated, run obj_parse on them.
+byte *obj_cache_load(const char *dir, uint64_t key, size_t *len);
+
+// Returns 0 on success, -1 on failure
+int obj_cache_store(const char *dir, uint64_t key, const byte *obj, size_t len);
+
+// asm_object through the cache: the stored object of the source if
+// there is a valid one, else a new one, which is then stored. *hit
+// tells which. Failing to store is not an error. Safe to call from
+// several threads at once.
+byte *obj_cache_object(const char *dir, const char *src, size_t len, size_t *out_len,
+		asm_error_t *err, bool *hit);
+
+/*
+ * Source files, for the assembler front ends
+ */
+
+// The malloc'd contents of `fname`, or NULL with errno set
+char *obj_read_source(const char *fname, size_t *len);
+
+// `src` with its extension replaced by .ef, malloc'd, NULL on
+// allocation failure
+char *obj_output_name(const char *src);
+
+#endif
@@ -0,0 +1,229 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+// Indices [lo, hi) not yet taken by anybody
+typedef struct pool_range
+{
+	pthread_mutex_t lock;
+	size_t lo, hi;
+} pool_range_t;
+
+struct pool
+{
+	unsigned nthreads;
+	pthread_t *threads;
+	pool_range_t *ranges; 	// one per worker
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned long generation;
+	unsigned active; 		// workers still busy in this run
+	bool quit;
+
+	pool_fn_t fn;
+	void *arg;
+};
+
+typedef struct pool_worker
+{
+	pool_t *pool;
+	unsigned index;
+} pool_worker_t;
+
+static _Thread_local unsigned worker_index;
+
+unsigned pool_worker_index(void)
+{
+	return worker_index;
+}
+
+static bool pool_take(pool_t *pool, unsigned self, size_t *index)
+{
+	pool_range_t *own = &pool->ranges[self];
+
+	pthread_mutex_lock(&own->lock);
+	if(own->lo < own->hi)
+	{
+		*index = own->lo++;
+		pthread_mutex_unlock(&own->lock);
+		return true;
+	}
+	pthread_mutex_unlock(&own->lock);
+
+	// own range is empty, steal the back half of somebody else's
+	for(unsigned k = 1; k < pool->nthreads; k++)
+	{
+		pool_range_t *victim = &pool->ranges[(self + k) % pool->nthreads];
+
+		pthread_mutex_lock(&victim->lock);
+		size_t left = victim->hi - victim->lo;
+		if(left == 0)
+		{
+			pthread_mutex_unlock(&victim->lock);
+			continue;
+		}
+		size_t hi = victim->hi;
+		size_t lo = hi - (left + 1) / 2;
+		victim->hi = lo;
+		pthread_mutex_unlock(&victim->lock);
+
+		pthread_mutex_lock(&own->lock);
+		own->lo = lo + 1;
+		own->hi = hi;
+		pthread_mutex_unlock(&own->lock);
+
+		*index = lo;
+		return true;
+	}
+	return false;
+}
+
+static void pool_work(pool_t *pool, unsigned self)
+{
+	size_t index;
+	while(pool_take(pool, self, &index))
+		pool->fn(pool->arg, index);
+}
+
+static void *pool_thread(void *arg)
+{
+	pool_worker_t *worker = arg;
+	pool_t *pool = worker->pool;
+	unsigned self = worker->index;
+	unsigned long seen = 0;
+	free(worker);
+
+	worker_index = self;
+	for(;;)
+	{
+		pthread_mutex_lock(&pool->lock);
+		while(!pool->quit && pool->generation == seen)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if(pool->quit)
+		{
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		pool_work(pool, self);
+
+		pthread_mutex_lock(&pool->lock);
+		if(--pool->active == 0)
+			pthread_cond_signal(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+pool_t *pool_create(unsigned nthreads)
+{
+	if(nthreads == 0)
+	{
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? (unsigned) ncpu : 1;
+	}
+
+	pool_t *pool = calloc(1, sizeof *pool);
+	if(!pool)
+		return NULL;
+
+	pool->nthreads = nthreads;
+	pool->threads = calloc(nthreads, sizeof *pool->threads);
+	pool->ranges = calloc(nthreads, sizeof *pool->ranges);
+	if(!pool->threads || !pool->ranges)
+	{
+		free(pool->threads);
+		free(pool->ranges);
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for(unsigned i = 0; i < nthreads; i++)
+		pthread_mutex_init(&pool->ranges[i].lock, NULL);
+
+	// worker 0 is the thread calling pool_run
+	for(unsigned i = 1; i < nthreads; i++)
+	{
+		pool_worker_t *worker = malloc(sizeof *worker);
+		if(worker)
+		{
+			worker->pool = pool;
+			worker->index = i;
+		}
+		if(!worker || pthread_create(&pool->threads[i], NULL, pool_thread, worker) != 0)
+		{
+			free(worker);
+			pool->nthreads = i;
+			break;
+		}
+	}
+	return pool;
+}
+
+void pool_destroy(pool_t *pool)
+{
+	if(!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for(unsigned i = 1; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	for(unsigned i = 0; i < pool->nthreads; i++)
+		pthread_mutex_destroy(&pool->ranges[i].lock);
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->ranges);
+	free(pool->threads);
+	free(pool);
+}
+
+unsigned pool_threads(const pool_t *pool)
+{
+	return pool->nthreads;
+}
+
+void pool_run(pool_t *pool, pool_fn_t fn, void *arg, size_t n)
+{
+	// split [0, n) evenly, the first n % nthreads workers get one extra
+	size_t share = n / pool->nthreads;
+	size_t extra = n % pool->nthreads;
+	size_t lo = 0;
+	for(unsigned i = 0; i < pool->nthreads; i++)
+	{
+		size_t len = share + (i < extra ? 1 : 0);
+		pool->ranges[i].lo = lo;
+		pool->ranges[i].hi = lo + len;
+		lo += len;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->active = pool->nthreads - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	worker_index = 0;
+	pool_work(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while(pool->active > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,33 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+ *
+ * Work-stealing thread pool
+ *
+ * pool_run(fn, arg, n) calls fn(arg, i) once for every i in [0, n) and
+ * returns when all calls are done. The index range is split evenly
+ * between the workers; a worker that runs dry steals the back half of
+ * another worker's remaining range. The calling thread takes part as
+ * worker 0, and the worker threads are kept alive between runs.
+ *
+ * */
+
+typedef void (*pool_fn_t)(void *arg, size_t index);
+
+typedef struct pool pool_t;
+
+// nthreads == 0 uses one thread per online CPU. Returns NULL on failure.
+pool_t *pool_create(unsigned nthreads);
+void pool_destroy(pool_t *pool);
+
+unsigned pool_threads(const pool_t *pool);
+
+// index of the calling worker inside fn, in [0, pool_threads())
+unsigned pool_worker_index(void);
+
+void pool_run(pool_t *pool, pool_fn_t fn, void *arg, size_t n);
+
+#endif
@@ -1,27 +1,265 @@
 #include "ram.h"
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
-void ram_init(ram_t *r)
+int ram_arena_init(ram_arena_t *arena, size_t slots)
 {
-	r->data = malloc(MEM_MAX * sizeof(byte));
-	for(word i = 0; i < MEM_MAX; i++)
-		r->data[i] = 0x0;
+	arena->base = mmap(NULL, slots * MEM_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(arena->base == MAP_FAILED)
+		return -1;
+
+	arena->free_list = malloc(slots * sizeof *arena->free_list);
+	if(!arena->free_list)
+	{
+		munmap(arena->base, slots * MEM_SIZE);
+		return -1;
+	}
+
+	arena->slots = slots;
+	arena->n_free = slots;
+	for(size_t i = 0; i < slots; i++)
+		arena->free_list[i] = slots - 1 - i;
+	pthread_mutex_init(&arena->lock, NULL);
+	return 0;
+}
+
+void ram_arena_free(ram_arena_t *arena)
+{
+	munmap(arena->base, arena->slots * MEM_SIZE);
+	free(arena->free_list);
+	pthread_mutex_destroy(&arena->lock);
+}
+
+static byte *ram_arena_take(ram_arena_t *arena)
+{
+	byte *data = NULL;
+	pthread_mutex_lock(&arena->lock);
+	if(arena->n_free > 0)
+		data = arena->base + arena->free_list[--arena->n_free] * MEM_SIZE;
+	pthread_mutex_unlock(&arena->lock);
+	return data;
 }
 
-byte ram_read(ram_t *ram, word addr)
+static void ram_arena_give(ram_arena_t *arena, byte *data)
 {
-	if(addr >= 0 && addr <= MEM_MAX)
-		return ram->data[addr];
+	pthread_mutex_lock(&arena->lock);
+	arena->free_list[arena->n_free++] = (data - arena->base) / MEM_SIZE;
+	pthread_mutex_unlock(&arena->lock);
+}
+
+int ram_init(ram_t *r, ram_arena_t *arena)
+{
+	r->arena = NULL;
+	r->data = arena ? ram_arena_take(arena) : NULL;
+	if(r->data)
+		r->arena = arena;
+	else
+		r->data = calloc(MEM_SIZE, sizeof(byte));
+
+	if(!r->data)
+		return -1;
+	memset(r->flags, 0, sizeof r->flags);
+	memset(r->base, 0, sizeof r->base);
+	memset(r->gen, 0, sizeof r->gen);
+	r->code_gen = 0;
+	ram_unmap(r, 0, RAM_PAGES);
 	return 0;
 }
 
-void ram_write(ram_t *ram, word addr, byte data)
+static inline byte *ram_own_page(ram_t *ram, unsigned p)
+{
+	return ram->data + p * RAM_PAGE_SIZE;
+}
+
+static void ram_block_release(ram_block_t *block)
+{
+	if(block && atomic_fetch_sub(&block->refs, 1) == 1)
+		free(block);
+}
+
+// Catch the next write to an own page
+static void ram_page_trap(ram_t *ram, unsigned p, byte flag)
+{
+	if(ram->rd[p] == ram_own_page(ram, p))
+	{
+		ram->flags[p] |= flag;
+		ram->wr[p] = NULL;
+	}
+}
+
+static void ram_page_untrap(ram_t *ram, unsigned p, byte flag)
+{
+	if(ram->flags[p] & flag)
+	{
+		ram->flags[p] &= ~flag;
+		if(!(ram->flags[p] & RAM_PAGE_TRAPS))
+			ram->wr[p] = ram_own_page(ram, p);
+	}
+}
+
+// The own page no longer equals its snapshot block
+static void ram_page_dirty(ram_t *ram, unsigned p)
+{
+	ram_block_release(ram->base[p]);
+	ram->base[p] = NULL;
+	ram_page_untrap(ram, p, RAM_PAGE_SNAP);
+}
+
+// Code decoded from the page is stale
+static void ram_page_code_changed(ram_t *ram, unsigned p)
+{
+	ram->gen[p]++;
+	ram->code_gen++;
+	ram_page_untrap(ram, p, RAM_PAGE_CODE);
+}
+
+bool ram_watch_code(ram_t *ram, byte page)
+{
+	if(ram->rd[page] == ram_own_page(ram, page))
+	{
+		ram_page_trap(ram, page, RAM_PAGE_CODE);
+		return true;
+	}
+	return ram->rd[page] && !ram->wr[page]; 	// read-only memory never changes
+}
+
+void ram_touch(ram_t *ram, word addr, size_t len)
 {
-	if(addr >= 0 && addr <= MEM_MAX)
-		ram->data[addr] = data;
+	if(len == 0)
+		return;
+	size_t last = addr + len - 1;
+	if(last > MEM_MAX)
+		last = MEM_MAX;
+	for(unsigned p = addr >> 8; p <= last >> 8; p++)
+	{
+		ram_page_dirty(ram, p);
+		ram_page_code_changed(ram, p);
+	}
+}
+
+int ram_snapshot(ram_t *ram, ram_block_t *pages[RAM_PAGES])
+{
+	for(unsigned p = 0; p < RAM_PAGES; p++)
+	{
+		if(!ram->base[p])
+		{
+			ram_block_t *block = malloc(sizeof *block);
+			if(!block)
+			{
+				while(p--)
+					ram_block_release(pages[p]);
+				return -1;
+			}
+			atomic_init(&block->refs, 1); 	// held by ram->base
+			memcpy(block->bytes, ram_own_page(ram, p), RAM_PAGE_SIZE);
+			ram->base[p] = block;
+			ram_page_trap(ram, p, RAM_PAGE_SNAP);
+		}
+		atomic_fetch_add(&ram->base[p]->refs, 1);
+		pages[p] = ram->base[p];
+	}
+	return 0;
+}
+
+void ram_restore(ram_t *ram, ram_block_t *const pages[RAM_PAGES])
+{
+	for(unsigned p = 0; p < RAM_PAGES; p++)
+	{
+		if(ram->base[p] == pages[p])
+			continue; 	// untouched since it was taken
+
+		ram_touch(ram, p << 8, RAM_PAGE_SIZE);
+		memcpy(ram_own_page(ram, p), pages[p]->bytes, RAM_PAGE_SIZE);
+		atomic_fetch_add(&pages[p]->refs, 1);
+		ram->base[p] = pages[p];
+		ram_page_trap(ram, p, RAM_PAGE_SNAP);
+	}
+}
+
+void ram_snapshot_release(ram_block_t *pages[RAM_PAGES])
+{
+	for(unsigned p = 0; p < RAM_PAGES; p++)
+	{
+		ram_block_release(pages[p]);
+		pages[p] = NULL;
+	}
+}
+
+void ram_clear(ram_t *ram)
+{
+	ram_touch(ram, 0, MEM_SIZE);
+
+	// arena pages come back zeroed on next touch, untouched ones cost nothing
+	if(ram->arena && madvise(ram->data, MEM_SIZE, MADV_DONTNEED) == 0)
+		return;
+	memset(ram->data, 0, MEM_SIZE);
+}
+
+byte ram_read_slow(ram_t *ram, word addr)
+{
+	ram_device_t *dev = &ram->dev[addr >> 8];
+	if(dev->read)
+		return dev->read(dev->ctx, addr);
+	return 0;
+}
+
+void ram_write_slow(ram_t *ram, word addr, byte data)
+{
+	if(ram->flags[addr >> 8] & RAM_PAGE_TRAPS)
+	{
+		ram_touch(ram, addr, 1);
+		ram->wr[addr >> 8][addr & 0xFF] = data;
+		return;
+	}
+
+	ram_device_t *dev = &ram->dev[addr >> 8];
+	if(dev->write)
+		dev->write(dev->ctx, addr, data);
+}
+
+void ram_map_device(ram_t *ram, byte first, unsigned count,
+		ram_read_fn read, ram_write_fn write, void *ctx)
+{
+	for(unsigned p = first; p < first + count && p < RAM_PAGES; p++)
+	{
+		ram_touch(ram, p << 8, RAM_PAGE_SIZE);
+		ram->rd[p] = NULL;
+		ram->wr[p] = NULL;
+		ram->dev[p] = (ram_device_t) { read, write, ctx };
+	}
+}
+
+void ram_map_memory(ram_t *ram, byte first, unsigned count, byte *mem, int writable)
+{
+	for(unsigned p = first; p < first + count && p < RAM_PAGES; p++)
+	{
+		byte *page = mem + (p - first) * RAM_PAGE_SIZE;
+		ram_touch(ram, p << 8, RAM_PAGE_SIZE);
+		ram->rd[p] = page;
+		ram->wr[p] = writable ? page : NULL;
+		ram->dev[p] = (ram_device_t) { 0 };
+	}
+}
+
+void ram_unmap(ram_t *ram, byte first, unsigned count)
+{
+	ram_map_memory(ram, first, count, ram->data + first * RAM_PAGE_SIZE, 1);
 }
 
 void ram_free(ram_t *ram)
 {
-	free(ram->data);
+	for(unsigned p = 0; p < RAM_PAGES; p++)
+		ram_page_dirty(ram, p);
+
+	if(ram->arena)
+	{
+		ram_clear(ram); // the next user expects zeroed memory
+		ram_arena_give(ram->arena, ram->data);
+	}
+	else
+		free(ram->data);
+	ram->data = NULL;
 }
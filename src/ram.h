@@ -1,21 +1,155 @@
 #ifndef RAM_H
 #define RAM_H
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "bytes.h"
 
-#define MEM_MAX 0xFFFF
+#define MEM_MAX 	0xFFFF 		// highest address
+#define MEM_SIZE 	0x10000 	// bytes in the address space
+
+#define RAM_PAGE_SIZE 	0x100
+#define RAM_PAGES 		0x100
+
+/*
+ *
+ * 64 KiB address space behind a 256 entry page table
+ *
+ * Every 256 byte page has a read and a write pointer. For plain memory
+ * they point at the backing storage and an access costs one table
+ * lookup. A NULL pointer sends the access to the page's device
+ * callbacks instead, which is how memory-mapped I/O is attached.
+ *
+ * */
+
+// Device callbacks get the full 16 bit address
+typedef byte (*ram_read_fn)(void *ctx, word addr);
+typedef void (*ram_write_fn)(void *ctx, word addr, byte data);
+
+typedef struct ram_device
+{
+	ram_read_fn read; 		// NULL reads as 0
+	ram_write_fn write; 	// NULL ignores writes
+	void *ctx;
+} ram_device_t;
+
+/*
+ *
+ * Arena for many short-lived RAMs
+ *
+ * One anonymous mapping sliced into MEM_SIZE slots. Pages are zeroed
+ * lazily by the kernel, so creating an instance does not touch its
+ * 64 KiB, and slots are recycled through a free list instead of going
+ * back to malloc. Safe to share between threads.
+ *
+ * */
+typedef struct ram_arena
+{
+	byte *base;
+	size_t slots;
+	size_t *free_list; 		// stack of free slot indices
+	size_t n_free;
+	pthread_mutex_t lock;
+} ram_arena_t;
+
+// Returns 0 on success, -1 on failure
+int ram_arena_init(ram_arena_t *arena, size_t slots);
+void ram_arena_free(ram_arena_t *arena);
+
+// Immutable copy of one page, shared by snapshots through a reference count
+typedef struct ram_block
+{
+	_Atomic unsigned refs;
+	byte bytes[RAM_PAGE_SIZE];
+} ram_block_t;
+
+// page flags, a set flag removes the write pointer of an own page so the
+// first write goes through ram_write_slow
+#define RAM_PAGE_SNAP 	0x01 	// page equals its snapshot block
+#define RAM_PAGE_CODE 	0x02 	// page holds cached decoded code
+#define RAM_PAGE_TRAPS 	(RAM_PAGE_SNAP | RAM_PAGE_CODE)
 
 typedef struct ram
 {
-	byte *data;
-} ram_t;
+	byte *data; 				// own backing storage, MEM_SIZE bytes
+	ram_arena_t *arena; 		// arena data came from, or NULL
+	byte *rd[RAM_PAGES]; 		// read pointer per page, NULL -> dev
+	byte *wr[RAM_PAGES]; 		// write pointer per page, NULL -> dev
+	ram_device_t dev[RAM_PAGES];
 
-void ram_init(ram_t *r);
+	byte flags[RAM_PAGES];
+	ram_block_t *base[RAM_PAGES]; 	// snapshot block equal to the own page, NULL if dirty
+	uint32_t gen[RAM_PAGES]; 		// bumped when a RAM_PAGE_CODE page is written or remapped
+	uint32_t code_gen; 				// bumped together with any gen[]
+} ram_t;
 
-byte ram_read(ram_t *ram, word addr);
+// Allocate zeroed memory from the heap, or from `arena` when it is not
+// NULL and has a free slot. Returns 0 on success, -1 on failure.
+int ram_init(ram_t *r, ram_arena_t *arena);
 
-void ram_write(ram_t *ram, word addr, byte data);
+// Zero the memory in place, page mappings are kept
+void ram_clear(ram_t *ram);
 
 void ram_free(ram_t *ram);
 
+byte ram_read_slow(ram_t *ram, word addr);
+void ram_write_slow(ram_t *ram, word addr, byte data);
+
+static inline byte ram_read(ram_t *ram, word addr)
+{
+	byte *page = ram->rd[addr >> 8];
+	if(page)
+		return page[addr & 0xFF];
+	return ram_read_slow(ram, addr);
+}
+
+static inline void ram_write(ram_t *ram, word addr, byte data)
+{
+	byte *page = ram->wr[addr >> 8];
+	if(page)
+		page[addr & 0xFF] = data;
+	else
+		ram_write_slow(ram, addr, data);
+}
+
+// Route pages [first, first + count) to device callbacks
+void ram_map_device(ram_t *ram, byte first, unsigned count,
+		ram_read_fn read, ram_write_fn write, void *ctx);
+
+// Back pages [first, first + count) with external memory, e.g. a ROM
+// image (writable = 0) or a region shared between several machines
+void ram_map_memory(ram_t *ram, byte first, unsigned count, byte *mem, int writable);
+
+// Return pages [first, first + count) to the RAM's own storage
+void ram_unmap(ram_t *ram, byte first, unsigned count);
+
+// Must be called after writing [addr, addr + len) through ram->data
+// directly, so snapshots and cached code see the change
+void ram_touch(ram_t *ram, word addr, size_t len);
+
+// Bump gen[page] on the next write to it. Returns false if the page is
+// a device or writable external memory, which cannot be watched.
+bool ram_watch_code(ram_t *ram, byte page);
+
+/*
+ *
+ * Copy-on-write snapshots of the own storage
+ *
+ * A snapshot is one ram_block_t reference per page. Pages that were
+ * not written since the previous snapshot or restore share the block
+ * taken then, so a snapshot only copies the pages dirtied in between.
+ * Clean pages have their write pointer removed, and the first write
+ * to one goes through ram_write_slow, which marks it dirty and puts
+ * the pointer back. Pages mapped to devices or external memory are
+ * not part of the snapshot.
+ *
+ * */
+// Returns 0 on success, -1 on allocation failure
+int ram_snapshot(ram_t *ram, ram_block_t *pages[RAM_PAGES]);
+void ram_restore(ram_t *ram, ram_block_t *const pages[RAM_PAGES]);
+void ram_snapshot_release(ram_block_t *pages[RAM_PAGES]);
+
 #endif
@@ -0,0 +1,109 @@
+#include <stdlib.h>
+
+#include "sched.h"
+
+void sched_init(sched_t *sched)
+{
+	sched->heap = NULL;
+	sched->n = sched->cap = 0;
+	sched->next_id = 1;
+}
+
+void sched_free(sched_t *sched)
+{
+	free(sched->heap);
+	sched_init(sched);
+}
+
+void sched_clear(sched_t *sched)
+{
+	sched->n = 0;
+}
+
+static bool sched_before(const sched_event_t *a, const sched_event_t *b)
+{
+	return a->when < b->when || (a->when == b->when && a->id < b->id);
+}
+
+static void sched_swap(sched_t *sched, size_t i, size_t j)
+{
+	sched_event_t tmp = sched->heap[i];
+	sched->heap[i] = sched->heap[j];
+	sched->heap[j] = tmp;
+}
+
+static void sched_sift_up(sched_t *sched, size_t i)
+{
+	while(i && sched_before(&sched->heap[i], &sched->heap[(i - 1) / 2]))
+	{
+		sched_swap(sched, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void sched_sift_down(sched_t *sched, size_t i)
+{
+	for(;;)
+	{
+		size_t min = i, l = 2 * i + 1, r = l + 1;
+		if(l < sched->n && sched_before(&sched->heap[l], &sched->heap[min]))
+			min = l;
+		if(r < sched->n && sched_before(&sched->heap[r], &sched->heap[min]))
+			min = r;
+		if(min == i)
+			return;
+		sched_swap(sched, i, min);
+		i = min;
+	}
+}
+
+// Remove heap[i], keeping the heap ordered
+static void sched_remove(sched_t *sched, size_t i)
+{
+	sched->heap[i] = sched->heap[--sched->n];
+	if(i == sched->n)
+		return;
+	sched_sift_up(sched, i);
+	sched_sift_down(sched, i);
+}
+
+uint64_t sched_add(sched_t *sched, uint64_t when, sched_fn_t fn, void *ctx)
+{
+	if(sched->n == sched->cap)
+	{
+		size_t cap = sched->cap ? 2 * sched->cap : 16;
+		sched_event_t *heap = realloc(sched->heap, cap * sizeof *heap);
+		if(!heap)
+			return 0;
+		sched->heap = heap;
+		sched->cap = cap;
+	}
+
+	const uint64_t id = sched->next_id++;
+	sched->heap[sched->n] = (sched_event_t) { when, id, fn, ctx };
+	sched_sift_up(sched, sched->n++);
+	return id;
+}
+
+// A linear search, device counts are small
+bool sched_cancel(sched_t *sched, uint64_t id)
+{
+	for(size_t i = 0; i < sched->n; i++)
+		if(sched->heap[i].id == id)
+		{
+			sched_remove(sched, i);
+			return true;
+		}
+	return false;
+}
+
+void sched_dispatch(sched_t *sched, uint64_t now)
+{
+	while(sched->n && sched->heap[0].when <= now)
+	{
+		// off the heap before the call, so the callback sees a consistent one
+		sched_event_t ev = sched->heap[0];
+		sched_remove(sched, 0);
+		ev.fn(ev.ctx, ev.when);
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ *
+ * Event scheduler
+ *
+ * Devices that act at a point in time (timers, UARTs, video) schedule
+ * a callback for an absolute CPU cycle count instead of being polled
+ * after every instruction. The events sit in a binary min-heap keyed
+ * on that cycle count, so the run loop only has to know the earliest
+ * one. Events due at the same cycle run in the order they were added.
+ *
+ * */
+
+// `when` is the cycle the event was scheduled for, the CPU may already
+// be a few cycles past it. Periodic devices reschedule at when + period
+// to stay free of drift.
+typedef void (*sched_fn_t)(void *ctx, uint64_t when);
+
+typedef struct sched_event
+{
+	uint64_t when;
+	uint64_t id; 	// increasing, breaks ties and names the event for sched_cancel
+	sched_fn_t fn;
+	void *ctx;
+} sched_event_t;
+
+typedef struct sched
+{
+	sched_event_t *heap;
+	size_t n, cap;
+	uint64_t next_id;
+} sched_t;
+
+void sched_init(sched_t *sched);
+void sched_free(sched_t *sched);
+
+// Drop every event
+void sched_clear(sched_t *sched);
+
+// Returns the id of the new event, or 0 on allocation failure
+uint64_t sched_add(sched_t *sched, uint64_t when, sched_fn_t fn, void *ctx);
+
+// Returns false if the event already ran or was cancelled
+bool sched_cancel(sched_t *sched, uint64_t id);
+
+// Cycle of the earliest event, UINT64_MAX if there is none
+static inline uint64_t sched_next(const sched_t *sched)
+{
+	return sched->n ? sched->heap[0].when : UINT64_MAX;
+}
+
+// Run every event due at `now`. Callbacks may add and cancel events,
+// an event they add for `now` or earlier runs in the same call.
+void sched_dispatch(sched_t *sched, uint64_t now);
+
+#endif
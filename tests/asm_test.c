@@ -0,0 +1,120 @@
+#include "test.h"
+#include "ef.h"
+
+/*
+ * Entry point and segments of assembled programs
+ */
+
+// Entry point of `src`, -1 if it has none
+static long entry_of(const char *src)
+{
+	asm_error_t err;
+	size_t len;
+	byte *image = asm_assemble(src, strlen(src), &len, &err);
+	if(!image)
+	{
+		fprintf(stderr, "line %u: %s\n", err.line, err.msg);
+		return -2;
+	}
+	ef_file hdr;
+	long entry = -2;
+	if(ef_parse(image, len, "<test>", &hdr) == 0)
+	{
+		entry = hdr.ef_flags & EF_HAS_ENTRY ? hdr.ef_entry : -1;
+		free_ef(&hdr);
+	}
+	free(image);
+	return entry;
+}
+
+static void test_first_instruction(void)
+{
+	CHECK_EQ(entry_of("nop\nkil\n"), 0x1000);
+	CHECK_EQ(entry_of("[.org 0x2000]\nnop\n"), 0x2000);
+	// data before the code is not run
+	CHECK_EQ(entry_of("[.org 0x0010]\n[.byte 1, 2, 3]\n[.org 0x0200]\nlda #1\n"), 0x0200);
+	CHECK_EQ(entry_of("table: [.word 1, 2]\nstart: lda table\n"), 0x1004);
+	CHECK_EQ(entry_of("[.byte 1]\n"), -1);
+}
+
+static void test_entry_directive(void)
+{
+	CHECK_EQ(entry_of("nop\nmain: kil\n[.entry main]\n"), 0x1001);
+	CHECK_EQ(entry_of("[.entry 0x3000]\n[.org 0x3000]\nkil\n"), 0x3000);
+	CHECK_EQ(entry_of("[.org 0x4000]\nnop\nmain: kil\n[.entry main]\n"), 0x4001);
+
+	asm_error_t err;
+	size_t len;
+	const char twice[] = "a: nop\n[.entry a]\n[.entry a]\n";
+	CHECK(!asm_assemble(twice, strlen(twice), &len, &err));
+	CHECK_EQ(err.line, 3);
+	const char external[] = "[.entry elsewhere]\nnop\n";
+	CHECK(!asm_assemble(external, strlen(external), &len, &err));
+}
+
+// The program runs from its first instruction, not from its data
+static void test_runs_past_data(void)
+{
+	emu_t emu;
+	CHECK(emu_init(&emu, NULL) == 0);
+	test_load(&emu,
+		"	[.org 0x0010]\n"
+		"	[.byte 1, 2, 3]\n"
+		"	[.org 0x0200]\n"
+		"	lda %0x11\n"
+		"	kil\n");
+	CHECK_EQ(emu_run(&emu, CPU_BUDGET_CYCLES, 1000), CPU_STOP_KIL);
+	CHECK_EQ(emu.cpu.A, 2);
+	emu_free(&emu);
+}
+
+// All of memory from .org 0, more than one 16-bit segment length holds
+static void test_full_memory(void)
+{
+	const size_t max = 64 * 1024 * 8;
+	char *src = malloc(max);
+	size_t n = snprintf(src, max, "[.org 0]\n");
+	for(unsigned addr = 0; addr < MEM_SIZE; addr += 16)
+	{
+		n += snprintf(src + n, max - n, "[.byte %u", addr & 0xFF);
+		for(unsigned i = 1; i < 16; i++)
+			n += snprintf(src + n, max - n, ", %u", (addr + i) & 0xFF);
+		n += snprintf(src + n, max - n, "]\n");
+	}
+
+	asm_error_t err;
+	size_t len;
+	byte *image = asm_assemble(src, n, &len, &err);
+	CHECK(image != NULL);
+	ef_file hdr;
+	if(image && ef_parse(image, len, "<test>", &hdr) == 0)
+	{
+		uint32_t next = 0;
+		for(word i = 0; i < hdr.ef_nsegs; i++)
+		{
+			const ef_segment *seg = &hdr.ef_segs[i];
+			if(!seg->len)
+				continue;
+			CHECK_EQ(seg->addr, next);
+			CHECK_EQ(seg->data[0], seg->addr & 0xFF);
+			CHECK_EQ(seg->data[seg->len - 1], (seg->addr + seg->len - 1) & 0xFF);
+			next = seg->addr + seg->len;
+		}
+		CHECK_EQ(next, MEM_SIZE);
+		CHECK(hdr.ef_nsegs > 1);
+		free_ef(&hdr);
+	}
+	else
+		CHECK(!"full image does not parse");
+	free(image);
+	free(src);
+}
+
+int main(void)
+{
+	RUN_TEST(test_first_instruction);
+	RUN_TEST(test_entry_directive);
+	RUN_TEST(test_runs_past_data);
+	RUN_TEST(test_full_memory);
+	return TEST_EXIT();
+}
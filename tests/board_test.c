@@ -0,0 +1,100 @@
+#include "test.h"
+#include "board.h"
+
+/*
+ * Lock-step boards give the same result for any thread count
+ */
+
+#define NCPUS 	4
+#define SHARED 	0x80 	// page mapped into every CPU
+
+// Every CPU adds its id at $10 to a shared counter, leaves the sum in
+// its own slot of the shared page and logs what it saw of the others.
+// $11 sets how many iterations it runs, so the CPUs stop at different
+// times.
+static const char program[] =
+	"main:\n"
+	"	ldx %0x11\n"
+	"loop:\n"
+	"	lda 0x8000\n"
+	"	clc\n"
+	"	adc %0x10\n"
+	"	sta 0x8000\n"
+	"	ldy %0x10\n"
+	"	sta 0x8001,y\n"
+	"	eor 0x8002\n"
+	"	eor 0x8003,y\n"
+	"	sta 0x0300,x\n"
+	"	inx\n"
+	"	bne loop\n"
+	"	kil\n";
+
+static board_t *run(unsigned threads, const emu_config_t *emu)
+{
+	const board_config_t config = { .ncpus = NCPUS, .quantum = 50, .threads = threads, .emu = *emu };
+	board_t *board = board_create(&config);
+	CHECK(board != NULL);
+	if(!board)
+		exit(EXIT_FAILURE);
+	CHECK(board_share(board, SHARED, 1) == 0);
+	for(unsigned i = 0; i < NCPUS; i++)
+	{
+		emu_t *cpu = board_cpu(board, i);
+		test_load(cpu, program);
+		cpu_write_byte(&cpu->ram, 0x10, i + 1);
+		cpu_write_byte(&cpu->ram, 0x11, 0x100 - 40 * (i + 1));
+	}
+	CHECK_EQ(board_run(board, UINT64_MAX), 0);
+	return board;
+}
+
+static void check_same(board_t *a, board_t *b)
+{
+	for(unsigned i = 0; i < NCPUS; i++)
+	{
+		emu_t *x = board_cpu(a, i), *y = board_cpu(b, i);
+		CHECK_EQ(board_stop_reason(a, i), CPU_STOP_KIL);
+		CHECK_EQ(board_stop_reason(b, i), CPU_STOP_KIL);
+		CHECK_EQ(x->cpu.A, y->cpu.A);
+		CHECK_EQ(x->cpu.X, y->cpu.X);
+		CHECK_EQ(x->cpu.Y, y->cpu.Y);
+		CHECK_EQ(x->cpu.PC, y->cpu.PC);
+		CHECK_EQ(cpu_get_status(&x->cpu), cpu_get_status(&y->cpu));
+		CHECK_EQ(x->cpu.cycles, y->cpu.cycles);
+		CHECK_EQ(x->cpu.instructions, y->cpu.instructions);
+		CHECK(memcmp(x->ram.data, y->ram.data, MEM_SIZE) == 0);
+		for(unsigned off = 0; off < RAM_PAGE_SIZE; off++)
+			CHECK_EQ(cpu_read_byte(&x->ram, SHARED << 8 | off), cpu_read_byte(&y->ram, SHARED << 8 | off));
+	}
+}
+
+static void check_threads(const emu_config_t *emu)
+{
+	board_t *one = run(1, emu);
+	// the CPUs saw each other's writes
+	CHECK(cpu_read_byte(&board_cpu(one, 0)->ram, 0x8000) != 0);
+	for(unsigned threads = 2; threads <= NCPUS; threads++)
+	{
+		board_t *many = run(threads, emu);
+		check_same(one, many);
+		board_destroy(many);
+	}
+	board_destroy(one);
+}
+
+static void test_interpreter(void)
+{
+	check_threads(&(emu_config_t) { 0 });
+}
+
+static void test_block_cache(void)
+{
+	check_threads(&(emu_config_t) { .block_cache = true });
+}
+
+int main(void)
+{
+	RUN_TEST(test_interpreter);
+	RUN_TEST(test_block_cache);
+	return TEST_EXIT();
+}
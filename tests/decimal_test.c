@@ -0,0 +1,145 @@
+#include "test.h"
+
+/*
+ * NMOS decimal mode ADC and SBC
+ *
+ * The reference is the NMOS description in Bruce Clark's "Decimal Mode"
+ * tutorial from 6502.org: A and C from sequence 1 (ADC) or 3 (SBC), N
+ * and V of ADC from sequence 2, Z of ADC from the binary sum, and every
+ * flag of SBC as in binary mode.
+ */
+
+typedef struct result
+{
+	byte a;
+	byte flags; 	// N, V, Z and C
+} result_t;
+
+static result_t ref_adc(byte a, byte b, bool c)
+{
+	int al = (a & 0x0F) + (b & 0x0F) + c;
+	if(al >= 0x0A)
+		al = ((al + 0x06) & 0x0F) + 0x10;
+	int sum = (a & 0xF0) + (b & 0xF0) + al;
+	const int sum2 = (int8_t) (a & 0xF0) + (int8_t) (b & 0xF0) + al;
+	result_t r = { 0, 0 };
+	if(sum >= 0xA0)
+		sum += 0x60;
+	r.a = sum;
+	r.flags |= sum >= 0x100 ? C : 0;
+	r.flags |= sum2 & 0x80 ? N : 0;
+	r.flags |= sum2 < -128 || sum2 > 127 ? V : 0;
+	r.flags |= (byte) (a + b + c) == 0 ? Z : 0;
+	return r;
+}
+
+static result_t ref_sbc(byte a, byte b, bool c)
+{
+	int al = (a & 0x0F) - (b & 0x0F) + c - 1;
+	if(al < 0)
+		al = ((al - 0x06) & 0x0F) - 0x10;
+	int diff = (a & 0xF0) - (b & 0xF0) + al;
+	if(diff < 0)
+		diff -= 0x60;
+
+	const int bin = a - b - !c;
+	const int sbin = (int8_t) a - (int8_t) b - !c;
+	result_t r = { diff, 0 };
+	r.flags |= bin >= 0 ? C : 0;
+	r.flags |= bin & 0x80 ? N : 0;
+	r.flags |= sbin < -128 || sbin > 127 ? V : 0;
+	r.flags |= (byte) bin == 0 ? Z : 0;
+	return r;
+}
+
+// One `opcode #b` at 0x1000 in decimal mode
+static result_t run_op(emu_t *emu, byte opcode, byte a, byte b, bool c)
+{
+	cpu_write_byte(&emu->ram, 0x1000, opcode);
+	cpu_write_byte(&emu->ram, 0x1001, b);
+	emu->cpu.PC = 0x1000;
+	emu->cpu.A = a;
+	cpu_set_status(&emu->cpu, D | (c ? C : 0));
+	emu_run(emu, CPU_BUDGET_INSTRUCTIONS, 1);
+	return (result_t) { emu->cpu.A, cpu_get_status(&emu->cpu) & (N | V | Z | C) };
+}
+
+static void setup(emu_t *emu)
+{
+	CHECK(emu_init(emu, NULL) == 0);
+	test_load(emu, "kil\n");
+	emu_run(emu, CPU_BUDGET_CYCLES, 10); 	// takes the reset
+}
+
+#define CHECK_RESULT(r, a_, flags_) \
+	do \
+	{ \
+		CHECK_EQ((r).a, a_); \
+		CHECK_EQ((r).flags, flags_); \
+	} while(0)
+
+// Worked examples of the tutorial and the NMOS datasheet
+static void test_known(void)
+{
+	emu_t emu;
+	setup(&emu);
+	CHECK_RESULT(run_op(&emu, INS_ADC_IMM, 0x12, 0x34, 0), 0x46, 0);
+	CHECK_RESULT(run_op(&emu, INS_ADC_IMM, 0x58, 0x46, 1), 0x05, N | V | C);
+	CHECK_RESULT(run_op(&emu, INS_ADC_IMM, 0x81, 0x92, 0), 0x73, V | C);
+	CHECK_RESULT(run_op(&emu, INS_ADC_IMM, 0x09, 0x01, 0), 0x10, 0);
+	// Z from the binary sum 0x9a, N from 0xa0 before the correction
+	CHECK_RESULT(run_op(&emu, INS_ADC_IMM, 0x99, 0x01, 0), 0x00, N | C);
+	CHECK_RESULT(run_op(&emu, INS_SBC_IMM, 0x46, 0x12, 1), 0x34, C);
+	CHECK_RESULT(run_op(&emu, INS_SBC_IMM, 0x40, 0x13, 1), 0x27, C);
+	CHECK_RESULT(run_op(&emu, INS_SBC_IMM, 0x32, 0x02, 0), 0x29, C);
+	CHECK_RESULT(run_op(&emu, INS_SBC_IMM, 0x12, 0x21, 1), 0x91, N);
+	CHECK_RESULT(run_op(&emu, INS_SBC_IMM, 0x21, 0x34, 1), 0x87, N);
+	CHECK_RESULT(run_op(&emu, INS_SBC_IMM, 0x00, 0x01, 1), 0x99, N);
+	emu_free(&emu);
+}
+
+// Every operand pair, valid BCD or not, and both carries
+static void test_exhaustive(void)
+{
+	emu_t emu;
+	setup(&emu);
+	unsigned bad = 0;
+	for(unsigned a = 0; a < 0x100; a++)
+		for(unsigned b = 0; b < 0x100; b++)
+			for(int c = 0; c < 2; c++)
+			{
+				const result_t adc = run_op(&emu, INS_ADC_IMM, a, b, c);
+				const result_t sbc = run_op(&emu, INS_SBC_IMM, a, b, c);
+				const result_t ra = ref_adc(a, b, c), rs = ref_sbc(a, b, c);
+				if((adc.a != ra.a || adc.flags != ra.flags) && bad++ < 8)
+					fprintf(stderr, "adc %02x %02x c%d: %02x/%02x, expected %02x/%02x\n",
+							a, b, c, adc.a, adc.flags, ra.a, ra.flags);
+				if((sbc.a != rs.a || sbc.flags != rs.flags) && bad++ < 8)
+					fprintf(stderr, "sbc %02x %02x c%d: %02x/%02x, expected %02x/%02x\n",
+							a, b, c, sbc.a, sbc.flags, rs.a, rs.flags);
+			}
+	CHECK_EQ(bad, 0);
+	emu_free(&emu);
+}
+
+// Binary mode is back after CLD
+static void test_cld(void)
+{
+	emu_t emu;
+	setup(&emu);
+	run_op(&emu, INS_ADC_IMM, 0x09, 0x01, 0);
+	emu.cpu.status &= ~D;
+	emu.cpu.PC = 0x1000;
+	emu.cpu.A = 0x09;
+	emu_run(&emu, CPU_BUDGET_INSTRUCTIONS, 1);
+	CHECK_EQ(emu.cpu.A, 0x0A);
+	emu_free(&emu);
+}
+
+int main(void)
+{
+	RUN_TEST(test_known);
+	RUN_TEST(test_exhaustive);
+	RUN_TEST(test_cld);
+	return TEST_EXIT();
+}
@@ -0,0 +1,247 @@
+#include <unistd.h>
+
+#include "test.h"
+#include "dis.h"
+#include "ef.h"
+
+/*
+ * Disassembler: sweep and trace, the dis65 listings, which assemble
+ * back to the bytes they list
+ */
+
+#define DIS65 	"./dis65"
+
+static byte mem[MEM_SIZE];
+
+static const char *text_at(word addr)
+{
+	static char buf[DIS_TEXT_MAX];
+	dis_insn_t insn;
+	dis_decode(mem, addr, &insn);
+	dis_text(&insn, buf);
+	return buf;
+}
+
+// Assemble `src` and copy its segments to `out`, which is cleared first.
+// Returns the EF image, or NULL if it does not assemble.
+static byte *load(const char *src, size_t len, byte *out, size_t *image_len, ef_file *hdr)
+{
+	asm_error_t err;
+	byte *image = asm_assemble(src, len, image_len, &err);
+	if(!image)
+	{
+		fprintf(stderr, "line %u: %s\n", err.line, err.msg);
+		return NULL;
+	}
+	memset(out, 0, MEM_SIZE);
+	if(ef_parse(image, *image_len, "<test>", hdr) < 0)
+	{
+		free(image);
+		return NULL;
+	}
+	for(word i = 0; i < hdr->ef_nsegs; i++)
+		memcpy(out + hdr->ef_segs[i].addr, hdr->ef_segs[i].data, hdr->ef_segs[i].len);
+	return image;
+}
+
+// `src` assembles to `len` bytes at `addr` equal to those in mem
+static bool assembles_to(const char *src, word addr, unsigned len)
+{
+	static byte out[MEM_SIZE];
+	size_t image_len;
+	ef_file hdr;
+	byte *image = load(src, strlen(src), out, &image_len, &hdr);
+	if(!image)
+		return false;
+	free_ef(&hdr);
+	free(image);
+	return memcmp(out + addr, mem + addr, len) == 0;
+}
+
+// Assemble `src` into mem and into an EF file at `path`, which has room
+// for the name of a temporary file. Returns false on failure.
+static bool write_program(const char *src, char *path)
+{
+	size_t len;
+	ef_file hdr;
+	byte *image = load(src, strlen(src), mem, &len, &hdr);
+	if(!image)
+		return false;
+	free_ef(&hdr);
+	strcpy(path, "/tmp/dis_testXXXXXX");
+	const int fd = mkstemp(path);
+	const bool ok = fd >= 0 && write(fd, image, len) == (ssize_t) len;
+	if(fd >= 0)
+		close(fd);
+	free(image);
+	return ok;
+}
+
+// stdout of dis65 with `args` on `path`, malloc'd, NULL on failure
+static char *dis65(const char *args, const char *path)
+{
+	char cmd[256];
+	snprintf(cmd, sizeof cmd, DIS65 " %s %s", args, path);
+	FILE *fp = popen(cmd, "r");
+	if(!fp)
+		return NULL;
+	size_t len = 0, cap = 4096;
+	char *out = malloc(cap);
+	size_t got;
+	while(out && (got = fread(out + len, 1, cap - len - 1, fp)) > 0)
+	{
+		len += got;
+		if(cap - len - 1 == 0)
+			out = realloc(out, cap *= 2);
+	}
+	if(pclose(fp) != 0 || !out)
+	{
+		free(out);
+		return NULL;
+	}
+	out[len] = '\0';
+	return out;
+}
+
+// Data after a jump, which a sweep takes for code: it decodes lda #$20
+// at $2003, and the jmp at $2005 swallows the start of `over`
+static const char jump_over_data[] =
+	"[.org 0x2000]\n"
+	"	jmp over\n"
+	"	[.byte 0xa9, 0x20, 0x4c]\n"
+	"over:\n"
+	"	lda #1\n"
+	"	kil\n";
+
+static void test_sweep_trace(void)
+{
+	char path[32];
+	CHECK(write_program(jump_over_data, path));
+
+	dis_insn_t insns[16];
+	const size_t n = dis_sweep(mem, 0x2000, 9, insns);
+	CHECK_EQ(n, 4);
+	CHECK_EQ(insns[1].addr, 0x2003);
+	CHECK_EQ(insns[2].addr, 0x2005);
+	CHECK_EQ(insns[3].addr, 0x2008);
+
+	byte starts[MEM_SIZE / 8] = { 0 };
+	const word entry = 0x2000;
+	CHECK_EQ(dis_trace(mem, &entry, 1, starts), 3);
+	CHECK(starts[0x2000 / 8] & 1 << 0x2000 % 8);
+	CHECK(starts[0x2006 / 8] & 1 << 0x2006 % 8);
+	CHECK(starts[0x2008 / 8] & 1 << 0x2008 % 8);
+	CHECK(!(starts[0x2003 / 8] & 1 << 0x2003 % 8));
+	CHECK(!(starts[0x2005 / 8] & 1 << 0x2005 % 8));
+
+	// the listings split the same way
+	char *sweep = dis65("", path);
+	char *trace = dis65("-r", path);
+	CHECK(sweep && strstr(sweep, "; 2003 ") && strstr(sweep, "; 2005 ") && !strstr(sweep, "; 2006 "));
+	CHECK(trace && strstr(trace, "[.org 0x2006]") && strstr(trace, "; 2006 ") && !strstr(trace, "; 2003 "));
+	free(sweep);
+	free(trace);
+	unlink(path);
+}
+
+static void test_machine_output(void)
+{
+	static const char src[] =
+		"[.org 0x3000]\n"
+		"start:\n"
+		"	lda #0x01\n"
+		"	sta %0x10\n"
+		"	[.byte 0xad, 0x10, 0x00]\n"
+		"	bne start\n"
+		"	jmp 0x1234\n"
+		"	[.byte 0xff, 0x02]\n";
+	char path[32];
+	CHECK(write_program(src, path));
+
+	char *out = dis65("-m", path);
+	CHECK(out != NULL);
+	if(out)
+		CHECK(strcmp(out,
+			"3000\ta901\tlda\timm\t01\n"
+			"3002\t8510\tsta\tzp\t10\n"
+			"3004\tad1000\tlda\tabs\t0010\n"
+			"3007\td0f7\tbne\trel\t3000\n"
+			"3009\t4c3412\tjmp\tabs\t1234\n"
+			"300c\tff\t-\t-\t-\n"
+			"300d\t02\tkil\timp\t-\n") == 0);
+	free(out);
+	unlink(path);
+}
+
+// Random bytes, and an instruction cut off by the end of memory, list
+// as source that assembles back to them
+static void test_round_trip(void)
+{
+	const size_t max = 1024 * 16 + 64;
+	char *src = malloc(max);
+	size_t n = snprintf(src, max, "[.org 0x2000]\n");
+	uint32_t seed = 12345;
+	for(unsigned i = 0; i < 1024; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		n += snprintf(src + n, max - n, "[.byte %u]\n", seed >> 16 & 0xFF);
+	}
+	n += snprintf(src + n, max - n, "[.org 0xfffc]\n[.byte 0xea, 0xea, 0x20, 0x34]\n");
+
+	char path[32];
+	CHECK(write_program(src, path));
+	char *listing = dis65("", path);
+	CHECK(listing != NULL);
+	if(listing)
+	{
+		static byte out[MEM_SIZE];
+		size_t len;
+		ef_file again;
+		byte *image = load(listing, strlen(listing), out, &len, &again);
+		CHECK(image != NULL);
+		if(image)
+		{
+			CHECK(memcmp(out + 0x2000, mem + 0x2000, 1024) == 0);
+			CHECK(memcmp(out + 0xFFFC, mem + 0xFFFC, 4) == 0);
+			free_ef(&again);
+			free(image);
+		}
+	}
+	free(listing);
+	unlink(path);
+	free(src);
+}
+
+// Instructions cut off by the end of memory are data, only the bytes
+// below the end are listed
+static void test_past_end(void)
+{
+	char src[128];
+	memset(mem, 0, sizeof mem);
+	mem[0x0000] = 0x12;
+	mem[0xFFFE] = INS_JSR;
+	mem[0xFFFF] = 0x34;
+	CHECK(strcmp(text_at(0xFFFE), "[.byte 0x20, 0x34] ; jsr 0x1234 (past the end)") == 0);
+	snprintf(src, sizeof src, "[.org 0xfffe]\n%s\n", text_at(0xFFFE));
+	CHECK(assembles_to(src, 0xFFFE, 2));
+
+	mem[0xFFFF] = INS_LDA_IMM;
+	CHECK(strcmp(text_at(0xFFFF), "[.byte 0xa9] ; lda #0x12 (past the end)") == 0);
+	snprintf(src, sizeof src, "[.org 0xffff]\n%s\n", text_at(0xFFFF));
+	CHECK(assembles_to(src, 0xFFFF, 1));
+
+	// ends exactly at the end of memory
+	mem[0xFFFD] = INS_LDA_ABS;
+	mem[0xFFFE] = 0x00;
+	mem[0xFFFF] = 0x20;
+	CHECK(strcmp(text_at(0xFFFD), "lda 0x2000") == 0);
+}
+
+int main(void)
+{
+	RUN_TEST(test_sweep_trace);
+	RUN_TEST(test_machine_output);
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_past_end);
+	return TEST_EXIT();
+}
@@ -0,0 +1,75 @@
+#include <unistd.h>
+
+#include "test.h"
+#include "ef.h"
+
+/*
+ * Loading EF files that do not fit in memory
+ */
+
+// v1 file of `size` bytes of payload, all NOP
+static byte *v1_image(word size, size_t *len)
+{
+	*len = EF_HEADER_SIZE + size;
+	byte *image = malloc(*len);
+	if(!image)
+		exit(EXIT_FAILURE);
+	image[0] = 'E';
+	image[1] = 'F';
+	image[2] = size & 0xFF;
+	image[3] = size >> 8;
+	memset(image + EF_HEADER_SIZE, INS_NOP, size);
+	return image;
+}
+
+static void test_v1_size(void)
+{
+	emu_t emu;
+	CHECK(emu_init(&emu, NULL) == 0);
+	size_t len;
+
+	// up to the end of memory
+	byte *image = v1_image(MEM_SIZE - EF_V1_LOAD, &len);
+	CHECK(emu_load_ef_image(&emu, image, len) == 0);
+	CHECK_EQ(cpu_read_byte(&emu.ram, MEM_MAX), INS_NOP);
+	free(image);
+
+	// one byte or a whole page more is rejected before anything is copied
+	image = v1_image(MEM_SIZE - EF_V1_LOAD + 1, &len);
+	CHECK(emu_load_ef_image(&emu, image, len) < 0);
+	free(image);
+	image = v1_image(0xF800, &len);
+	CHECK(emu_load_ef_image(&emu, image, len) < 0);
+
+	// the same from a file
+	char path[] = "/tmp/ef_testXXXXXX";
+	const int fd = mkstemp(path);
+	CHECK(fd >= 0);
+	CHECK(write(fd, image, len) == (ssize_t) len);
+	close(fd);
+	CHECK(emu_load_ef(&emu, path) < 0);
+	ef_file hdr;
+	CHECK(read_ef(path, &hdr) < 0);
+	unlink(path);
+	free(image);
+	emu_free(&emu);
+}
+
+static void test_truncated(void)
+{
+	emu_t emu;
+	CHECK(emu_init(&emu, NULL) == 0);
+	size_t len;
+	byte *image = v1_image(0x100, &len);
+	CHECK(emu_load_ef_image(&emu, image, len - 1) < 0);
+	CHECK(emu_load_ef_image(&emu, image, 3) < 0);
+	free(image);
+	emu_free(&emu);
+}
+
+int main(void)
+{
+	RUN_TEST(test_v1_size);
+	RUN_TEST(test_truncated);
+	return TEST_EXIT();
+}
@@ -0,0 +1,184 @@
+#include "test.h"
+
+/*
+ * IRQ, NMI and BRK through the vectors of the loaded image, and back
+ * with RTI
+ */
+
+// Counts interrupts at $10 (IRQ) and $11 (NMI), keeps the status they
+// pushed at $12 and $13. The device at $d000 drops IRQ source 1 when
+// written.
+static const char program[] =
+	"boot:\n"
+	"	lda #0xee\n"
+	"	sta %0x20\n"
+	"	kil\n"
+	"main:\n"
+	"	ldx #0xff\n"
+	"	txs\n"
+	"	cli\n"
+	"	sec\n"
+	"	lda #0x42\n"
+	"loop:\n"
+	"	jmp loop\n"
+	"irq:\n"
+	"	pha\n"
+	"	inc %0x10\n"
+	"	tsx\n"
+	"	lda 0x0102,x\n"
+	"	sta %0x12\n"
+	"	sta 0xd000\n"
+	"	pla\n"
+	"	clc\n"
+	"	rti\n"
+	"nmi:\n"
+	"	inc %0x11\n"
+	"	tsx\n"
+	"	lda 0x0101,x\n"
+	"	sta %0x13\n"
+	"	rti\n"
+	"	[.org 0xfffa]\n"
+	"	[.word nmi, main, irq]\n";
+
+static void ack(void *ctx, word addr, byte data)
+{
+	(void) addr;
+	(void) data;
+	cpu_set_irq(ctx, 1, false);
+}
+
+static void setup(emu_t *emu, const char *src)
+{
+	CHECK(emu_init(emu, NULL) == 0);
+	ram_map_device(&emu->ram, 0xD0, 1, NULL, ack, &emu->cpu);
+	test_load(emu, src);
+}
+
+// The image's own vector table is used, not the entry point
+static void test_vector_table(void)
+{
+	emu_t emu;
+	setup(&emu, program);
+	CHECK(cpu_read_word(&emu.ram, NMI_VECTOR) != 0);
+	CHECK_EQ(emu_run(&emu, CPU_BUDGET_CYCLES, 100), CPU_STOP_BUDGET);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x20), 0);
+	CHECK_EQ(emu.cpu.status & I, 0);
+	emu_free(&emu);
+}
+
+static void test_irq_round_trip(void)
+{
+	emu_t emu;
+	setup(&emu, program);
+	emu_run(&emu, CPU_BUDGET_CYCLES, 100);
+	const word loop = emu.cpu.PC;
+	CHECK_EQ(cpu_read_byte(&emu.ram, loop), INS_JMP_ABS);
+
+	cpu_set_irq(&emu.cpu, 1, true);
+	emu_run(&emu, CPU_BUDGET_CYCLES, 200);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x10), 1);
+	CHECK_EQ(emu.cpu.irq, 0);
+	// pushed with B clear and U set, back in the loop with the flags
+	// and registers of before
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x12) & (B | U), U);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x12) & C, C);
+	CHECK_EQ(emu.cpu.PC, loop);
+	CHECK_EQ(emu.cpu.SP, 0xFF);
+	CHECK_EQ(emu.cpu.A, 0x42);
+	CHECK_EQ(emu.cpu.carry, 1);
+	CHECK_EQ(emu.cpu.status & I, 0);
+	emu_free(&emu);
+}
+
+static void test_irq_masked(void)
+{
+	emu_t emu;
+	setup(&emu, program);
+	emu_run(&emu, CPU_BUDGET_CYCLES, 100);
+	emu.cpu.status |= I;
+	cpu_set_irq(&emu.cpu, 1, true);
+	emu_run(&emu, CPU_BUDGET_CYCLES, 200);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x10), 0);
+
+	// taken as soon as I is cleared, the line is still low
+	emu.cpu.status &= ~I;
+	emu_run(&emu, CPU_BUDGET_CYCLES, 200);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x10), 1);
+	emu_free(&emu);
+}
+
+static void test_nmi(void)
+{
+	emu_t emu;
+	setup(&emu, program);
+	emu_run(&emu, CPU_BUDGET_CYCLES, 100);
+	const word loop = emu.cpu.PC;
+
+	// not masked by I, and every edge is taken once
+	emu.cpu.status |= I;
+	cpu_trigger_nmi(&emu.cpu);
+	emu_run(&emu, CPU_BUDGET_CYCLES, 200);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x11), 1);
+	cpu_trigger_nmi(&emu.cpu);
+	emu_run(&emu, CPU_BUDGET_CYCLES, 200);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x11), 2);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x13) & (B | I), I);
+	CHECK_EQ(emu.cpu.PC, loop);
+	CHECK_EQ(emu.cpu.SP, 0xFF);
+	CHECK_EQ(emu.cpu.status & I, I);
+	emu_free(&emu);
+}
+
+// NMI wins over IRQ when both are pending, the IRQ follows
+static void test_priority(void)
+{
+	emu_t emu;
+	setup(&emu, program);
+	emu_run(&emu, CPU_BUDGET_CYCLES, 100);
+	cpu_set_irq(&emu.cpu, 1, true);
+	cpu_trigger_nmi(&emu.cpu);
+	emu_run(&emu, CPU_BUDGET_INSTRUCTIONS, 1);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x11), 1);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x10), 0);
+	emu_run(&emu, CPU_BUDGET_CYCLES, 200);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x10), 1);
+	emu_free(&emu);
+}
+
+// BRK goes through the IRQ vector with B set and returns past its
+// padding byte
+static void test_brk(void)
+{
+	static const char src[] =
+		"	ldx #0xff\n"
+		"	txs\n"
+		"	brk\n"
+		"	[.byte 0xea]\n"
+		"	lda #0x99\n"
+		"	kil\n"
+		"handler:\n"
+		"	tsx\n"
+		"	lda 0x0101,x\n"
+		"	sta %0x12\n"
+		"	rti\n"
+		"	[.org 0xfffe]\n"
+		"	[.word handler]\n";
+	emu_t emu;
+	setup(&emu, src);
+	CHECK_EQ(emu_run(&emu, CPU_BUDGET_CYCLES, 1000), CPU_STOP_KIL);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x12) & B, B);
+	CHECK_EQ(emu.cpu.A, 0x99);
+	CHECK_EQ(emu.cpu.SP, 0xFF);
+	emu_free(&emu);
+}
+
+int main(void)
+{
+	RUN_TEST(test_vector_table);
+	RUN_TEST(test_irq_round_trip);
+	RUN_TEST(test_irq_masked);
+	RUN_TEST(test_nmi);
+	RUN_TEST(test_priority);
+	RUN_TEST(test_brk);
+	return TEST_EXIT();
+}
@@ -0,0 +1,243 @@
+#include "test.h"
+#include "bcache.h"
+
+/*
+ * Differential runs: the interpreter against the block cache and the
+ * JIT in verify mode, which reruns every native block interpreted
+ */
+
+// Rewrites the immediate operand of an instruction in the block it is
+// running in, then the branch target of the loop it is in
+static const char self_modifying[] =
+	"	ldx #0\n"
+	"	ldy #0\n"
+	"loop:\n"
+	"op:	lda #0\n"
+	"	clc\n"
+	"	adc #3\n"
+	"	sta op + 1\n"
+	"	sta %0x20,x\n"
+	"	eor %0x21\n"
+	"	sta %0x21\n"
+	"	inx\n"
+	"	bne loop\n"
+	"	iny\n"
+	"	cpy #3\n"
+	"	bne loop\n"
+	"	lda #<last\n"
+	"	sta jump + 1\n"
+	"	lda #>last\n"
+	"	sta jump + 2\n"
+	"jump:	jmp loop\n"
+	"last:\n"
+	"	sed\n"
+	"	lda #0x19\n"
+	"	ldx #40\n"
+	"add:	clc\n"
+	"	adc #0x01\n"
+	"	sbc #0x00\n"
+	"	php\n"
+	"	pla\n"
+	"	sta 0x0300,x\n"
+	"	dex\n"
+	"	bne add\n"
+	"	cld\n"
+	"	kil\n";
+
+// Spins with an IRQ held low but masked, then takes it on CLI. The
+// handler keeps the return address it finds on the stack at $12.
+static const char masked_irq[] =
+	"main:\n"
+	"	ldx #0xff\n"
+	"	txs\n"
+	"	sei\n"
+	"loop:\n"
+	"	inc %0x30\n"
+	"	bne loop\n"
+	"	inc %0x31\n"
+	"	lda %0x31\n"
+	"	cmp #4\n"
+	"	bne loop\n"
+	"	cli\n"
+	"	nop\n"
+	"	kil\n"
+	"irq:\n"
+	"	inc %0x10\n"
+	"	tsx\n"
+	"	lda 0x0102,x\n"
+	"	sta %0x12\n"
+	"	lda 0x0103,x\n"
+	"	sta %0x13\n"
+	"	kil\n"
+	"	[.org 0xfffa]\n"
+	"	[.word irq, main, irq]\n";
+
+// Every inline and predecoded op, binary and decimal. The routine in zero page gets
+// cached, so zero page is watched and its stores take the slow path.
+static const char alu_ops[] =
+	"main:\n"
+	"	ldx #0xff\n"
+	"	txs\n"
+	"	lda #0x37\n"
+	"	jsr run\n"
+	"	sed\n"
+	"	jsr run\n"
+	"	cld\n"
+	"	jsr zp_inc\n"
+	"	jsr run\n"
+	"	kil\n"
+	"run:\n"
+	"	ldx %0x31\n"
+	"	ldy #0x10\n"
+	"	sta %0x20\n"
+	"	adc #0x11\n"
+	"	eor %0x20\n"
+	"	sbc %0x21\n"
+	"	ora #0x05\n"
+	"	and %0x22\n"
+	"	stx %0x21\n"
+	"	sty %0x22\n"
+	"	adc %0x21\n"
+	"	sbc #0x03\n"
+	"	cmp #0x40\n"
+	"	cpx %0x20\n"
+	"	cpy #0x08\n"
+	"	ldy %0x20\n"
+	"	cpy %0x22\n"
+	"	cmp %0x21\n"
+	"	tay\n"
+	"	iny\n"
+	"	dey\n"
+	"	iny\n"
+	"	tya\n"
+	"	tax\n"
+	"	dex\n"
+	"	txa\n"
+	"	and 0x0400\n"
+	"	sta 0x0500\n"
+	"	ora 0x0301\n"
+	"	stx 0x0501\n"
+	"	eor 0x0500\n"
+	"	sty 0x0502\n"
+	"	cmp 0x0501\n"
+	"	ldx 0x0502\n"
+	"	cpx 0x0300\n"
+	"	ldy 0x0500\n"
+	"	cpy 0x0501\n"
+	"	lda 0x0502\n"
+	"	eor #0xa5\n"
+	"	php\n"
+	"	ldx %0x31\n"
+	"	sta 0x0300,x\n"
+	"	pla\n"
+	"	sta 0x0400,x\n"
+	"	jsr zp_inc\n"
+	"	bne run\n"
+	"	rts\n"
+	"	[.org 0x00f0]\n"
+	"zp_inc:\n"
+	"	inc %0x31\n"
+	"	rts\n";
+
+static void run_program(const emu_config_t *config, emu_t *emu, const char *src, bool irq)
+{
+	CHECK(emu_init(emu, config) == 0);
+	test_load(emu, src);
+	cpu_set_irq(&emu->cpu, 1, irq);
+	CHECK_EQ(emu_run(emu, CPU_BUDGET_CYCLES, 10000000), CPU_STOP_KIL);
+}
+
+static void run(const emu_config_t *config, emu_t *emu)
+{
+	run_program(config, emu, self_modifying, false);
+}
+
+static void check_same(emu_t *a, emu_t *b)
+{
+	CHECK_EQ(a->cpu.A, b->cpu.A);
+	CHECK_EQ(a->cpu.X, b->cpu.X);
+	CHECK_EQ(a->cpu.Y, b->cpu.Y);
+	CHECK_EQ(a->cpu.SP, b->cpu.SP);
+	CHECK_EQ(a->cpu.PC, b->cpu.PC);
+	CHECK_EQ(cpu_get_status(&a->cpu), cpu_get_status(&b->cpu));
+	CHECK_EQ(a->cpu.cycles, b->cpu.cycles);
+	CHECK_EQ(a->cpu.instructions, b->cpu.instructions);
+	CHECK(memcmp(a->ram.data, b->ram.data, MEM_SIZE) == 0);
+}
+
+static void test_block_cache(void)
+{
+	emu_t ref, emu;
+	run(NULL, &ref);
+	run(&(emu_config_t) { .block_cache = true }, &emu);
+	check_same(&ref, &emu);
+	emu_free(&emu);
+	emu_free(&ref);
+}
+
+static void test_jit_verify(void)
+{
+	emu_t ref, emu;
+	run(NULL, &ref);
+	run(&(emu_config_t) { .jit_verify = true }, &emu);
+	check_same(&ref, &emu);
+	CHECK_EQ(emu_jit_mismatches(&emu), 0);
+#if defined(__x86_64__)
+	// the loops are hot enough to be translated and checked
+	CHECK(emu.bcache->jit != NULL);
+	CHECK(emu.bcache->verified > 0);
+#endif
+	emu_free(&emu);
+	emu_free(&ref);
+}
+
+static void test_alu_ops(void)
+{
+	emu_t ref, cached, jit;
+	run_program(NULL, &ref, alu_ops, false);
+	run_program(&(emu_config_t) { .block_cache = true }, &cached, alu_ops, false);
+	run_program(&(emu_config_t) { .jit_verify = true }, &jit, alu_ops, false);
+	check_same(&ref, &cached);
+	check_same(&ref, &jit);
+	CHECK_EQ(emu_jit_mismatches(&jit), 0);
+#if defined(__x86_64__)
+	CHECK(jit.bcache->verified > 0);
+#endif
+	emu_free(&jit);
+	emu_free(&cached);
+	emu_free(&ref);
+}
+
+// A masked IRQ does not end blocks, and CLI in the middle of one takes
+// it at the next instruction in every mode
+static void test_masked_irq(void)
+{
+	emu_t ref, cached, jit;
+	run_program(NULL, &ref, masked_irq, true);
+	run_program(&(emu_config_t) { .block_cache = true }, &cached, masked_irq, true);
+	run_program(&(emu_config_t) { .jit_verify = true }, &jit, masked_irq, true);
+	CHECK_EQ(cpu_read_byte(&ref.ram, 0x10), 1);
+	CHECK_EQ(cpu_read_byte(&ref.ram, 0x31), 4);
+	// pushed PC is the NOP after CLI
+	const word ret = cpu_read_byte(&ref.ram, 0x12) | cpu_read_byte(&ref.ram, 0x13) << 8;
+	CHECK_EQ(cpu_read_byte(&ref.ram, ret), INS_NOP);
+	CHECK_EQ(cpu_read_byte(&ref.ram, ret - 1), INS_CLI);
+	check_same(&ref, &cached);
+	check_same(&ref, &jit);
+	CHECK_EQ(emu_jit_mismatches(&jit), 0);
+#if defined(__x86_64__)
+	CHECK(jit.bcache->verified > 0);
+#endif
+	emu_free(&jit);
+	emu_free(&cached);
+	emu_free(&ref);
+}
+
+int main(void)
+{
+	RUN_TEST(test_block_cache);
+	RUN_TEST(test_jit_verify);
+	RUN_TEST(test_alu_ops);
+	RUN_TEST(test_masked_irq);
+	return TEST_EXIT();
+}
@@ -0,0 +1,170 @@
+#include "test.h"
+#include "lanes.h"
+
+/*
+ * Every lane against a scalar CPU running the same program on the same
+ * input
+ */
+
+// Sums its input in a loop of input iterations, then takes one of four
+// ways by the low bits of it: an indirect loop until the budget runs
+// out, an illegal opcode, or a call and decimal arithmetic before KIL
+static const char program[] =
+	"	ldx 0x0200\n"
+	"	ldy #0\n"
+	"	lda #0\n"
+	"loop:\n"
+	"	clc\n"
+	"	adc 0x0200\n"
+	"	sta 0x0300,y\n"
+	"	iny\n"
+	"	dex\n"
+	"	bne loop\n"
+	"	sta %0x10\n"
+	"	lda 0x0200\n"
+	"	and #3\n"
+	"	beq spin\n"
+	"	cmp #2\n"
+	"	beq illegal\n"
+	"	jsr sub\n"
+	"	sed\n"
+	"	adc #0x19\n"
+	"	cld\n"
+	"	sta %0x11\n"
+	"	php\n"
+	"	kil\n"
+	"illegal:\n"
+	"	[.byte 0xff]\n"
+	"spin:\n"
+	"	lda #0x00\n"
+	"	sta %0x20\n"
+	"	lda #0x03\n"
+	"	sta %0x21\n"
+	"again:\n"
+	"	lda [0x20],y\n"
+	"	eor #0x5a\n"
+	"	sta [0x20],y\n"
+	"	iny\n"
+	"	jmp again\n"
+	"sub:\n"
+	"	tsx\n"
+	"	txa\n"
+	"	ror a\n"
+	"	rts\n";
+
+#define NLANES 		LANES_MAX
+#define SLICE 		700
+#define SLICES 		12
+
+static byte input(unsigned lane)
+{
+	return lane * 5 + 1;
+}
+
+static void check_lane(lanes_t *lanes, unsigned lane, emu_t *emu, cpu_stop_t stop)
+{
+	cpu6502_t cpu;
+	lanes_get(lanes, lane, &cpu);
+	CHECK_EQ(lanes_stop_reason(lanes, lane), stop);
+	CHECK_EQ(cpu.A, emu->cpu.A);
+	CHECK_EQ(cpu.X, emu->cpu.X);
+	CHECK_EQ(cpu.Y, emu->cpu.Y);
+	CHECK_EQ(cpu.SP, emu->cpu.SP);
+	CHECK_EQ(cpu.PC, emu->cpu.PC);
+	CHECK_EQ(cpu_get_status(&cpu), cpu_get_status(&emu->cpu));
+	CHECK_EQ(cpu.cycles, emu->cpu.cycles);
+	CHECK_EQ(cpu.instructions, emu->cpu.instructions);
+	CHECK(memcmp(lanes_ram(lanes, lane)->data, emu->ram.data, MEM_SIZE) == 0);
+}
+
+static void test_against_scalar(void)
+{
+	emu_t image;
+	CHECK(emu_init(&image, NULL) == 0);
+	test_load(&image, program);
+
+	lanes_t *lanes = lanes_create(NLANES, NULL);
+	CHECK(lanes != NULL);
+	if(!lanes)
+		return;
+	lanes_reset(lanes, &image.ram);
+
+	static emu_t emus[NLANES];
+	cpu_stop_t stops[NLANES];
+	for(unsigned i = 0; i < NLANES; i++)
+	{
+		cpu_write_byte(lanes_ram(lanes, i), 0x0200, input(i));
+		CHECK(emu_init(&emus[i], NULL) == 0);
+		test_load(&emus[i], program);
+		emu_run(&emus[i], CPU_BUDGET_CYCLES, 7); 	// the reset lanes_reset leaves taken
+		cpu_write_byte(&emus[i].ram, 0x0200, input(i));
+		stops[i] = CPU_STOP_BUDGET;
+	}
+
+	for(int s = 0; s < SLICES; s++)
+	{
+		lanes_run(lanes, SLICE);
+		for(unsigned i = 0; i < NLANES; i++)
+		{
+			if(stops[i] == CPU_STOP_BUDGET)
+				stops[i] = emu_run(&emus[i], CPU_BUDGET_CYCLES, SLICE);
+			check_lane(lanes, i, &emus[i], stops[i]);
+		}
+	}
+
+	// every way out was taken, and most of it ran on whole vectors
+	unsigned kil = 0, illegal = 0, running = 0;
+	for(unsigned i = 0; i < NLANES; i++)
+	{
+		kil += stops[i] == CPU_STOP_KIL;
+		illegal += stops[i] == CPU_STOP_ILLEGAL;
+		running += stops[i] == CPU_STOP_BUDGET;
+	}
+	CHECK(kil && illegal && running);
+	uint64_t vector, scalar;
+	lanes_stats(lanes, &vector, &scalar);
+	CHECK(vector > scalar);
+
+	for(unsigned i = 0; i < NLANES; i++)
+		emu_free(&emus[i]);
+	lanes_destroy(lanes);
+	emu_free(&image);
+}
+
+// A stopped lane stays stopped until it is resumed
+static void test_resume(void)
+{
+	emu_t image;
+	CHECK(emu_init(&image, NULL) == 0);
+	test_load(&image, "inx\nkil\ninx\nkil\n");
+	lanes_t *lanes = lanes_create(2, NULL);
+	CHECK(lanes != NULL);
+	if(!lanes)
+		return;
+	lanes_reset(lanes, &image.ram);
+
+	CHECK_EQ(lanes_run(lanes, 100), 0);
+	CHECK_EQ(lanes_stop_reason(lanes, 1), CPU_STOP_KIL);
+	CHECK_EQ(lanes_run(lanes, 100), 0);
+
+	cpu6502_t cpu;
+	lanes_get(lanes, 1, &cpu);
+	cpu.PC++;
+	lanes_set(lanes, 1, &cpu);
+	lanes_resume(lanes, 1);
+	lanes_run(lanes, 100);
+	lanes_get(lanes, 0, &cpu);
+	CHECK_EQ(cpu.X, 1);
+	lanes_get(lanes, 1, &cpu);
+	CHECK_EQ(cpu.X, 2);
+	CHECK_EQ(lanes_stop_reason(lanes, 1), CPU_STOP_KIL);
+	lanes_destroy(lanes);
+	emu_free(&image);
+}
+
+int main(void)
+{
+	RUN_TEST(test_against_scalar);
+	RUN_TEST(test_resume);
+	return TEST_EXIT();
+}
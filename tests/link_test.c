@@ -0,0 +1,182 @@
+#include <dirent.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "obj.h"
+
+/*
+ * Programs of several units: shared globals, undefined externs and the
+ * object cache
+ */
+
+static const char caller[] =
+	"[.global main]\n"
+	"main:\n"
+	"	lda #5\n"
+	"	jsr add\n"
+	"	sta result\n"
+	"	ldx result\n"
+	"	kil\n";
+
+static const char callee[] =
+	"[.global add, result]\n"
+	"add:\n"
+	"	clc\n"
+	"	adc #3\n"
+	"	rts\n"
+	"result:\n"
+	"	[.byte 0]\n";
+
+// callee after an edit
+static const char callee_edited[] =
+	"[.global add, result]\n"
+	"add:\n"
+	"	clc\n"
+	"	adc #4\n"
+	"	rts\n"
+	"result:\n"
+	"	[.byte 0]\n";
+
+#define MAX_UNITS 	4
+
+// Link the `n` objects and run the program, returns its stop reason or
+// -1 if it does not link
+static int link_run(byte **images, const size_t *lens, size_t n, emu_t *emu, asm_error_t *err)
+{
+	obj_file objs[MAX_UNITS];
+	for(size_t i = 0; i < n; i++)
+		CHECK(obj_parse(images[i], lens[i], &objs[i]) == 0);
+
+	size_t len;
+	byte *image = obj_link(objs, n, &len, err);
+	for(size_t i = 0; i < n; i++)
+		obj_free(&objs[i]);
+	if(!image)
+		return -1;
+
+	CHECK(emu_init(emu, NULL) == 0);
+	CHECK(emu_load_ef_image(emu, image, len) == 0);
+	free(image);
+	return emu_run(emu, CPU_BUDGET_CYCLES, 10000);
+}
+
+static byte *object(const char *src, size_t *len)
+{
+	asm_error_t err;
+	byte *image = asm_object(src, strlen(src), len, &err);
+	if(!image)
+	{
+		fprintf(stderr, "line %u: %s\n", err.line, err.msg);
+		exit(EXIT_FAILURE);
+	}
+	return image;
+}
+
+static void test_shared_globals(void)
+{
+	size_t lens[2];
+	byte *images[2] = { object(caller, &lens[0]), object(callee, &lens[1]) };
+	emu_t emu;
+	asm_error_t err;
+	CHECK_EQ(link_run(images, lens, 2, &emu, &err), CPU_STOP_KIL);
+	CHECK_EQ(emu.cpu.A, 8);
+	CHECK_EQ(emu.cpu.X, 8);
+	emu_free(&emu);
+	free(images[0]);
+	free(images[1]);
+}
+
+static void test_undefined_extern(void)
+{
+	size_t lens[2];
+	byte *images[2] = { object(callee, &lens[0]), object(caller, &lens[1]) };
+	emu_t emu;
+	asm_error_t err;
+	// caller alone misses add and result
+	CHECK_EQ(link_run(&images[1], &lens[1], 1, &emu, &err), -1);
+	CHECK_EQ(err.unit, 0);
+	CHECK_EQ(err.line, 4);
+	CHECK(strstr(err.msg, "undefined symbol 'add'") != NULL);
+
+	// the error names the unit it is in
+	const char *missing = "lda other\nkil\n";
+	size_t more_len;
+	byte *more[3] = { images[0], images[1], object(missing, &more_len) };
+	const size_t more_lens[3] = { lens[0], lens[1], more_len };
+	CHECK_EQ(link_run(more, more_lens, 3, &emu, &err), -1);
+	CHECK_EQ(err.unit, 2);
+	CHECK(strstr(err.msg, "undefined symbol 'other'") != NULL);
+	free(more[2]);
+	free(images[0]);
+	free(images[1]);
+}
+
+static void remove_dir(const char *dir)
+{
+	DIR *d = opendir(dir);
+	if(d)
+	{
+		struct dirent *ent;
+		char path[512];
+		while((ent = readdir(d)))
+		{
+			if(ent->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof path, "%s/%s", dir, ent->d_name);
+			unlink(path);
+		}
+		closedir(d);
+	}
+	rmdir(dir);
+}
+
+// Editing one unit only assembles that unit again
+static void test_cache_hit(void)
+{
+	char dir[] = "/tmp/link_testXXXXXX";
+	CHECK(mkdtemp(dir) != NULL);
+
+	const char *first[2] = { caller, callee };
+	const char *second[2] = { caller, callee_edited };
+	const bool hits[2][2] = { { false, false }, { true, false } };
+	const byte results[2] = { 8, 9 };
+	for(unsigned run = 0; run < 2; run++)
+	{
+		const char **srcs = run ? second : first;
+		byte *images[2];
+		size_t lens[2];
+		for(unsigned i = 0; i < 2; i++)
+		{
+			asm_error_t err;
+			bool hit;
+			images[i] = obj_cache_object(dir, srcs[i], strlen(srcs[i]), &lens[i], &err, &hit);
+			CHECK(images[i] != NULL);
+			CHECK_EQ(hit, hits[run][i]);
+		}
+
+		emu_t emu;
+		asm_error_t err;
+		CHECK_EQ(link_run(images, lens, 2, &emu, &err), CPU_STOP_KIL);
+		CHECK_EQ(emu.cpu.A, results[run]);
+		emu_free(&emu);
+		free(images[0]);
+		free(images[1]);
+	}
+
+	// the edit did not drop the old object either
+	asm_error_t err;
+	size_t len;
+	bool hit;
+	byte *image = obj_cache_object(dir, callee, strlen(callee), &len, &err, &hit);
+	CHECK(hit);
+	free(image);
+	remove_dir(dir);
+}
+
+int main(void)
+{
+	RUN_TEST(test_shared_globals);
+	RUN_TEST(test_undefined_extern);
+	RUN_TEST(test_cache_hit);
+	return TEST_EXIT();
+}
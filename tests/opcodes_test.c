@@ -0,0 +1,191 @@
+#include "test.h"
+
+/*
+ * Results of official opcodes against known 6502 values
+ */
+
+#define FLAGS (N | V | Z | C)
+
+// Run `src` up to its kil
+static void run(emu_t *emu, const char *src)
+{
+	CHECK(emu_init(emu, NULL) == 0);
+	test_load(emu, src);
+	CHECK_EQ(emu_run(emu, CPU_BUDGET_CYCLES, 100000), CPU_STOP_KIL);
+}
+
+static const struct
+{
+	const char *src;
+	byte a;
+	byte flags; 	// N, V, Z and C after it
+} results[] =
+{
+	{ "clc\nlda #0x50\nadc #0x50\nkil\n", 0xA0, N | V },
+	{ "clc\nlda #0xff\nadc #0x01\nkil\n", 0x00, Z | C },
+	{ "clc\nlda #0x80\nadc #0xff\nkil\n", 0x7F, V | C },
+	{ "sec\nlda #0x7f\nadc #0x00\nkil\n", 0x80, N | V },
+	{ "sec\nlda #0x50\nsbc #0xb0\nkil\n", 0xA0, N | V },
+	{ "sec\nlda #0x00\nsbc #0x01\nkil\n", 0xFF, N },
+	{ "clc\nlda #0x05\nsbc #0x02\nkil\n", 0x02, C },
+	{ "sec\nlda #0x80\nsbc #0x01\nkil\n", 0x7F, V | C },
+	{ "lda #0x40\ncmp #0x40\nkil\n", 0x40, Z | C },
+	{ "lda #0x40\ncmp #0x41\nkil\n", 0x40, N },
+	{ "ldx #0x10\ncpx #0x01\ntxa\nkil\n", 0x10, C },
+	{ "ldy #0x80\ncpy #0x00\ntya\nkil\n", 0x80, N | C },
+	{ "lda #0xc0\nsta %0x10\nlda #0\nbit %0x10\nkil\n", 0x00, N | V | Z },
+	{ "lda #0x40\nsta 0x0300\nlda #0x40\nbit 0x0300\nkil\n", 0x40, V },
+	{ "sec\nlda #0x01\nror a\nkil\n", 0x80, N | C },
+	{ "clc\nlda #0x80\nrol a\nkil\n", 0x00, Z | C },
+	{ "lda #0x01\nlsr a\nkil\n", 0x00, Z | C },
+	{ "lda #0xc0\nasl a\nkil\n", 0x80, N | C },
+	{ "lda #0xf0\nand #0x3c\nkil\n", 0x30, 0 },
+	{ "lda #0xf0\nora #0x0f\nkil\n", 0xFF, N },
+	{ "lda #0xff\neor #0xff\nkil\n", 0x00, Z },
+	{ "ldx #0x00\ndex\ntxa\nkil\n", 0xFF, N },
+	{ "ldy #0xff\niny\ntya\nkil\n", 0x00, Z },
+	{ "lda #0x80\nclv\nkil\n", 0x80, N },
+	// PHP pushes B and U set, I is set since the reset
+	{ "lda #1\nsec\nphp\npla\nkil\n", 0x35, C },
+	{ "lda #0xc3\npha\nplp\nphp\npla\nkil\n", 0xF3, N | V | C },
+	{ "lda #0\npha\nlda #1\npla\nkil\n", 0x00, Z },
+	// TXS leaves the flags, TSX sets them
+	{ "ldx #0x80\nlda #1\ntxs\ntsx\ntxa\nkil\n", 0x80, N },
+};
+
+static void test_results(void)
+{
+	for(size_t i = 0; i < sizeof results / sizeof *results; i++)
+	{
+		emu_t emu;
+		run(&emu, results[i].src);
+		if(emu.cpu.A != results[i].a || (cpu_get_status(&emu.cpu) & FLAGS) != results[i].flags)
+		{
+			fprintf(stderr, "%s-> A %02x P %02x, expected A %02x flags %02x\n", results[i].src,
+					emu.cpu.A, cpu_get_status(&emu.cpu), results[i].a, results[i].flags);
+			test_failures++;
+		}
+		emu_free(&emu);
+	}
+}
+
+static void test_memory(void)
+{
+	emu_t emu;
+	run(&emu,
+		"	lda #0xff\n"
+		"	sta 0x0300\n"
+		"	inc 0x0300\n" 		// wraps to 0
+		"	ldx #4\n"
+		"	dec 0x02fc,x\n" 	// 0x0300 to 0xff
+		"	lda #0x81\n"
+		"	sta %0x10\n"
+		"	asl %0x10\n"
+		"	ror %0x10\n" 		// the carry from asl back in
+		"	ldx #0x20\n"
+		"	lda #0x12\n"
+		"	sta %0xf0,x\n" 		// zero page index wraps to 0x10
+		"	ldy #0x34\n"
+		"	sty %0x11\n"
+		"	lda #0x00\n"
+		"	sta %0x20\n"
+		"	lda #0x04\n"
+		"	sta %0x21\n"
+		"	ldy #2\n"
+		"	lda #0x77\n"
+		"	sta [0x20],y\n" 	// 0x0402
+		"	ldx #0\n"
+		"	lda [0x20,x]\n"
+		"	kil\n");
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x0300), 0xFF);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x10), 0x12);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x11), 0x34);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x0402), 0x77);
+	CHECK_EQ(emu.cpu.A, 0x00);
+	emu_free(&emu);
+}
+
+// JMP [addr] takes the high byte from the start of the same page when
+// the pointer is at the end of one
+static void test_jmp_indirect_wrap(void)
+{
+	emu_t emu;
+	run(&emu,
+		"	lda #0x00\n"
+		"	sta 0x02ff\n"
+		"	lda #0x20\n"
+		"	sta 0x0200\n"
+		"	lda #0x30\n"
+		"	sta 0x0300\n"
+		"	jmp [0x02ff]\n"
+		"	[.org 0x2000]\n"
+		"	ldx #1\n"
+		"	kil\n"
+		"	[.org 0x3000]\n"
+		"	ldx #2\n"
+		"	kil\n");
+	CHECK_EQ(emu.cpu.X, 1);
+	emu_free(&emu);
+}
+
+// JSR pushes the address of its last byte, RTS returns past it
+static void test_jsr_rts(void)
+{
+	emu_t emu;
+	run(&emu,
+		"	ldx #0xff\n"
+		"	txs\n"
+		"	jsr sub\n" 			// at 0x1003
+		"	lda #0x11\n"
+		"	kil\n"
+		"sub:\n"
+		"	tsx\n"
+		"	lda 0x0101,x\n"
+		"	sta %0x10\n"
+		"	lda 0x0102,x\n"
+		"	sta %0x11\n"
+		"	rts\n");
+	CHECK_EQ(cpu_read_word(&emu.ram, 0x10), 0x1005);
+	CHECK_EQ(emu.cpu.A, 0x11);
+	CHECK_EQ(emu.cpu.SP, 0xFF);
+	emu_free(&emu);
+}
+
+// Cycles of the instruction at `at`
+static uint64_t cycles_of(const char *src, word at)
+{
+	emu_t emu;
+	CHECK(emu_init(&emu, NULL) == 0);
+	test_load(&emu, src);
+	CHECK(cpu_add_breakpoint(&emu.cpu, at));
+	CHECK_EQ(emu_run(&emu, CPU_BUDGET_CYCLES, 100000), CPU_STOP_BREAKPOINT);
+	cpu_clear_breakpoints(&emu.cpu);
+	const uint64_t start = emu.cpu.cycles;
+	emu_run(&emu, CPU_BUDGET_INSTRUCTIONS, 1);
+	const uint64_t cycles = emu.cpu.cycles - start;
+	emu_free(&emu);
+	return cycles;
+}
+
+static void test_cycles(void)
+{
+	// ldx #n is 2 bytes, the instruction measured is at 0x1002
+	CHECK_EQ(cycles_of("ldx #0\nlda 0x10ff,x\nkil\n", 0x1002), 4);
+	CHECK_EQ(cycles_of("ldx #1\nlda 0x10ff,x\nkil\n", 0x1002), 5);
+	CHECK_EQ(cycles_of("ldx #1\nsta 0x10ff,x\nkil\n", 0x1002), 5);
+	CHECK_EQ(cycles_of("ldx #0\nbne 0x1010\nkil\n", 0x1002), 2);
+	CHECK_EQ(cycles_of("ldx #1\nbne 0x1010\nkil\n", 0x1002), 3);
+	CHECK_EQ(cycles_of("ldx #1\nbne 0x0ff0\nkil\n", 0x1002), 4);
+	CHECK_EQ(cycles_of("ldx #1\nasl 0x0300,x\nkil\n", 0x1002), 7);
+	CHECK_EQ(cycles_of("ldx #1\njsr 0x2000\nkil\n", 0x1002), 6);
+}
+
+int main(void)
+{
+	RUN_TEST(test_results);
+	RUN_TEST(test_memory);
+	RUN_TEST(test_jmp_indirect_wrap);
+	RUN_TEST(test_jsr_rts);
+	RUN_TEST(test_cycles);
+	return TEST_EXIT();
+}
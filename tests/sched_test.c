@@ -0,0 +1,198 @@
+#include "test.h"
+#include "sched.h"
+
+/*
+ * Scheduler order, and events that devices add while the CPU runs
+ */
+
+typedef struct log
+{
+	uint64_t order[16]; 	// `when` of every event run, in run order
+	unsigned n;
+} log_t;
+
+static void log_event(void *ctx, uint64_t when)
+{
+	log_t *log = ctx;
+	log->order[log->n++] = when;
+}
+
+static void test_order(void)
+{
+	sched_t sched;
+	sched_init(&sched);
+	log_t log = { 0 };
+
+	sched_add(&sched, 30, log_event, &log);
+	const uint64_t first = sched_add(&sched, 10, log_event, &log);
+	sched_add(&sched, 20, log_event, &log);
+	const uint64_t dropped = sched_add(&sched, 25, log_event, &log);
+	sched_add(&sched, 10, log_event, &log);
+	CHECK_EQ(sched_next(&sched), 10);
+	CHECK(sched_cancel(&sched, dropped));
+	CHECK(!sched_cancel(&sched, dropped));
+
+	sched_dispatch(&sched, 9);
+	CHECK_EQ(log.n, 0);
+	sched_dispatch(&sched, 20);
+	CHECK_EQ(log.n, 3);
+	CHECK_EQ(log.order[0], 10);
+	CHECK_EQ(log.order[1], 10);
+	CHECK_EQ(log.order[2], 20);
+	CHECK(!sched_cancel(&sched, first));
+	CHECK_EQ(sched_next(&sched), 30);
+
+	sched_dispatch(&sched, UINT64_MAX);
+	CHECK_EQ(log.n, 4);
+	CHECK_EQ(sched_next(&sched), UINT64_MAX);
+	sched_free(&sched);
+}
+
+// An event that adds another one due at once, which runs in the same
+// dispatch
+typedef struct chain
+{
+	sched_t *sched;
+	log_t log;
+} chain_t;
+
+static void chain_event(void *ctx, uint64_t when)
+{
+	chain_t *chain = ctx;
+	log_event(&chain->log, when);
+	if(chain->log.n < 3)
+		sched_add(chain->sched, when + 1, chain_event, chain);
+}
+
+static void test_added_in_dispatch(void)
+{
+	sched_t sched;
+	sched_init(&sched);
+	chain_t chain = { &sched, { { 0 }, 0 } };
+	sched_add(&sched, 5, chain_event, &chain);
+	sched_dispatch(&sched, 100);
+	CHECK_EQ(chain.log.n, 3);
+	CHECK_EQ(chain.log.order[2], 7);
+	CHECK_EQ(sched.n, 0);
+	sched_free(&sched);
+}
+
+/*
+ * A timer device at $d000: a write arms an event `delay` cycles later
+ */
+
+typedef struct timer
+{
+	emu_t *emu;
+	uint64_t delay;
+	uint64_t armed_at, when, fired_at;
+	unsigned fired;
+} dev_timer_t;
+
+static void timer_fire(void *ctx, uint64_t when)
+{
+	dev_timer_t *timer = ctx;
+	timer->when = when;
+	timer->fired_at = timer->emu->cpu.cycles;
+	timer->fired++;
+}
+
+static void timer_write(void *ctx, word addr, byte data)
+{
+	(void) addr;
+	(void) data;
+	dev_timer_t *timer = ctx;
+	timer->armed_at = timer->emu->cpu.cycles;
+	emu_schedule(timer->emu, timer->armed_at + timer->delay, timer_fire, timer);
+}
+
+static const char timer_program[] =
+	"	lda #1\n"
+	"	sta 0xd000\n"
+	"loop:\n"
+	"	jmp loop\n";
+
+static void run_timer(const emu_config_t *config, cpu_budget_t kind)
+{
+	emu_t emu;
+	CHECK(emu_init(&emu, config) == 0);
+	dev_timer_t timer = { .emu = &emu, .delay = 10 };
+	ram_map_device(&emu.ram, 0xD0, 1, NULL, timer_write, &timer);
+	test_load(&emu, timer_program);
+
+	// the heap is empty when the run starts
+	CHECK_EQ(emu_run(&emu, kind, 100000), CPU_STOP_BUDGET);
+	CHECK_EQ(timer.fired, 1);
+	CHECK_EQ(timer.when, timer.armed_at + timer.delay);
+	// late by less than one instruction
+	CHECK(timer.fired_at >= timer.when && timer.fired_at < timer.when + 7);
+	emu_free(&emu);
+}
+
+static void test_armed_by_device(void)
+{
+	run_timer(NULL, CPU_BUDGET_CYCLES);
+	run_timer(NULL, CPU_BUDGET_INSTRUCTIONS);
+}
+
+static void test_armed_by_device_cached(void)
+{
+	run_timer(&(emu_config_t) { .block_cache = true }, CPU_BUDGET_CYCLES);
+	run_timer(&(emu_config_t) { .jit = true }, CPU_BUDGET_CYCLES);
+}
+
+// An event later than the one the slice stops at does not cut it short
+static void test_armed_behind_pending(void)
+{
+	emu_t emu;
+	CHECK(emu_init(&emu, NULL) == 0);
+	dev_timer_t timer = { .emu = &emu, .delay = 50 };
+	ram_map_device(&emu.ram, 0xD0, 1, NULL, timer_write, &timer);
+	test_load(&emu, timer_program);
+
+	log_t log = { 0 };
+	emu_schedule(&emu, 20, log_event, &log);
+	CHECK_EQ(emu_run(&emu, CPU_BUDGET_CYCLES, 1000), CPU_STOP_BUDGET);
+	CHECK_EQ(log.n, 1);
+	CHECK_EQ(timer.fired, 1);
+	CHECK(timer.fired_at >= timer.when && timer.fired_at < timer.when + 7);
+	emu_free(&emu);
+}
+
+// A periodic device reschedules itself from its own event
+typedef struct ticker
+{
+	emu_t *emu;
+	unsigned ticks;
+} ticker_t;
+
+static void tick(void *ctx, uint64_t when)
+{
+	ticker_t *ticker = ctx;
+	ticker->ticks++;
+	emu_schedule(ticker->emu, when + 100, tick, ticker);
+}
+
+static void test_periodic(void)
+{
+	emu_t emu;
+	CHECK(emu_init(&emu, NULL) == 0);
+	test_load(&emu, "loop: jmp loop\n");
+	ticker_t ticker = { &emu, 0 };
+	emu_schedule(&emu, 100, tick, &ticker);
+	for(int i = 0; i < 10; i++)
+		CHECK_EQ(emu_run(&emu, CPU_BUDGET_CYCLES, 1000), CPU_STOP_BUDGET);
+	CHECK_EQ(ticker.ticks, emu.cpu.cycles / 100);
+	emu_free(&emu);
+}
+
+int main(void)
+{
+	RUN_TEST(test_order);
+	RUN_TEST(test_added_in_dispatch);
+	RUN_TEST(test_armed_by_device);
+	RUN_TEST(test_armed_by_device_cached);
+	RUN_TEST(test_armed_behind_pending);
+	RUN_TEST(test_periodic);
+	return TEST_EXIT();
+}
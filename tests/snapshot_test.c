@@ -0,0 +1,106 @@
+#include "test.h"
+
+/*
+ * Copy-on-write snapshots
+ */
+
+// Counts up in $0200 until the budget runs out
+static const char counter[] =
+	"	ldx #0\n"
+	"loop:\n"
+	"	inx\n"
+	"	stx 0x0200\n"
+	"	jmp loop\n";
+
+static void test_isolation(void)
+{
+	emu_t emu, other;
+	CHECK(emu_init(&emu, NULL) == 0);
+	CHECK(emu_init(&other, NULL) == 0);
+	test_load(&emu, counter);
+	emu_run(&emu, CPU_BUDGET_INSTRUCTIONS, 31);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x0200), 10);
+
+	emu_snapshot_t *first = emu_snapshot(&emu);
+	CHECK(first != NULL);
+	const cpu6502_t at_first = emu.cpu;
+
+	// writes after the snapshot go to copies, not to the snapshot
+	cpu_write_byte(&emu.ram, 0x3000, 0xAA);
+	emu_run(&emu, CPU_BUDGET_INSTRUCTIONS, 30);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x0200), 20);
+	emu_snapshot_t *second = emu_snapshot(&emu);
+	CHECK(second != NULL);
+
+	// pages nobody wrote are shared, the written ones are not
+	CHECK(first->pages[0x10] == second->pages[0x10]);
+	CHECK(first->pages[0x80] == second->pages[0x80]);
+	CHECK(first->pages[0x02] != second->pages[0x02]);
+	CHECK(first->pages[0x30] != second->pages[0x30]);
+
+	emu_restore(&emu, first);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x0200), 10);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x3000), 0);
+	CHECK_EQ(emu.cpu.PC, at_first.PC);
+	CHECK_EQ(emu.cpu.X, at_first.X);
+	CHECK_EQ(emu.cpu.cycles, at_first.cycles);
+
+	// the same snapshot into another instance, which then runs apart
+	emu_restore(&other, second);
+	CHECK_EQ(cpu_read_byte(&other.ram, 0x0200), 20);
+	CHECK_EQ(cpu_read_byte(&other.ram, 0x3000), 0xAA);
+	emu_run(&other, CPU_BUDGET_INSTRUCTIONS, 30);
+	cpu_write_byte(&other.ram, 0x3000, 0x55);
+	CHECK_EQ(cpu_read_byte(&other.ram, 0x0200), 30);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x0200), 10);
+
+	// neither instance changed the snapshots
+	emu_restore(&emu, second);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x0200), 20);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x3000), 0xAA);
+	CHECK_EQ(second->pages[0x30]->bytes[0], 0xAA);
+	CHECK_EQ(first->pages[0x02]->bytes[0], 10);
+
+	// a snapshot outlives the instance it was taken from
+	emu_free(&emu);
+	emu_restore(&other, first);
+	CHECK_EQ(cpu_read_byte(&other.ram, 0x0200), 10);
+	emu_run(&other, CPU_BUDGET_INSTRUCTIONS, 30);
+	CHECK_EQ(cpu_read_byte(&other.ram, 0x0200), 20);
+
+	emu_snapshot_free(first);
+	emu_snapshot_free(second);
+	emu_free(&other);
+}
+
+// Restoring over rewritten code drops the cached blocks of it
+static void test_restore_code(void)
+{
+	emu_t emu;
+	CHECK(emu_init(&emu, &(emu_config_t) { .jit = true }) == 0);
+	test_load(&emu, counter);
+	emu_snapshot_t *snap = emu_snapshot(&emu);
+	CHECK(snap != NULL);
+	emu_run(&emu, CPU_BUDGET_INSTRUCTIONS, 3000);
+	const byte count = cpu_read_byte(&emu.ram, 0x0200);
+
+	// inx becomes dex
+	emu_restore(&emu, snap);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x1002), INS_INX);
+	cpu_write_byte(&emu.ram, 0x1002, INS_DEX);
+	emu_run(&emu, CPU_BUDGET_INSTRUCTIONS, 3000);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x0200), (byte) -count);
+
+	emu_restore(&emu, snap);
+	emu_run(&emu, CPU_BUDGET_INSTRUCTIONS, 3000);
+	CHECK_EQ(cpu_read_byte(&emu.ram, 0x0200), count);
+	emu_snapshot_free(snap);
+	emu_free(&emu);
+}
+
+int main(void)
+{
+	RUN_TEST(test_isolation);
+	RUN_TEST(test_restore_code);
+	return TEST_EXIT();
+}
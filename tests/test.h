@@ -0,0 +1,73 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm.h"
+#include "emu.h"
+
+/*
+ *
+ * Minimal test harness
+ *
+ * Every tests/<name>_test.c is a program of its own, built against the
+ * core library by `make test`, that exits non-zero if a check failed.
+ * Checks report the file and line and let the test go on.
+ *
+ * */
+
+static int test_failures;
+
+#define CHECK(cond) \
+	do \
+	{ \
+		if(!(cond)) \
+		{ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			test_failures++; \
+		} \
+	} while(0)
+
+#define CHECK_EQ(a, b) \
+	do \
+	{ \
+		const long long a_ = (long long) (a), b_ = (long long) (b); \
+		if(a_ != b_) \
+		{ \
+			fprintf(stderr, "%s:%d: %s is %lld (0x%llx), expected %lld (0x%llx)\n", \
+					__FILE__, __LINE__, #a, a_, (unsigned long long) a_, b_, (unsigned long long) b_); \
+			test_failures++; \
+		} \
+	} while(0)
+
+#define RUN_TEST(fn) \
+	do \
+	{ \
+		const int before_ = test_failures; \
+		fn(); \
+		printf("%-40s %s\n", #fn, test_failures == before_ ? "ok" : "FAILED"); \
+	} while(0)
+
+#define TEST_EXIT() (test_failures ? EXIT_FAILURE : EXIT_SUCCESS)
+
+// Assemble `src` into `emu`, which starts at its entry point on the next
+// run. Aborts the test program if the source does not assemble.
+static inline void test_load(emu_t *emu, const char *src)
+{
+	asm_error_t err;
+	size_t len;
+	byte *image = asm_assemble(src, strlen(src), &len, &err);
+	if(!image)
+	{
+		fprintf(stderr, "test program does not assemble: line %u: %s\n", err.line, err.msg);
+		exit(EXIT_FAILURE);
+	}
+	if(emu_load_ef_image(emu, image, len) < 0)
+		exit(EXIT_FAILURE);
+	free(image);
+}
+
+#endif